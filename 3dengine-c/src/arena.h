@@ -0,0 +1,110 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Linear arena for memory that only lives for one frame
+// Allocations bump an offset into a single block, and all of them are
+// released at once by resetting the arena at the start of the next frame.
+// A frame needing more than the block holds gets extra blocks from malloc,
+// and the next reset replaces everything with one block big enough for that
+// frame, so once the working set is known frames run without calling malloc.
+///////////////////////////////////////////////////////////////////////////////
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_overflow {
+    struct arena_overflow* next;
+} arena_overflow;
+
+typedef struct {
+    unsigned char* base;
+    size_t size;
+    size_t used;
+
+    // Blocks allocated past the end of the base block this frame
+    arena_overflow* overflow;
+    size_t overflow_size;
+
+    size_t peak; // bytes used by the largest frame so far
+} arena;
+
+bool arena_init(arena* a, size_t size) {
+    arena empty = { 0 };
+    *a = empty;
+    a->base = malloc(size);
+    if (!a->base) {
+        fprintf(stderr, "Error trying to allocate memory for the frame arena.\n");
+        return false;
+    }
+    a->size = size;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocate an aligned block that lives until the next reset; returns NULL
+// only when out of memory
+///////////////////////////////////////////////////////////////////////////////
+void* arena_alloc(arena* a, size_t bytes) {
+    size_t offset = (a->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (offset + bytes <= a->size) {
+        a->used = offset + bytes;
+        return a->base + offset;
+    }
+
+    // Out of room: a block of its own for this frame, with the link to the
+    // other ones in front of it padded to keep the alignment
+    arena_overflow* block = malloc(ARENA_ALIGNMENT + bytes);
+    if (!block) {
+        fprintf(stderr, "Error trying to allocate memory for the frame arena.\n");
+        return NULL;
+    }
+    block->next = a->overflow;
+    a->overflow = block;
+    a->overflow_size += ARENA_ALIGNMENT + bytes;
+    return (unsigned char*) block + ARENA_ALIGNMENT;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Release everything allocated since the last reset, growing the base block
+// to fit the whole frame if it overflowed
+///////////////////////////////////////////////////////////////////////////////
+void arena_reset(arena* a) {
+    size_t frame_size = a->used + a->overflow_size;
+    if (frame_size > a->peak)
+        a->peak = frame_size;
+
+    if (a->overflow) {
+        while (a->overflow) {
+            arena_overflow* next = a->overflow->next;
+            free(a->overflow);
+            a->overflow = next;
+        }
+        a->overflow_size = 0;
+
+        size_t size = a->size > 0 ? a->size : ARENA_ALIGNMENT;
+        while (size < frame_size)
+            size *= 2;
+        unsigned char* grown = malloc(size);
+        if (grown) {
+            free(a->base);
+            a->base = grown;
+            a->size = size;
+        } else {
+            fprintf(stderr, "Error trying to grow the frame arena to %zu bytes.\n", size);
+        }
+    }
+    a->used = 0;
+}
+
+void arena_free(arena* a) {
+    arena_reset(a);
+    free(a->base);
+    arena empty = { 0 };
+    *a = empty;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Typed growable arrays
+// ARRAY_DEFINE(name, type) declares a struct `name` holding its elements
+// inline, and the functions name_init, name_reserve, name_push, name_append,
+// name_swap_remove, name_clear and name_free working on it. Elements are
+// read and written directly through `elements[i]` for i below `length`.
+// Removal moves the last element into the freed slot, so it is O(1) but
+// does not keep the order.
+//
+// Growth is tuned for the loaders, which push many small elements one at a
+// time: the first allocation already takes ARRAY_MIN_BYTES, capacity then
+// doubles, and past ARRAY_DOUBLING_LIMIT bytes it only grows by half so that
+// very large meshes do not leave most of a huge block unused. When the final
+// size is known, reserve it up front and no growth happens at all.
+///////////////////////////////////////////////////////////////////////////////
+#define ARRAY_MIN_BYTES 4096
+#define ARRAY_DOUBLING_LIMIT (64 * 1024 * 1024)
+
+///////////////////////////////////////////////////////////////////////////////
+// Grow a heap block so it holds at least `needed` elements; shared by every
+// array type
+///////////////////////////////////////////////////////////////////////////////
+bool array_grow(void** elements, int* capacity, int needed, size_t element_size) {
+    if (needed <= *capacity)
+        return true;
+
+    size_t new_capacity = (size_t)*capacity;
+    if (new_capacity * element_size < ARRAY_MIN_BYTES)
+        new_capacity = (ARRAY_MIN_BYTES + element_size - 1) / element_size;
+    while (new_capacity < (size_t)needed) {
+        if (new_capacity * element_size < ARRAY_DOUBLING_LIMIT)
+            new_capacity *= 2;
+        else
+            new_capacity += new_capacity / 2;
+    }
+    if (new_capacity > INT32_MAX)
+        new_capacity = INT32_MAX;
+    if (new_capacity < (size_t)needed) {
+        fprintf(stderr, "Error growing an array past %d elements.\n", INT32_MAX);
+        return false;
+    }
+
+    void* grown = realloc(*elements, new_capacity * element_size);
+    if (!grown) {
+        fprintf(stderr, "Error trying to allocate memory for an array of %zu elements.\n", new_capacity);
+        return false;
+    }
+    *elements = grown;
+    *capacity = (int)new_capacity;
+    return true;
+}
+
+#define ARRAY_DEFINE(name, type)                                                   \
+    typedef struct {                                                               \
+        type* elements;                                                            \
+        int length;                                                                \
+        int capacity;                                                              \
+    } name;                                                                        \
+                                                                                   \
+    void name##_init(name* a) {                                                    \
+        a->elements = NULL;                                                        \
+        a->length = 0;                                                             \
+        a->capacity = 0;                                                           \
+    }                                                                              \
+                                                                                   \
+    /* Make room for at least `capacity` elements in total */                      \
+    bool name##_reserve(name* a, int capacity) {                                   \
+        if (capacity <= a->capacity)                                               \
+            return true;                                                           \
+        void* elements = a->elements;                                              \
+        if (!array_grow(&elements, &a->capacity, capacity, sizeof(type)))          \
+            return false;                                                          \
+        a->elements = (type*) elements;                                            \
+        return true;                                                               \
+    }                                                                              \
+                                                                                   \
+    bool name##_push(name* a, type element) {                                      \
+        if (a->length == a->capacity && !name##_reserve(a, a->length + 1))         \
+            return false;                                                          \
+        a->elements[a->length++] = element;                                        \
+        return true;                                                               \
+    }                                                                              \
+                                                                                   \
+    /* Copy `count` elements to the end with a single capacity check */            \
+    bool name##_append(name* a, const type* elements, int count) {                 \
+        if (count <= 0)                                                            \
+            return true;                                                           \
+        if (!name##_reserve(a, a->length + count))                                 \
+            return false;                                                          \
+        memcpy(a->elements + a->length, elements, sizeof(type) * (size_t)count);   \
+        a->length += count;                                                        \
+        return true;                                                               \
+    }                                                                              \
+                                                                                   \
+    /* Remove an element by moving the last one into its slot */                   \
+    void name##_swap_remove(name* a, int index) {                                  \
+        if (index < 0 || index >= a->length)                                      \
+            return;                                                                \
+        a->elements[index] = a->elements[--a->length];                             \
+    }                                                                              \
+                                                                                   \
+    void name##_clear(name* a) {                                                   \
+        a->length = 0;                                                             \
+    }                                                                              \
+                                                                                   \
+    void name##_free(name* a) {                                                    \
+        free(a->elements);                                                         \
+        name##_init(a);                                                            \
+    }
+
+ARRAY_DEFINE(int_array, int)
+ARRAY_DEFINE(uint32_array, uint32_t)
+ARRAY_DEFINE(float_array, float)
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Alpha blending of colors over the color buffer
+// Straight colors keep their channels as they are and their opacity in the
+// alpha byte; premultiplied colors have their channels already scaled by
+// it, which saves the multiply of the source. Either way the destination
+// stays opaque.
+// Every channel is blended in 16 bits, with the division by 255 done
+// exactly as (x + 128 + ((x + 128) >> 8)) >> 8, so the SSE2 kernels (four
+// pixels per register) give the same colors as the scalar ones. A source
+// whose alpha is 0 leaves the destination as it was.
+///////////////////////////////////////////////////////////////////////////////
+
+// The kernels have an SSE2 version picked at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLEND_SIMD_X86 1
+#include <emmintrin.h>
+#define BLEND_TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+
+uint32_t blend_divide_255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+uint32_t premultiply_color(uint32_t color) {
+    uint32_t alpha = color >> 24;
+    uint32_t result = color & 0xFF000000;
+    for (int shift = 0; shift < 24; shift += 8)
+        result |= blend_divide_255(((color >> shift) & 0xFF) * alpha) << shift;
+    return result;
+}
+
+uint32_t blend_straight(uint32_t destination, uint32_t source) {
+    uint32_t alpha = source >> 24;
+    uint32_t result = 0xFF000000;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t s = (source >> shift) & 0xFF, d = (destination >> shift) & 0xFF;
+        result |= blend_divide_255(s * alpha + d * (255 - alpha)) << shift;
+    }
+    return result;
+}
+
+uint32_t blend_premultiplied(uint32_t destination, uint32_t source) {
+    uint32_t alpha = source >> 24;
+    uint32_t result = 0xFF000000;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t s = (source >> shift) & 0xFF, d = (destination >> shift) & 0xFF;
+        uint32_t channel = s + blend_divide_255(d * (255 - alpha));
+        result |= (channel > 0xFF ? 0xFF : channel) << shift;
+    }
+    return result;
+}
+
+#ifdef BLEND_SIMD_X86
+// Alpha of every pixel spread over its four 16-bit channel lanes
+BLEND_TARGET_SSE2 __m128i blend_alpha_lanes_sse2(__m128i pixels16) {
+    __m128i alpha = _mm_shufflelo_epi16(pixels16, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+BLEND_TARGET_SSE2 __m128i blend_divide_255_sse2(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Two pixels widened to 16 bits: source * alpha + destination * (255 - alpha)
+BLEND_TARGET_SSE2 __m128i blend_straight_half_sse2(__m128i source, __m128i destination) {
+    __m128i alpha = blend_alpha_lanes_sse2(source);
+    __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(source, alpha), _mm_mullo_epi16(destination, inverse));
+    return blend_divide_255_sse2(sum);
+}
+
+BLEND_TARGET_SSE2 __m128i blend_premultiplied_half_sse2(__m128i source, __m128i destination) {
+    __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), blend_alpha_lanes_sse2(source));
+    return blend_divide_255_sse2(_mm_mullo_epi16(destination, inverse));
+}
+
+BLEND_TARGET_SSE2 void blend_run_sse2(uint32_t* destination, const uint32_t* source, int count, bool premultiplied) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*) &source[i]);
+        __m128i d = _mm_loadu_si128((const __m128i*) &destination[i]);
+        __m128i s_low = _mm_unpacklo_epi8(s, zero), s_high = _mm_unpackhi_epi8(s, zero);
+        __m128i d_low = _mm_unpacklo_epi8(d, zero), d_high = _mm_unpackhi_epi8(d, zero);
+        __m128i blended;
+        if (premultiplied) {
+            blended = _mm_packus_epi16(blend_premultiplied_half_sse2(s_low, d_low), blend_premultiplied_half_sse2(s_high, d_high));
+            blended = _mm_adds_epu8(blended, s);
+        } else {
+            blended = _mm_packus_epi16(blend_straight_half_sse2(s_low, d_low), blend_straight_half_sse2(s_high, d_high));
+        }
+        _mm_storeu_si128((__m128i*) &destination[i], _mm_or_si128(blended, opaque));
+    }
+    for (; i < count; i++)
+        destination[i] = premultiplied ? blend_premultiplied(destination[i], source[i]) : blend_straight(destination[i], source[i]);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Blend a run of source colors over as many destination pixels
+///////////////////////////////////////////////////////////////////////////////
+void blend_run(uint32_t* destination, const uint32_t* source, int count, bool premultiplied) {
+#ifdef BLEND_SIMD_X86
+    if (__builtin_cpu_supports("sse2")) {
+        blend_run_sse2(destination, source, count, premultiplied);
+        return;
+    }
+#endif
+    for (int i = 0; i < count; i++)
+        destination[i] = premultiplied ? blend_premultiplied(destination[i], source[i]) : blend_straight(destination[i], source[i]);
+}
+
+#endif
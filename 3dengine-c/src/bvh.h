@@ -0,0 +1,571 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "vector.h"
+#include "frustum.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Bounding volume hierarchy over world-space bounding boxes
+// Every node covers one contiguous range of items[], the box indices in
+// leaf order, so a node found entirely inside the frustum hands out its
+// whole range without further tests. The two children of a node are stored
+// next to each other and after their parent, so walking the nodes backwards
+// refits children before parents.
+// The tree is built top-down with binned SAH (surface area heuristic), the
+// upper levels handing their right subtree to a worker thread. Moving boxes
+// are refitted in place every frame: only the leaves holding them and the
+// ancestors of those leaves, found through the leaf of every item and the
+// parent of every node, unless so many moved that refitting the whole tree
+// is cheaper. Once the SAH cost of the refitted tree grows
+// BVH_REBUILD_RATIO times past the cost it was built with, it is rebuilt
+// from scratch.
+///////////////////////////////////////////////////////////////////////////////
+#define BVH_BINS 16
+#define BVH_MAX_LEAF_SIZE 8
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_REBUILD_RATIO 1.5f
+#define BVH_PARALLEL_MIN_ITEMS 4096
+#define BVH_MAX_BUILD_THREADS 8
+#define BVH_FULL_REFIT_SHARE 4 // refit every node once 1 box in 4 moved
+
+typedef struct {
+    float min[3];
+    float max[3];
+} aabb;
+
+typedef struct {
+    aabb bounds;
+    int child; // left child, the right one follows it; 0 for leaves
+    int first;
+    int count;
+} bvh_node;
+
+typedef struct {
+    bvh_node* nodes;
+    int num_nodes;
+    int* items;
+    int num_items;
+    int* parents; // parent of every node, -1 for the root
+    int* item_leaves; // leaf node holding every box
+    bool* refit_marks; // nodes already listed for the refit under way
+    int* refit_nodes;
+    float node_cost; // sum of the SAH costs of all nodes
+    float build_cost;
+    float cost;
+    float build_ms; // time the last build took
+} bvh;
+
+///////////////////////////////////////////////////////////////////////////////
+// Bounding box helpers
+///////////////////////////////////////////////////////////////////////////////
+aabb aabb_empty(void) {
+    aabb box = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+    return box;
+}
+
+void aabb_grow(aabb* box, const aabb* other) {
+    for (int k = 0; k < 3; k++) {
+        box->min[k] = other->min[k] < box->min[k] ? other->min[k] : box->min[k];
+        box->max[k] = other->max[k] > box->max[k] ? other->max[k] : box->max[k];
+    }
+}
+
+float aabb_area(const aabb* box) {
+    float dx = box->max[0] - box->min[0];
+    float dy = box->max[1] - box->min[1];
+    float dz = box->max[2] - box->min[2];
+    if (dx < 0 || dy < 0 || dz < 0)
+        return 0;
+    return 2 * (dx * dy + dy * dz + dz * dx);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Top-down build into scratch nodes
+// A subtree over n boxes never needs more than 2n - 1 nodes, so every
+// subtree owns that many scratch nodes from its root on and subtrees built
+// on different threads never touch the same memory. The scratch tree is then
+// flattened into the final layout.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    aabb bounds;
+    int left;
+    int right;
+    int first;
+    int count;
+} bvh_build_node;
+
+// Boxes are copied next to their index and centroid and partitioned in
+// place, so every level of the build reads its range sequentially
+typedef struct {
+    aabb box;
+    float centroid[3];
+    int index;
+} bvh_build_item;
+
+typedef struct {
+    bvh_build_item* items;
+    bvh_build_node* nodes;
+    int parallel_depth;
+} bvh_builder;
+
+typedef struct {
+    bvh_builder* builder;
+    int node;
+    int first;
+    int count;
+    int depth;
+} bvh_build_task;
+
+void bvh_build_node_recursive(bvh_builder* builder, int node, int first, int count, int depth);
+
+int bvh_build_worker(void* data) {
+    bvh_build_task* task = (bvh_build_task*) data;
+    bvh_build_node_recursive(task->builder, task->node, task->first, task->count, task->depth);
+    return 0;
+}
+
+void bvh_build_node_recursive(bvh_builder* builder, int node, int first, int count, int depth) {
+    bvh_build_item* items = builder->items;
+    bvh_build_node* n = &builder->nodes[node];
+
+    aabb centroids = aabb_empty();
+    n->bounds = aabb_empty();
+    n->left = n->right = -1;
+    n->first = first;
+    n->count = count;
+    for (int i = first; i < first + count; i++) {
+        aabb_grow(&n->bounds, &items[i].box);
+        for (int k = 0; k < 3; k++) {
+            float c = items[i].centroid[k];
+            centroids.min[k] = c < centroids.min[k] ? c : centroids.min[k];
+            centroids.max[k] = c > centroids.max[k] ? c : centroids.max[k];
+        }
+    }
+    if (count == 1)
+        return;
+
+    // Bin the centroids along all three axes in one pass; small ranges
+    // get as many bins as they have boxes
+    int num_bins = count < BVH_BINS ? count : BVH_BINS;
+    float bin_scale[3];
+    for (int k = 0; k < 3; k++) {
+        float extent = centroids.max[k] - centroids.min[k];
+        bin_scale[k] = extent > 0 ? num_bins * 0.9999f / extent : 0;
+    }
+    int bin_counts[3][BVH_BINS] = { { 0 } };
+    aabb bin_bounds[3][BVH_BINS];
+    for (int k = 0; k < 3; k++) {
+        for (int b = 0; b < num_bins; b++)
+            bin_bounds[k][b] = aabb_empty();
+    }
+    for (int i = first; i < first + count; i++) {
+        for (int k = 0; k < 3; k++) {
+            int b = (int)((items[i].centroid[k] - centroids.min[k]) * bin_scale[k]);
+            bin_counts[k][b]++;
+            aabb_grow(&bin_bounds[k][b], &items[i].box);
+        }
+    }
+
+    // Sweep the bins of each axis for the cheapest split
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    int best_split = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        if (bin_scale[axis] == 0)
+            continue;
+
+        float right_area[BVH_BINS];
+        int right_count[BVH_BINS];
+        aabb right = aabb_empty();
+        int right_total = 0;
+        for (int b = num_bins - 1; b > 0; b--) {
+            aabb_grow(&right, &bin_bounds[axis][b]);
+            right_total += bin_counts[axis][b];
+            right_area[b] = aabb_area(&right);
+            right_count[b] = right_total;
+        }
+
+        aabb left = aabb_empty();
+        int left_total = 0;
+        for (int b = 0; b < num_bins - 1; b++) {
+            aabb_grow(&left, &bin_bounds[axis][b]);
+            left_total += bin_counts[axis][b];
+            if (left_total == 0 || right_count[b + 1] == 0)
+                continue;
+            float cost = aabb_area(&left) * left_total + right_area[b + 1] * right_count[b + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b + 1;
+            }
+        }
+    }
+
+    int mid;
+    if (best_axis < 0) {
+        // Every centroid in one spot: keep a small leaf or halve the range
+        if (count <= BVH_MAX_LEAF_SIZE)
+            return;
+        mid = first + count / 2;
+    } else {
+        float area = aabb_area(&n->bounds);
+        if (count <= BVH_MAX_LEAF_SIZE && area * count <= area * BVH_TRAVERSAL_COST + best_cost)
+            return;
+
+        int i = first;
+        int j = first + count - 1;
+        while (i <= j) {
+            int b = (int)((items[i].centroid[best_axis] - centroids.min[best_axis]) * bin_scale[best_axis]);
+            if (b < best_split) {
+                i++;
+            } else {
+                bvh_build_item swap = items[i];
+                items[i] = items[j];
+                items[j--] = swap;
+            }
+        }
+        mid = i;
+    }
+
+    int left_count = mid - first;
+    n->left = node + 1;
+    n->right = node + 2 * left_count;
+
+    // Hand the right subtree to another thread near the top of big trees
+    SDL_Thread* thread = NULL;
+    bvh_build_task task = { builder, n->right, mid, count - left_count, depth + 1 };
+    if (depth < builder->parallel_depth && count >= BVH_PARALLEL_MIN_ITEMS)
+        thread = SDL_CreateThread(bvh_build_worker, "bvh_build", &task);
+    bvh_build_node_recursive(builder, n->left, first, left_count, depth + 1);
+    if (thread != NULL)
+        SDL_WaitThread(thread, NULL);
+    else
+        bvh_build_worker(&task);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SAH cost of one node, and a sum of node costs relative to the root area
+///////////////////////////////////////////////////////////////////////////////
+float bvh_node_cost(const bvh_node* node) {
+    float area = aabb_area(&node->bounds);
+    return node->child ? area * BVH_TRAVERSAL_COST : area * node->count;
+}
+
+float bvh_relative_cost(const bvh* tree, float node_cost) {
+    float root_area = tree->num_nodes > 0 ? aabb_area(&tree->nodes[0].bounds) : 0;
+    return root_area > 0 ? node_cost / root_area : 0;
+}
+
+void bvh_free(bvh* tree) {
+    free(tree->nodes);
+    free(tree->items);
+    free(tree->parents);
+    free(tree->item_leaves);
+    free(tree->refit_marks);
+    free(tree->refit_nodes);
+    bvh empty = { 0 };
+    *tree = empty;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the tree from scratch over an array of boxes
+///////////////////////////////////////////////////////////////////////////////
+bool bvh_build(bvh* tree, const aabb* boxes, int num_boxes) {
+    bvh_free(tree);
+    if (num_boxes == 0)
+        return true;
+
+    int max_nodes = 2 * num_boxes - 1;
+    tree->items = (int*) malloc(sizeof(int) * num_boxes);
+    tree->nodes = (bvh_node*) malloc(sizeof(bvh_node) * max_nodes);
+    tree->parents = (int*) malloc(sizeof(int) * max_nodes);
+    tree->item_leaves = (int*) malloc(sizeof(int) * num_boxes);
+    tree->refit_marks = (bool*) calloc(max_nodes, sizeof(bool));
+    tree->refit_nodes = (int*) malloc(sizeof(int) * max_nodes);
+    bvh_build_node* scratch = (bvh_build_node*) malloc(sizeof(bvh_build_node) * max_nodes);
+    bvh_build_item* build_items = (bvh_build_item*) malloc(sizeof(bvh_build_item) * num_boxes);
+    int* stack = (int*) malloc(sizeof(int) * 2 * max_nodes);
+    if (!tree->items || !tree->nodes || !tree->parents || !tree->item_leaves ||
+        !tree->refit_marks || !tree->refit_nodes || !scratch || !build_items || !stack) {
+        fprintf(stderr, "Error trying to allocate memory for the BVH.\n");
+        free(scratch);
+        free(build_items);
+        free(stack);
+        bvh_free(tree);
+        return false;
+    }
+    tree->num_items = num_boxes;
+    for (int i = 0; i < num_boxes; i++) {
+        build_items[i].box = boxes[i];
+        for (int k = 0; k < 3; k++)
+            build_items[i].centroid[k] = (boxes[i].min[k] + boxes[i].max[k]) * 0.5f;
+        build_items[i].index = i;
+    }
+
+    int threads = SDL_GetCPUCount();
+    if (threads > BVH_MAX_BUILD_THREADS)
+        threads = BVH_MAX_BUILD_THREADS;
+    bvh_builder builder = { .items = build_items, .nodes = scratch, .parallel_depth = 0 };
+    while ((1 << builder.parallel_depth) < threads)
+        builder.parallel_depth++;
+    bvh_build_node_recursive(&builder, 0, 0, num_boxes, 0);
+    for (int i = 0; i < num_boxes; i++)
+        tree->items[i] = build_items[i].index;
+    free(build_items);
+
+    // Flatten, giving the children of each node two adjacent slots
+    int top = 0;
+    stack[top++] = 0;
+    stack[top++] = 0;
+    tree->num_nodes = 1;
+    tree->parents[0] = -1;
+    while (top > 0) {
+        int target = stack[--top];
+        int source = stack[--top];
+        const bvh_build_node* from = &scratch[source];
+        bvh_node* to = &tree->nodes[target];
+        to->bounds = from->bounds;
+        to->first = from->first;
+        to->count = from->count;
+        to->child = 0;
+        if (from->left >= 0) {
+            to->child = tree->num_nodes;
+            tree->num_nodes += 2;
+            tree->parents[to->child] = target;
+            tree->parents[to->child + 1] = target;
+            stack[top++] = from->left;
+            stack[top++] = to->child;
+            stack[top++] = from->right;
+            stack[top++] = to->child + 1;
+        }
+    }
+    free(scratch);
+    free(stack);
+
+    tree->node_cost = 0;
+    for (int i = 0; i < tree->num_nodes; i++) {
+        const bvh_node* node = &tree->nodes[i];
+        for (int j = node->first; !node->child && j < node->first + node->count; j++)
+            tree->item_leaves[tree->items[j]] = i;
+        tree->node_cost += bvh_node_cost(node);
+    }
+    tree->build_cost = tree->cost = bvh_relative_cost(tree, tree->node_cost);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Refit the bounds of one node, from its children or from its boxes
+///////////////////////////////////////////////////////////////////////////////
+void bvh_refit_node(bvh* tree, const aabb* boxes, int index) {
+    bvh_node* node = &tree->nodes[index];
+    if (node->child) {
+        node->bounds = tree->nodes[node->child].bounds;
+        aabb_grow(&node->bounds, &tree->nodes[node->child + 1].bounds);
+    } else {
+        node->bounds = aabb_empty();
+        for (int j = node->first; j < node->first + node->count; j++)
+            aabb_grow(&node->bounds, &boxes[tree->items[j]]);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Refit the bounds of every node to the current boxes, children first
+///////////////////////////////////////////////////////////////////////////////
+void bvh_refit(bvh* tree, const aabb* boxes) {
+    tree->node_cost = 0;
+    for (int i = tree->num_nodes - 1; i >= 0; i--) {
+        bvh_refit_node(tree, boxes, i);
+        tree->node_cost += bvh_node_cost(&tree->nodes[i]);
+    }
+    tree->cost = bvh_relative_cost(tree, tree->node_cost);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Refit only the leaves holding the given boxes and their ancestors
+// Every path up to the root stops at the first node an earlier box already
+// listed. Children have higher indices than their parents, so refitting
+// the list from the highest index down refits children first.
+///////////////////////////////////////////////////////////////////////////////
+int bvh_compare_descending(const void* a, const void* b) {
+    return *(const int*) b - *(const int*) a;
+}
+
+void bvh_refit_items(bvh* tree, const aabb* boxes, const int* items, int count) {
+    int num_listed = 0;
+    for (int i = 0; i < count; i++) {
+        for (int n = tree->item_leaves[items[i]]; n >= 0 && !tree->refit_marks[n]; n = tree->parents[n]) {
+            tree->refit_marks[n] = true;
+            tree->refit_nodes[num_listed++] = n;
+        }
+    }
+    qsort(tree->refit_nodes, num_listed, sizeof(int), bvh_compare_descending);
+
+    for (int i = 0; i < num_listed; i++) {
+        int n = tree->refit_nodes[i];
+        tree->node_cost -= bvh_node_cost(&tree->nodes[n]);
+        bvh_refit_node(tree, boxes, n);
+        tree->node_cost += bvh_node_cost(&tree->nodes[n]);
+        tree->refit_marks[n] = false;
+    }
+    tree->cost = bvh_relative_cost(tree, tree->node_cost);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bring the tree up to date with the boxes: refit it around the moved boxes
+// (all of them when moved is NULL), or rebuild it when the number of boxes
+// changed or refitting has worn the tree down
+///////////////////////////////////////////////////////////////////////////////
+bool bvh_update(bvh* tree, const aabb* boxes, int num_boxes, const int* moved, int num_moved) {
+    if (num_boxes == tree->num_items && tree->num_nodes > 0) {
+        if (moved == NULL || num_moved * BVH_FULL_REFIT_SHARE > num_boxes)
+            bvh_refit(tree, boxes);
+        else
+            bvh_refit_items(tree, boxes, moved, num_moved);
+        if (tree->cost <= tree->build_cost * BVH_REBUILD_RATIO)
+            return true;
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    if (!bvh_build(tree, boxes, num_boxes))
+        return false;
+    tree->build_ms = (float)((SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Frustum culling: collect the items whose boxes touch the frustum
+// Planes a node lies entirely inside of are dropped from the mask of its
+// subtree; once no planes are left, the whole range is visible.
+///////////////////////////////////////////////////////////////////////////////
+bool bvh_box_in_frustum(const frustum* f, const aabb* box, int* plane_mask) {
+    for (int p = 0; p < 6; p++) {
+        if (!(*plane_mask & (1 << p)))
+            continue;
+        const plane* pl = &f->planes[p];
+        float normal[3] = { pl->normal.x, pl->normal.y, pl->normal.z };
+        float nearest = pl->distance;
+        float farthest = pl->distance;
+        for (int k = 0; k < 3; k++) {
+            if (normal[k] >= 0) {
+                farthest += normal[k] * box->max[k];
+                nearest += normal[k] * box->min[k];
+            } else {
+                farthest += normal[k] * box->min[k];
+                nearest += normal[k] * box->max[k];
+            }
+        }
+        if (farthest < 0)
+            return false;
+        if (nearest >= 0)
+            *plane_mask &= ~(1 << p);
+    }
+    return true;
+}
+
+void bvh_cull_node(const bvh* tree, const aabb* boxes, const frustum* f, int index, int plane_mask, int* visible, int* num_visible) {
+    const bvh_node* node = &tree->nodes[index];
+    if (!bvh_box_in_frustum(f, &node->bounds, &plane_mask))
+        return;
+
+    if (plane_mask == 0) {
+        memcpy(&visible[*num_visible], &tree->items[node->first], sizeof(int) * node->count);
+        *num_visible += node->count;
+    } else if (node->child) {
+        bvh_cull_node(tree, boxes, f, node->child, plane_mask, visible, num_visible);
+        bvh_cull_node(tree, boxes, f, node->child + 1, plane_mask, visible, num_visible);
+    } else {
+        for (int i = node->first; i < node->first + node->count; i++) {
+            int item_mask = plane_mask;
+            if (bvh_box_in_frustum(f, &boxes[tree->items[i]], &item_mask))
+                visible[(*num_visible)++] = tree->items[i];
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fill visible (room for every item) and return how many items it holds
+///////////////////////////////////////////////////////////////////////////////
+int bvh_cull(const bvh* tree, const aabb* boxes, const frustum* f, int* visible) {
+    int num_visible = 0;
+    if (tree->num_nodes > 0)
+        bvh_cull_node(tree, boxes, f, 0, (1 << 6) - 1, visible, &num_visible);
+    return num_visible;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Ray picking: the item whose box the ray enters first, or -1
+///////////////////////////////////////////////////////////////////////////////
+bool bvh_ray_box(const aabb* box, const float origin[3], const float inverse_direction[3], float max_distance, float* distance) {
+    float t_enter = 0;
+    float t_exit = max_distance;
+    for (int k = 0; k < 3; k++) {
+        float t0 = (box->min[k] - origin[k]) * inverse_direction[k];
+        float t1 = (box->max[k] - origin[k]) * inverse_direction[k];
+        if (t0 > t1) {
+            float swap = t0;
+            t0 = t1;
+            t1 = swap;
+        }
+        if (t0 > t_enter) t_enter = t0;
+        if (t1 < t_exit) t_exit = t1;
+    }
+    *distance = t_enter;
+    return t_enter <= t_exit;
+}
+
+void bvh_pick_node(const bvh* tree, const aabb* boxes, int index, const float origin[3], const float inverse_direction[3], int* picked, float* picked_distance) {
+    const bvh_node* node = &tree->nodes[index];
+    if (!node->child) {
+        for (int i = node->first; i < node->first + node->count; i++) {
+            float distance;
+            if (bvh_ray_box(&boxes[tree->items[i]], origin, inverse_direction, *picked_distance, &distance) &&
+                distance < *picked_distance) {
+                *picked = tree->items[i];
+                *picked_distance = distance;
+            }
+        }
+        return;
+    }
+
+    // Visit the nearer child first so the farther one is often skipped
+    float near_distance, far_distance;
+    int near_child = node->child;
+    int far_child = node->child + 1;
+    bool near_hit = bvh_ray_box(&tree->nodes[near_child].bounds, origin, inverse_direction, *picked_distance, &near_distance);
+    bool far_hit = bvh_ray_box(&tree->nodes[far_child].bounds, origin, inverse_direction, *picked_distance, &far_distance);
+    if (far_hit && (!near_hit || far_distance < near_distance)) {
+        int swap_child = near_child;
+        near_child = far_child;
+        far_child = swap_child;
+        float swap_distance = near_distance;
+        near_distance = far_distance;
+        far_distance = swap_distance;
+        bool swap_hit = near_hit;
+        near_hit = far_hit;
+        far_hit = swap_hit;
+    }
+    if (near_hit)
+        bvh_pick_node(tree, boxes, near_child, origin, inverse_direction, picked, picked_distance);
+    if (far_hit && far_distance < *picked_distance)
+        bvh_pick_node(tree, boxes, far_child, origin, inverse_direction, picked, picked_distance);
+}
+
+int bvh_pick(const bvh* tree, const aabb* boxes, vec3d origin, vec3d direction, float* distance) {
+    float from[3] = { origin.x, origin.y, origin.z };
+    float inverse_direction[3] = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    float root_distance;
+    int picked = -1;
+    *distance = FLT_MAX;
+    if (tree->num_nodes > 0 && bvh_ray_box(&tree->nodes[0].bounds, from, inverse_direction, FLT_MAX, &root_distance))
+        bvh_pick_node(tree, boxes, 0, from, inverse_direction, &picked, distance);
+    return picked;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef COLOR_RAMP_H
+#define COLOR_RAMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Lookup tables for lighting colors
+// Light adds up linearly, but the channels of a color are stored in sRGB,
+// where 128 is about a fifth of the light of 255 rather than half of it.
+// Gamma-correct shading takes every channel to linear light, scales it
+// there and takes it back, which would be two pow calls per channel. The
+// tables hold those conversions, computed once: 256 entries from sRGB to
+// 12-bit linear light and 4096 back.
+// Diffuse light on its own goes through shade ramps instead: for each of the
+// 257 diffuse levels (0 to 256 / 256, as the shading fixes them), the lit
+// sRGB value of every channel value, so a lit color is three lookups.
+// Without gamma correction the ramps scale the channels as they are.
+///////////////////////////////////////////////////////////////////////////////
+#define COLOR_LINEAR_BITS 12
+#define COLOR_LINEAR_MAX ((1 << COLOR_LINEAR_BITS) - 1)
+#define COLOR_RAMP_LEVELS 257
+
+typedef struct {
+    bool gamma;
+    uint16_t to_linear[256];
+    uint8_t to_srgb[COLOR_LINEAR_MAX + 1];
+    uint8_t ramps[COLOR_RAMP_LEVELS][256];
+} color_tables;
+
+color_tables light_tables;
+
+float srgb_to_linear(float c) {
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float linear_to_srgb(float l) {
+    return l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1 / 2.4f) - 0.055f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fill the tables, gamma correct or scaling the sRGB values directly
+///////////////////////////////////////////////////////////////////////////////
+void color_tables_init(color_tables* t, bool gamma) {
+    t->gamma = gamma;
+    for (int c = 0; c < 256; c++) {
+        float linear = gamma ? srgb_to_linear(c / 255.0f) : c / 255.0f;
+        t->to_linear[c] = (uint16_t)(linear * COLOR_LINEAR_MAX + 0.5f);
+    }
+    for (int l = 0; l <= COLOR_LINEAR_MAX; l++) {
+        float linear = (float)l / COLOR_LINEAR_MAX;
+        t->to_srgb[l] = (uint8_t)((gamma ? linear_to_srgb(linear) : linear) * 255 + 0.5f);
+    }
+    for (int level = 0; level < COLOR_RAMP_LEVELS; level++) {
+        for (int c = 0; c < 256; c++) {
+            if (gamma)
+                t->ramps[level][c] = (uint8_t)(linear_to_srgb(srgb_to_linear(c / 255.0f) * level / 256) * 255 + 0.5f);
+            else
+                t->ramps[level][c] = (uint8_t)((c * level) >> 8);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Light a color with a diffuse level from 0 to 256, keeping its alpha
+///////////////////////////////////////////////////////////////////////////////
+uint32_t ramp_color(const color_tables* t, uint32_t color, uint32_t diffuse) {
+    const uint8_t* ramp = t->ramps[diffuse];
+    return (color & 0xFF000000) |
+        ((uint32_t)ramp[(color >> 16) & 0xFF] << 16) |
+        ((uint32_t)ramp[(color >> 8) & 0xFF] << 8) |
+        ramp[color & 0xFF];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Light a color in linear light: every channel times diffuse / 256, plus
+// specular (0 to 255) as an amount of white light, saturated
+///////////////////////////////////////////////////////////////////////////////
+uint32_t ramp_color_specular(const color_tables* t, uint32_t color, uint32_t diffuse, uint32_t specular) {
+    if (specular == 0)
+        return ramp_color(t, color, diffuse);
+    uint32_t added = (specular * 257) >> 4; // 255 becomes COLOR_LINEAR_MAX
+    uint32_t result = color & 0xFF000000;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t channel = ((t->to_linear[(color >> shift) & 0xFF] * diffuse) >> 8) + added;
+        result |= (uint32_t)t->to_srgb[channel > COLOR_LINEAR_MAX ? COLOR_LINEAR_MAX : channel] << shift;
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "vector.h"
+#include "gbuffer.h"
+#include "lighting.h"
+#include "shading.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Lighting pass of the deferred shading mode
+// Once every triangle is in the G-buffer, each drawn pixel is lit exactly
+// once from its depth, normal and material, with the same Lambert and Blinn
+// terms as per-pixel shading, so the cost follows the size of the screen
+// instead of the overdraw. The screen is split along the light tiles, which
+// worker threads take one at a time, and every tile is lit from its own
+// light list, four pixels at a time with SSE2.
+// The workers are started once and sleep between frames until the next
+// pass wakes them.
+///////////////////////////////////////////////////////////////////////////////
+#define DEFERRED_MAX_THREADS 8
+
+typedef struct {
+    const gbuffer* g;
+    const float* depth;
+    const lighting* lights;
+    uint32_t* colors;
+    bool simd;
+    SDL_atomic_t next_tile;
+} deferred_pass;
+
+typedef struct {
+    SDL_Thread* threads[DEFERRED_MAX_THREADS];
+    int num_threads;
+    SDL_mutex* lock;
+    SDL_cond* wake;
+    SDL_cond* done;
+    deferred_pass pass;
+    int frame; // passes started so far
+    int busy; // workers still on the current pass
+    bool quit;
+} deferred_workers;
+
+deferred_workers deferred;
+
+///////////////////////////////////////////////////////////////////////////////
+// Light the drawn pixels of a row of a tile, from x_from up to x_to excluded
+///////////////////////////////////////////////////////////////////////////////
+void deferred_light_row_scalar(const deferred_pass* pass, const uint32_t* list, int num_lights, int y, int x_from, int x_to) {
+    const gbuffer* g = pass->g;
+    const lighting* lights = pass->lights;
+    float view_y = ((float)y - lights->height * 0.5f) * lights->pixel_to_view_y;
+    for (int x = x_from; x < x_to; x++) {
+        int index = y * g->width + x;
+        float depth = pass->depth[index];
+        if (!(depth > 0))
+            continue;
+        float w = 1 / depth;
+        vec3d position = {
+            .x = (((float)x - lights->width * 0.5f) * lights->pixel_to_view_x) * w,
+            .y = view_y * w,
+            .z = w
+        };
+        vec3d normal = gbuffer_unpack_normal(g->normals[index]);
+
+        float diffuse, specular;
+        light_surface(lights, list, num_lights, position, normal, &diffuse, &specular);
+        specular *= g->material_table[g->materials[index]].specular;
+        diffuse = diffuse > 0 ? (diffuse < 1 ? diffuse : 1) : 0;
+        specular = specular > 0 ? (specular < 1 ? specular : 1) : 0;
+        pass->colors[index] = light_color(g->albedo[index], (uint32_t)(diffuse * 256), (uint32_t)(specular * 255));
+    }
+}
+
+#ifdef SHADING_SIMD_X86
+// Same steps as deferred_light_row_scalar, four pixels at a time: the
+// G-buffer of each group is unpacked into lanes, the empty pixels lit as
+// if they faced the viewer and left out of the store
+SHADING_TARGET_SSE2 void deferred_light_row_sse2(const deferred_pass* pass, const uint32_t* list, int num_lights, int y, int x_from, int x_to) {
+    const gbuffer* g = pass->g;
+    const lighting* lights = pass->lights;
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1);
+    __m128 view_y = _mm_set1_ps(((float)y - lights->height * 0.5f) * lights->pixel_to_view_y);
+    __m128 half_width = _mm_set1_ps(lights->width * 0.5f);
+    __m128 pixel_to_view_x = _mm_set1_ps(lights->pixel_to_view_x);
+
+    for (int x = x_from; x < x_to; x += 4) {
+        int index = y * g->width + x;
+        float depth[4], nx[4], ny[4], nz[4], strength[4];
+        uint32_t albedo[4];
+        int drawn = 0;
+        for (int i = 0; i < 4; i++) {
+            if (x + i < x_to && pass->depth[index + i] > 0) {
+                vec3d normal = gbuffer_unpack_normal(g->normals[index + i]);
+                depth[i] = pass->depth[index + i];
+                nx[i] = normal.x;
+                ny[i] = normal.y;
+                nz[i] = normal.z;
+                strength[i] = g->material_table[g->materials[index + i]].specular;
+                albedo[i] = g->albedo[index + i];
+                drawn |= 1 << i;
+            } else {
+                depth[i] = 1;
+                nx[i] = ny[i] = 0;
+                nz[i] = -1;
+                strength[i] = 0;
+                albedo[i] = 0;
+            }
+        }
+        if (!drawn)
+            continue;
+
+        __m128 xs = _mm_add_ps(_mm_set1_ps((float)x), _mm_set_ps(3, 2, 1, 0));
+        __m128 w = _mm_div_ps(one, _mm_loadu_ps(depth));
+        __m128 px = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(xs, half_width), pixel_to_view_x), w);
+        __m128 py = _mm_mul_ps(view_y, w);
+
+        __m128 diffuse, specular;
+        light_surface_sse2(lights, list, num_lights, px, py, w,
+            _mm_loadu_ps(nx), _mm_loadu_ps(ny), _mm_loadu_ps(nz), &diffuse, &specular);
+        specular = _mm_mul_ps(specular, _mm_loadu_ps(strength));
+        diffuse = _mm_max_ps(_mm_min_ps(diffuse, one), zero);
+        specular = _mm_max_ps(_mm_min_ps(specular, one), zero);
+        __m128i diffuse_fixed = _mm_cvttps_epi32(_mm_mul_ps(diffuse, _mm_set1_ps(256)));
+        __m128i specular_fixed = _mm_cvttps_epi32(_mm_mul_ps(specular, _mm_set1_ps(255)));
+        __m128i color = _mm_loadu_si128((const __m128i*) albedo);
+
+        uint32_t lit[4];
+        _mm_storeu_si128((__m128i*) lit, shade_colors_sse2(color, diffuse_fixed, specular_fixed));
+        for (int i = 0; i < 4; i++) {
+            if (drawn & (1 << i))
+                pass->colors[index + i] = lit[i];
+        }
+    }
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Light every drawn pixel of one light tile
+///////////////////////////////////////////////////////////////////////////////
+void deferred_light_tile(const deferred_pass* pass, int tile) {
+    const lighting* lights = pass->lights;
+    int x_from = (tile % lights->tiles_x) << LIGHT_TILE_SHIFT;
+    int y_from = (tile / lights->tiles_x) << LIGHT_TILE_SHIFT;
+    int x_to = x_from + (1 << LIGHT_TILE_SHIFT);
+    int y_to = y_from + (1 << LIGHT_TILE_SHIFT);
+    if (x_to > pass->g->width) x_to = pass->g->width;
+    if (y_to > pass->g->height) y_to = pass->g->height;
+
+    int num_lights;
+    const uint32_t* list = lighting_tile_lights(lights, x_from, y_from, &num_lights);
+    for (int y = y_from; y < y_to; y++) {
+#ifdef SHADING_SIMD_X86
+        if (pass->simd) {
+            deferred_light_row_sse2(pass, list, num_lights, y, x_from, x_to);
+            continue;
+        }
+#endif
+        deferred_light_row_scalar(pass, list, num_lights, y, x_from, x_to);
+    }
+}
+
+void deferred_light_tiles(deferred_pass* pass) {
+    int num_tiles = pass->lights->tiles_x * pass->lights->tiles_y;
+    for (int tile = SDL_AtomicAdd(&pass->next_tile, 1); tile < num_tiles; tile = SDL_AtomicAdd(&pass->next_tile, 1))
+        deferred_light_tile(pass, tile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Worker thread: wait for a pass, take tiles until there are none left, and
+// report back
+///////////////////////////////////////////////////////////////////////////////
+int deferred_light_worker(void* data) {
+    (void)data;
+    int frame = 0;
+    SDL_LockMutex(deferred.lock);
+    while (true) {
+        while (!deferred.quit && deferred.frame == frame)
+            SDL_CondWait(deferred.wake, deferred.lock);
+        if (deferred.quit)
+            break;
+        frame = deferred.frame;
+        SDL_UnlockMutex(deferred.lock);
+
+        deferred_light_tiles(&deferred.pass);
+
+        SDL_LockMutex(deferred.lock);
+        if (--deferred.busy == 0)
+            SDL_CondSignal(deferred.done);
+    }
+    SDL_UnlockMutex(deferred.lock);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start the workers, one fewer than the cores as the calling thread works
+// too; without them the calling thread lights every tile
+///////////////////////////////////////////////////////////////////////////////
+bool deferred_init(void) {
+    deferred.lock = SDL_CreateMutex();
+    deferred.wake = SDL_CreateCond();
+    deferred.done = SDL_CreateCond();
+    deferred.frame = 0;
+    deferred.busy = 0;
+    deferred.quit = false;
+    deferred.num_threads = 0;
+    if (!deferred.lock || !deferred.wake || !deferred.done) {
+        fprintf(stderr, "Error creating the deferred lighting workers.\n");
+        return false;
+    }
+
+    int num_threads = SDL_GetCPUCount() - 1;
+    if (num_threads > DEFERRED_MAX_THREADS - 1)
+        num_threads = DEFERRED_MAX_THREADS - 1;
+    for (int i = 0; i < num_threads; i++) {
+        SDL_Thread* thread = SDL_CreateThread(deferred_light_worker, "deferred_light", NULL);
+        if (!thread) {
+            fprintf(stderr, "Error creating deferred lighting thread.\n");
+            break;
+        }
+        deferred.threads[deferred.num_threads++] = thread;
+    }
+    return true;
+}
+
+void deferred_shutdown(void) {
+    if (!deferred.lock)
+        return;
+    SDL_LockMutex(deferred.lock);
+    deferred.quit = true;
+    SDL_CondBroadcast(deferred.wake);
+    SDL_UnlockMutex(deferred.lock);
+
+    for (int i = 0; i < deferred.num_threads; i++)
+        SDL_WaitThread(deferred.threads[i], NULL);
+    deferred.num_threads = 0;
+
+    SDL_DestroyCond(deferred.done);
+    SDL_DestroyCond(deferred.wake);
+    SDL_DestroyMutex(deferred.lock);
+    deferred.lock = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Light the G-buffer into the color buffer, over the depth it was drawn with
+// and the light tiles binned this frame; the calling thread works on the
+// tiles alongside the workers and returns once they are all done
+///////////////////////////////////////////////////////////////////////////////
+void deferred_light(const gbuffer* g, const float* depth, const lighting* lights, uint32_t* colors) {
+    deferred_pass* pass = &deferred.pass;
+    pass->g = g;
+    pass->depth = depth;
+    pass->lights = lights;
+    pass->colors = colors;
+    pass->simd = false;
+#ifdef SHADING_SIMD_X86
+    pass->simd = __builtin_cpu_supports("sse2");
+#endif
+    SDL_AtomicSet(&pass->next_tile, 0);
+
+    if (deferred.num_threads == 0) {
+        deferred_light_tiles(pass);
+        return;
+    }
+
+    SDL_LockMutex(deferred.lock);
+    deferred.busy = deferred.num_threads;
+    deferred.frame++;
+    SDL_CondBroadcast(deferred.wake);
+    SDL_UnlockMutex(deferred.lock);
+
+    deferred_light_tiles(pass);
+
+    SDL_LockMutex(deferred.lock);
+    while (deferred.busy > 0)
+        SDL_CondWait(deferred.done, deferred.lock);
+    SDL_UnlockMutex(deferred.lock);
+}
+
+#endif
@@ -0,0 +1,519 @@
+#ifndef DEPTH_BUFFER_H
+#define DEPTH_BUFFER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "shading.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Per-pixel depth buffer with a hierarchical min/max depth pyramid
+// Pixels store 1/w, which is linear in screen space and grows towards the
+// camera, and 0 means nothing was drawn there. Above the pixels, every 8x8
+// tile keeps the farthest and the nearest depth it holds, and every 64x64
+// block the farthest depth of its tiles.
+// A triangle is first tested against the blocks it overlaps with its nearest
+// vertex, then against every tile with its own depth at the tile corners:
+// tiles it cannot reach are skipped without reading a single pixel, and
+// tiles it is entirely in front of are written without testing.
+// The farthest depth of a tile stays at 0 until all 64 of its pixels have
+// been drawn, and from then on is only recomputed from the pixels when a
+// triangle overwrites one that was at that depth, so it never claims more
+// than the pixels hold.
+///////////////////////////////////////////////////////////////////////////////
+#define DEPTH_TILE_SHIFT 3   // 8x8 pixel tiles
+#define DEPTH_BLOCK_SHIFT 3  // 8x8 tiles per block of the top level
+
+enum {
+    DEPTH_TILE_TEST,   // test every pixel
+    DEPTH_TILE_REJECT, // the triangle is behind everything in the tile
+    DEPTH_TILE_ACCEPT  // the triangle is in front of everything in the tile
+};
+
+typedef struct {
+    float* pixels;
+    int width;
+    int height;
+
+    float* tile_far;
+    float* tile_near;
+    int tiles_x;
+    int tiles_y;
+
+    float* block_far;
+    int blocks_x;
+    int blocks_y;
+
+    uint64_t* tile_written; // pixels of each tile drawn this frame
+
+    // State of the tiles under the triangle being drawn
+    uint8_t* tile_state;
+    bool* tile_dirty;
+
+    int triangles_drawn;
+    int triangles_rejected;
+    int tiles_rejected;
+} depth_buffer;
+
+///////////////////////////////////////////////////////////////////////////////
+// Depth plane and bounds of the triangle being drawn
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    float dz_dx;
+    float dz_dy;
+    float z_origin;
+    float z_min;
+    float z_max;
+    int x_min, y_min;
+    int x_max, y_max;
+} depth_triangle;
+
+///////////////////////////////////////////////////////////////////////////////
+// Declare the global depth buffer of the frame
+///////////////////////////////////////////////////////////////////////////////
+depth_buffer z_buffer;
+
+bool depth_buffer_init(depth_buffer* buffer, int width, int height) {
+    depth_buffer empty = { 0 };
+    *buffer = empty;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->tiles_x = (width + (1 << DEPTH_TILE_SHIFT) - 1) >> DEPTH_TILE_SHIFT;
+    buffer->tiles_y = (height + (1 << DEPTH_TILE_SHIFT) - 1) >> DEPTH_TILE_SHIFT;
+    buffer->blocks_x = (buffer->tiles_x + (1 << DEPTH_BLOCK_SHIFT) - 1) >> DEPTH_BLOCK_SHIFT;
+    buffer->blocks_y = (buffer->tiles_y + (1 << DEPTH_BLOCK_SHIFT) - 1) >> DEPTH_BLOCK_SHIFT;
+
+    int num_tiles = buffer->tiles_x * buffer->tiles_y;
+    buffer->pixels = malloc(sizeof(float) * width * height);
+    buffer->tile_far = malloc(sizeof(float) * num_tiles);
+    buffer->tile_near = malloc(sizeof(float) * num_tiles);
+    buffer->block_far = malloc(sizeof(float) * buffer->blocks_x * buffer->blocks_y);
+    buffer->tile_written = malloc(sizeof(uint64_t) * num_tiles);
+    buffer->tile_state = malloc(sizeof(uint8_t) * num_tiles);
+    buffer->tile_dirty = malloc(sizeof(bool) * num_tiles);
+    if (!buffer->pixels || !buffer->tile_far || !buffer->tile_near || !buffer->block_far ||
+        !buffer->tile_written || !buffer->tile_state || !buffer->tile_dirty) {
+        fprintf(stderr, "Error trying to allocate memory for the depth buffer.\n");
+        return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reset every level of the buffer to nothing drawn
+///////////////////////////////////////////////////////////////////////////////
+void depth_buffer_clear(depth_buffer* buffer) {
+    int num_tiles = buffer->tiles_x * buffer->tiles_y;
+    memset(buffer->pixels, 0, sizeof(float) * buffer->width * buffer->height);
+    memset(buffer->tile_far, 0, sizeof(float) * num_tiles);
+    memset(buffer->tile_near, 0, sizeof(float) * num_tiles);
+    memset(buffer->block_far, 0, sizeof(float) * buffer->blocks_x * buffer->blocks_y);
+
+    memset(buffer->tile_written, 0, sizeof(uint64_t) * num_tiles);
+
+    // Pixels past the right and bottom edges count as drawn
+    int tile_size = 1 << DEPTH_TILE_SHIFT;
+    int columns = buffer->width & (tile_size - 1), rows = buffer->height & (tile_size - 1);
+    uint64_t outside_row = 0xFFull & ~((1ull << columns) - 1);
+    for (int ty = 0; columns && ty < buffer->tiles_y; ty++) {
+        for (int y = 0; y < tile_size; y++)
+            buffer->tile_written[(ty + 1) * buffer->tiles_x - 1] |= outside_row << (y * tile_size);
+    }
+    for (int tx = 0; rows && tx < buffer->tiles_x; tx++)
+        buffer->tile_written[(buffer->tiles_y - 1) * buffer->tiles_x + tx] |= UINT64_MAX << (rows * tile_size);
+    buffer->triangles_drawn = 0;
+    buffer->triangles_rejected = 0;
+    buffer->tiles_rejected = 0;
+}
+
+void depth_buffer_free(depth_buffer* buffer) {
+    free(buffer->pixels);
+    free(buffer->tile_far);
+    free(buffer->tile_near);
+    free(buffer->block_far);
+    free(buffer->tile_written);
+    free(buffer->tile_state);
+    free(buffer->tile_dirty);
+    depth_buffer empty = { 0 };
+    *buffer = empty;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Depth of the triangle plane at a pixel, kept within the range of its
+// vertices so slivers do not poke through. Every step is monotonic, so along
+// a span or over a rectangle the extremes are always at the ends or corners.
+///////////////////////////////////////////////////////////////////////////////
+float depth_triangle_row(const depth_triangle* t, int y) {
+    return t->z_origin + t->dz_dy * y;
+}
+
+float depth_triangle_at(const depth_triangle* t, float row, int x) {
+    float z = row + t->dz_dx * x;
+    return z < t->z_min ? t->z_min : (z > t->z_max ? t->z_max : z);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Set up the depth plane of a screen triangle (w is the view depth of each
+// vertex) and classify the tiles under it; returns false when the whole
+// triangle is hidden or behind the camera, and nothing needs to be drawn
+///////////////////////////////////////////////////////////////////////////////
+bool depth_triangle_begin(
+    depth_buffer* buffer, depth_triangle* t,
+    int x0, int y0, float w0,
+    int x1, int y1, float w1,
+    int x2, int y2, float w2
+) {
+    if (w0 <= 0 || w1 <= 0 || w2 <= 0)
+        return false;
+    buffer->triangles_drawn++;
+
+    // Pixel bounds, with a pixel of slack on the left where the fill spans
+    // can round down past the leftmost vertex
+    t->x_min = (x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2)) - 1;
+    t->y_min = (y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2));
+    t->x_max = (x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2));
+    t->y_max = (y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2));
+    if (t->x_min < 0) t->x_min = 0;
+    if (t->y_min < 0) t->y_min = 0;
+    if (t->x_max > buffer->width - 1) t->x_max = buffer->width - 1;
+    if (t->y_max > buffer->height - 1) t->y_max = buffer->height - 1;
+    if (t->x_min > t->x_max || t->y_min > t->y_max)
+        return false;
+
+    int tx_min = t->x_min >> DEPTH_TILE_SHIFT, tx_max = t->x_max >> DEPTH_TILE_SHIFT;
+    int ty_min = t->y_min >> DEPTH_TILE_SHIFT, ty_max = t->y_max >> DEPTH_TILE_SHIFT;
+
+    // Top level: the nearest vertex against the farthest depth of every block
+    float z0 = 1 / w0, z1 = 1 / w1, z2 = 1 / w2;
+    t->z_max = z0 > z1 ? (z0 > z2 ? z0 : z2) : (z1 > z2 ? z1 : z2);
+    bool visible = false;
+    for (int by = ty_min >> DEPTH_BLOCK_SHIFT; !visible && by <= ty_max >> DEPTH_BLOCK_SHIFT; by++) {
+        for (int bx = tx_min >> DEPTH_BLOCK_SHIFT; bx <= tx_max >> DEPTH_BLOCK_SHIFT; bx++) {
+            if (t->z_max > buffer->block_far[by * buffer->blocks_x + bx]) {
+                visible = true;
+                break;
+            }
+        }
+    }
+    if (!visible) {
+        buffer->triangles_rejected++;
+        return false;
+    }
+
+    // Plane through the three vertices, or flat at the nearest one when the
+    // triangle has no area
+    t->z_min = z0 < z1 ? (z0 < z2 ? z0 : z2) : (z1 < z2 ? z1 : z2);
+    float area = (float)(x1 - x0) * (y2 - y0) - (float)(x2 - x0) * (y1 - y0);
+    if (area != 0) {
+        float inverse_area = 1 / area;
+        t->dz_dx = ((z1 - z0) * (y2 - y0) - (z2 - z0) * (y1 - y0)) * inverse_area;
+        t->dz_dy = ((z2 - z0) * (x1 - x0) - (z1 - z0) * (x2 - x0)) * inverse_area;
+        t->z_origin = z0 - t->dz_dx * x0 - t->dz_dy * y0;
+    } else {
+        t->dz_dx = 0;
+        t->dz_dy = 0;
+        t->z_origin = t->z_max;
+    }
+
+    // Tiles: the depth of the triangle over the part of the tile it can touch,
+    // nearest and farthest at the corners the plane slopes towards
+    visible = false;
+    for (int ty = ty_min; ty <= ty_max; ty++) {
+        int py_min = ty << DEPTH_TILE_SHIFT, py_max = py_min + (1 << DEPTH_TILE_SHIFT) - 1;
+        if (py_min < t->y_min) py_min = t->y_min;
+        if (py_max > t->y_max) py_max = t->y_max;
+        float row_near = depth_triangle_row(t, t->dz_dy > 0 ? py_max : py_min);
+        float row_far = depth_triangle_row(t, t->dz_dy > 0 ? py_min : py_max);
+
+        for (int tx = tx_min; tx <= tx_max; tx++) {
+            int px_min = tx << DEPTH_TILE_SHIFT, px_max = px_min + (1 << DEPTH_TILE_SHIFT) - 1;
+            if (px_min < t->x_min) px_min = t->x_min;
+            if (px_max > t->x_max) px_max = t->x_max;
+
+            float near = depth_triangle_at(t, row_near, t->dz_dx > 0 ? px_max : px_min);
+            float far = depth_triangle_at(t, row_far, t->dz_dx > 0 ? px_min : px_max);
+
+            int tile = ty * buffer->tiles_x + tx;
+            if (near <= buffer->tile_far[tile]) {
+                buffer->tile_state[tile] = DEPTH_TILE_REJECT;
+                buffer->tiles_rejected++;
+            } else {
+                buffer->tile_state[tile] = far > buffer->tile_near[tile] ? DEPTH_TILE_ACCEPT : DEPTH_TILE_TEST;
+                visible = true;
+            }
+            buffer->tile_dirty[tile] = false;
+        }
+    }
+    if (!visible)
+        buffer->triangles_rejected++;
+    return visible;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Depth test and write a horizontal span of the triangle; the pixels that
+// pass are shaded one tile run at a time
+///////////////////////////////////////////////////////////////////////////////
+void depth_triangle_span(depth_buffer* buffer, const depth_triangle* t, int y, int x_from, int x_to, uint32_t* colors, const triangle_shading* shading) {
+    if (y < t->y_min || y > t->y_max)
+        return;
+    if (x_from > x_to) {
+        int x = x_from;
+        x_from = x_to;
+        x_to = x;
+    }
+    if (x_from < t->x_min) x_from = t->x_min;
+    if (x_to > t->x_max) x_to = t->x_max;
+
+    float row = depth_triangle_row(t, y);
+    float* depth = &buffer->pixels[y * buffer->width];
+    colors += y * buffer->width;
+    int tile_row = (y >> DEPTH_TILE_SHIFT) * buffer->tiles_x;
+    int written_shift = (y & ((1 << DEPTH_TILE_SHIFT) - 1)) << DEPTH_TILE_SHIFT;
+
+    // Flat shading writes its color along with the depth; the other modes
+    // shade the pixels that passed afterwards, or store them in the G-buffer
+    // for the deferred lighting to write, so the color is left alone
+    bool flat = shading->mode == SHADING_FLAT;
+    uint32_t flat_color = shading->color;
+
+    // Walk the span one tile at a time
+    for (int x = x_from; x <= x_to; ) {
+        int tile = tile_row + (x >> DEPTH_TILE_SHIFT);
+        int end = x | ((1 << DEPTH_TILE_SHIFT) - 1);
+        if (end > x_to)
+            end = x_to;
+
+        // Pixels failing the test were already drawn, so the whole run of
+        // the span counts as drawn either way
+        uint64_t bits = ((1ull << (end - x + 1)) - 1) << (x & ((1 << DEPTH_TILE_SHIFT) - 1));
+        buffer->tile_written[tile] |= bits << written_shift;
+
+        uint8_t state = buffer->tile_state[tile];
+        if (state != DEPTH_TILE_REJECT) {
+            float tile_far = buffer->tile_far[tile];
+            uint32_t passed = 0;
+            bool dirty = false;
+            if (state == DEPTH_TILE_ACCEPT) {
+                for (int p = x; p <= end; p++) {
+                    dirty |= depth[p] <= tile_far;
+                    depth[p] = depth_triangle_at(t, row, p);
+                    if (flat)
+                        colors[p] = flat_color;
+                }
+                passed = (1u << (end - x + 1)) - 1;
+            } else {
+                for (int p = x; p <= end; p++) {
+                    float z = depth_triangle_at(t, row, p);
+                    if (z > depth[p]) {
+                        dirty |= depth[p] <= tile_far;
+                        depth[p] = z;
+                        if (flat)
+                            colors[p] = flat_color;
+                        passed |= 1u << (p - x);
+                    }
+                }
+            }
+            if (passed) {
+                if (!flat)
+                    shade_run(shading, y, x, end - x + 1, passed, &depth[x], &colors[x]);
+                float z_start = depth_triangle_at(t, row, x);
+                float z_end = depth_triangle_at(t, row, end);
+                float near = z_start > z_end ? z_start : z_end;
+                if (near > buffer->tile_near[tile])
+                    buffer->tile_near[tile] = near;
+                buffer->tile_dirty[tile] |= dirty;
+            }
+        }
+        x = end + 1;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Depth test a horizontal span of a transparent triangle without writing
+// it, and blend the pixels in front of what was drawn over the colors one
+// tile run at a time; the runs carry the depth of the triangle itself, as
+// the buffer holds the depth of what is behind it
+///////////////////////////////////////////////////////////////////////////////
+void depth_triangle_span_blend(depth_buffer* buffer, const depth_triangle* t, int y, int x_from, int x_to, uint32_t* colors, const triangle_shading* shading) {
+    if (y < t->y_min || y > t->y_max)
+        return;
+    if (x_from > x_to) {
+        int x = x_from;
+        x_from = x_to;
+        x_to = x;
+    }
+    if (x_from < t->x_min) x_from = t->x_min;
+    if (x_to > t->x_max) x_to = t->x_max;
+
+    float row = depth_triangle_row(t, y);
+    const float* depth = &buffer->pixels[y * buffer->width];
+    colors += y * buffer->width;
+    int tile_row = (y >> DEPTH_TILE_SHIFT) * buffer->tiles_x;
+
+    for (int x = x_from; x <= x_to; ) {
+        int tile = tile_row + (x >> DEPTH_TILE_SHIFT);
+        int end = x | ((1 << DEPTH_TILE_SHIFT) - 1);
+        if (end > x_to)
+            end = x_to;
+
+        uint8_t state = buffer->tile_state[tile];
+        if (state != DEPTH_TILE_REJECT) {
+            float run_depth[SHADING_RUN_MAX];
+            uint32_t passed = 0;
+            for (int p = x; p <= end; p++) {
+                float z = depth_triangle_at(t, row, p);
+                run_depth[p - x] = z;
+                if (state == DEPTH_TILE_ACCEPT || z > depth[p])
+                    passed |= 1u << (p - x);
+            }
+            if (passed)
+                shade_run_blended(shading, y, x, end - x + 1, passed, run_depth, &colors[x]);
+        }
+        x = end + 1;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Depth test and write a horizontal span of the triangle and nothing else,
+// for depth-only passes such as shadow maps: the same walk as
+// depth_triangle_span without colors, masks or shading, the tested pixels
+// keeping the nearest depth without branching
+///////////////////////////////////////////////////////////////////////////////
+void depth_triangle_span_depth(depth_buffer* buffer, const depth_triangle* t, int y, int x_from, int x_to) {
+    if (y < t->y_min || y > t->y_max)
+        return;
+    if (x_from > x_to) {
+        int x = x_from;
+        x_from = x_to;
+        x_to = x;
+    }
+    if (x_from < t->x_min) x_from = t->x_min;
+    if (x_to > t->x_max) x_to = t->x_max;
+
+    float row = depth_triangle_row(t, y);
+    float* depth = &buffer->pixels[y * buffer->width];
+    int tile_row = (y >> DEPTH_TILE_SHIFT) * buffer->tiles_x;
+    int written_shift = (y & ((1 << DEPTH_TILE_SHIFT) - 1)) << DEPTH_TILE_SHIFT;
+
+    for (int x = x_from; x <= x_to; ) {
+        int tile = tile_row + (x >> DEPTH_TILE_SHIFT);
+        int end = x | ((1 << DEPTH_TILE_SHIFT) - 1);
+        if (end > x_to)
+            end = x_to;
+
+        uint64_t bits = ((1ull << (end - x + 1)) - 1) << (x & ((1 << DEPTH_TILE_SHIFT) - 1));
+        buffer->tile_written[tile] |= bits << written_shift;
+
+        uint8_t state = buffer->tile_state[tile];
+        if (state != DEPTH_TILE_REJECT) {
+            float tile_far = buffer->tile_far[tile];
+            bool written = false, dirty = false;
+            if (state == DEPTH_TILE_ACCEPT) {
+                for (int p = x; p <= end; p++) {
+                    dirty |= depth[p] <= tile_far;
+                    depth[p] = depth_triangle_at(t, row, p);
+                }
+                written = true;
+            } else {
+                for (int p = x; p <= end; p++) {
+                    float z = depth_triangle_at(t, row, p);
+                    bool nearer = z > depth[p];
+                    dirty |= nearer & (depth[p] <= tile_far);
+                    written |= nearer;
+                    depth[p] = nearer ? z : depth[p];
+                }
+            }
+            if (written) {
+                float z_start = depth_triangle_at(t, row, x);
+                float z_end = depth_triangle_at(t, row, end);
+                float near = z_start > z_end ? z_start : z_end;
+                if (near > buffer->tile_near[tile])
+                    buffer->tile_near[tile] = near;
+                buffer->tile_dirty[tile] |= dirty;
+            }
+        }
+        x = end + 1;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Depth test and write a single pixel of the triangle; returns whether it
+// passed and should be shaded
+///////////////////////////////////////////////////////////////////////////////
+bool depth_triangle_pixel(depth_buffer* buffer, const depth_triangle* t, int x, int y) {
+    if (x < t->x_min || x > t->x_max || y < t->y_min || y > t->y_max)
+        return false;
+
+    int tile = (y >> DEPTH_TILE_SHIFT) * buffer->tiles_x + (x >> DEPTH_TILE_SHIFT);
+    int bit = ((y & ((1 << DEPTH_TILE_SHIFT) - 1)) << DEPTH_TILE_SHIFT) + (x & ((1 << DEPTH_TILE_SHIFT) - 1));
+    buffer->tile_written[tile] |= 1ull << bit;
+    if (buffer->tile_state[tile] == DEPTH_TILE_REJECT)
+        return false;
+
+    float z = depth_triangle_at(t, depth_triangle_row(t, y), x);
+    float* depth = &buffer->pixels[y * buffer->width + x];
+    if (buffer->tile_state[tile] == DEPTH_TILE_TEST && z <= *depth)
+        return false;
+    buffer->tile_dirty[tile] |= *depth <= buffer->tile_far[tile];
+    *depth = z;
+    if (z > buffer->tile_near[tile])
+        buffer->tile_near[tile] = z;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Move the farthest depth of the tiles the triangle changed forward, and with
+// them the blocks above
+///////////////////////////////////////////////////////////////////////////////
+void depth_triangle_end(depth_buffer* buffer, const depth_triangle* t) {
+    int tx_min = t->x_min >> DEPTH_TILE_SHIFT, tx_max = t->x_max >> DEPTH_TILE_SHIFT;
+    int ty_min = t->y_min >> DEPTH_TILE_SHIFT, ty_max = t->y_max >> DEPTH_TILE_SHIFT;
+
+    bool raised = false;
+    for (int ty = ty_min; ty <= ty_max; ty++) {
+        for (int tx = tx_min; tx <= tx_max; tx++) {
+            int tile = ty * buffer->tiles_x + tx;
+            if (!buffer->tile_dirty[tile] || buffer->tile_written[tile] != UINT64_MAX)
+                continue;
+
+            // Only the pixels inside the screen
+            int x_end = (tx + 1) << DEPTH_TILE_SHIFT, y_end = (ty + 1) << DEPTH_TILE_SHIFT;
+            if (x_end > buffer->width) x_end = buffer->width;
+            if (y_end > buffer->height) y_end = buffer->height;
+            float far = FLT_MAX;
+            for (int y = ty << DEPTH_TILE_SHIFT; y < y_end; y++) {
+                const float* depth = &buffer->pixels[y * buffer->width];
+                for (int x = tx << DEPTH_TILE_SHIFT; x < x_end; x++)
+                    far = depth[x] < far ? depth[x] : far;
+            }
+            if (far > buffer->tile_far[tile]) {
+                buffer->tile_far[tile] = far;
+                raised = true;
+            }
+        }
+    }
+    if (!raised)
+        return;
+
+    for (int by = ty_min >> DEPTH_BLOCK_SHIFT; by <= ty_max >> DEPTH_BLOCK_SHIFT; by++) {
+        for (int bx = tx_min >> DEPTH_BLOCK_SHIFT; bx <= tx_max >> DEPTH_BLOCK_SHIFT; bx++) {
+            int ty_end = (by + 1) << DEPTH_BLOCK_SHIFT, tx_end = (bx + 1) << DEPTH_BLOCK_SHIFT;
+            if (ty_end > buffer->tiles_y) ty_end = buffer->tiles_y;
+            if (tx_end > buffer->tiles_x) tx_end = buffer->tiles_x;
+
+            float far = FLT_MAX;
+            for (int ty = by << DEPTH_BLOCK_SHIFT; ty < ty_end; ty++) {
+                for (int tx = bx << DEPTH_BLOCK_SHIFT; tx < tx_end; tx++) {
+                    float tile_far = buffer->tile_far[ty * buffer->tiles_x + tx];
+                    far = tile_far < far ? tile_far : far;
+                }
+            }
+            buffer->block_far[by * buffer->blocks_x + bx] = far;
+        }
+    }
+}
+
+#endif
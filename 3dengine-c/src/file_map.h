@@ -0,0 +1,59 @@
+#ifndef FILE_MAP_H
+#define FILE_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FILE_MAP_ENABLED 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Read-only file mappings, used to load baked assets without copying them
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    const void* data;
+    size_t size;
+} mapped_file;
+
+///////////////////////////////////////////////////////////////////////////////
+// Map a whole file read-only; returns false if it is missing or unmappable
+///////////////////////////////////////////////////////////////////////////////
+bool map_file(const char* path, mapped_file* file) {
+#if defined(FILE_MAP_ENABLED)
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    file->data = data;
+    file->size = (size_t)st.st_size;
+    return true;
+#else
+    (void)path;
+    (void)file;
+    return false;
+#endif
+}
+
+void unmap_file(mapped_file* file) {
+#if defined(FILE_MAP_ENABLED)
+    if (file->data != NULL)
+        munmap((void*)file->data, file->size);
+#endif
+    file->data = NULL;
+    file->size = 0;
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <stdbool.h>
+#include <math.h>
+#include "vector.h"
+#include "matrix.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// View frustum in camera space, as six planes facing inwards
+// A point p is inside a plane when dot(normal, p) + distance >= 0.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    vec3d normal;
+    float distance;
+} plane;
+
+typedef struct {
+    plane planes[6];
+} frustum;
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the frustum of a perspective projection matrix (camera at the origin
+// looking down +z) and its near and far distances
+///////////////////////////////////////////////////////////////////////////////
+frustum frustum_from_projection(const mat4x4* proj, float znear, float zfar) {
+    float x_scale = proj->m[0][0];
+    float y_scale = proj->m[1][1];
+    float x_length = sqrt(x_scale * x_scale + 1);
+    float y_length = sqrt(y_scale * y_scale + 1);
+
+    frustum result = {
+        .planes = {
+            { .normal = {  x_scale / x_length, 0, 1 / x_length, 0 }, .distance = 0 },  // left
+            { .normal = { -x_scale / x_length, 0, 1 / x_length, 0 }, .distance = 0 },  // right
+            { .normal = { 0,  y_scale / y_length, 1 / y_length, 0 }, .distance = 0 },  // top
+            { .normal = { 0, -y_scale / y_length, 1 / y_length, 0 }, .distance = 0 },  // bottom
+            { .normal = { 0, 0,  1, 0 }, .distance = -znear },                         // near
+            { .normal = { 0, 0, -1, 0 }, .distance = zfar }                            // far
+        }
+    };
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// True unless the sphere lies entirely outside one of the planes
+///////////////////////////////////////////////////////////////////////////////
+bool frustum_intersects_sphere(const frustum* f, vec3d center, float radius) {
+    for (int i = 0; i < 6; i++) {
+        if (vector_dot(f->planes[i].normal, center) + f->planes[i].distance < -radius)
+            return false;
+    }
+    return true;
+}
+
+#endif
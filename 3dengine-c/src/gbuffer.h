@@ -0,0 +1,82 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "vector.h"
+#include "vertex_format.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// G-buffer of the deferred shading mode
+// Rasterization stores what the lighting needs from every pixel in separate
+// arrays: the unlit face color (no texture is sampled, the textured path
+// being disabled), the surface normal as two 8-bit octahedral
+// coordinates, and a material ID. The depth comes from the depth buffer the
+// triangles were tested against, which also tells which pixels were drawn,
+// so the G-buffer never needs clearing. 7 bytes per pixel on top of the
+// depth.
+// Every model has a material of its own, at the index of the model; the
+// models past the end of the table share its last entry, which keeps the
+// strength the table was created with.
+///////////////////////////////////////////////////////////////////////////////
+#define GBUFFER_MAX_MATERIALS 256
+
+typedef struct {
+    float specular; // strength of the highlights
+} gbuffer_material;
+
+typedef struct {
+    int width;
+    int height;
+    uint32_t* albedo;
+    uint16_t* normals;
+    uint8_t* materials;
+    gbuffer_material material_table[GBUFFER_MAX_MATERIALS];
+} gbuffer;
+
+bool gbuffer_init(gbuffer* g, int width, int height, float specular) {
+    g->width = width;
+    g->height = height;
+    g->albedo = malloc(sizeof(uint32_t) * width * height);
+    g->normals = malloc(sizeof(uint16_t) * width * height);
+    g->materials = malloc(sizeof(uint8_t) * width * height);
+    for (int i = 0; i < GBUFFER_MAX_MATERIALS; i++)
+        g->material_table[i].specular = specular;
+    if (!g->albedo || !g->normals || !g->materials) {
+        fprintf(stderr, "Error trying to allocate memory for the G-buffer.\n");
+        return false;
+    }
+    return true;
+}
+
+uint8_t gbuffer_material_id(int model) {
+    return (uint8_t)(model < GBUFFER_MAX_MATERIALS - 1 ? model : GBUFFER_MAX_MATERIALS - 1);
+}
+
+void gbuffer_free(gbuffer* g) {
+    free(g->albedo);
+    free(g->normals);
+    free(g->materials);
+    g->albedo = NULL;
+    g->normals = NULL;
+    g->materials = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Normals packed into 16 bits, the first octahedral coordinate in the low
+// byte; the normal to pack needs no normalizing
+///////////////////////////////////////////////////////////////////////////////
+uint16_t gbuffer_pack_normal(vec3d normal) {
+    uint8_t encoded[2];
+    octahedral_encode(normal, encoded);
+    return (uint16_t)(encoded[0] | (encoded[1] << 8));
+}
+
+vec3d gbuffer_unpack_normal(uint16_t packed) {
+    uint8_t encoded[2] = { (uint8_t)(packed & 0xFF), (uint8_t)(packed >> 8) };
+    return octahedral_decode(encoded);
+}
+
+#endif
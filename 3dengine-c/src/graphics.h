@@ -63,7 +63,8 @@ int initialize_window(void) {
 // Set a pixel with a given colour
 ///////////////////////////////////////////////////////////////////////////////
 void draw_pixel(int x, int y, uint32_t color) {
-    color_buffer[(window_width * y) + x] = color;
+    if (x >= 0 && x < (int)window_width && y >= 0 && y < (int)window_height)
+        color_buffer[(window_width * y) + x] = color;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
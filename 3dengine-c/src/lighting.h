@@ -0,0 +1,423 @@
+#ifndef LIGHTING_H
+#define LIGHTING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "vector.h"
+#include "matrix.h"
+#include "arena.h"
+#include "array.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Dynamic lights with tiled light culling
+// The scene is lit by any number of directional, point and spot lights. The
+// camera sits at the origin looking down +z, so the world space lights are
+// placed in is also the view space they are evaluated in.
+//
+// Point and spot lights fade out to nothing at their range. Once a frame,
+// lighting_bin projects the sphere each of them reaches onto the screen and
+// lists the light in every 32x32 pixel tile the sphere can cover, so a
+// surface only evaluates the lights listed in the tile it is drawn in.
+// Directional lights reach everywhere and are listed in every tile. The
+// lists are rebuilt from the frame arena every frame, as the lights move.
+//
+// Light tiles are larger than the depth buffer tiles, so every run of pixels
+// the depth buffer hands to the shading lies in a single light tile.
+///////////////////////////////////////////////////////////////////////////////
+#define LIGHT_TILE_SHIFT 5
+#define LIGHT_SHININESS_SQUARINGS 5 // highlight exponent 2^5 = 32
+
+// The per-pixel evaluation has an SSE2 version picked at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LIGHTING_SIMD_X86 1
+#include <emmintrin.h>
+#define LIGHTING_TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Shadow map of a directional or spot light, as the lookups see it
+// The matrix takes world positions to the map: x and y in texels, and a
+// depth that grows towards the light as in the depth buffer. For a spot
+// light the projection is a perspective one, the texel position is divided
+// by w and the depth is 1/w; for a directional light all three come out of
+// the matrix directly. Texels nothing was drawn into hold 0 and let all the
+// light through, as does everything outside the map.
+///////////////////////////////////////////////////////////////////////////////
+#define SHADOW_BIAS 0.002f // relative depth a receiver may be behind the map
+
+typedef struct {
+    const float* depth; // size x size texels, NULL when the light casts no shadow
+    int size;
+    mat4x4 matrix;
+    bool perspective;
+    bool pcf; // filter the 2x2 texels around the point instead of taking one
+} light_shadow;
+
+typedef enum {
+    LIGHT_DIRECTIONAL,
+    LIGHT_POINT,
+    LIGHT_SPOT
+} light_type;
+
+typedef struct {
+    light_type type;
+    vec3d position;  // point and spot lights
+    vec3d direction; // unit; directional: towards the light, spot: the way it shines
+    float intensity;
+    float range;     // point and spot lights reach no further
+    float spot_cos_outer; // spot lights: no light outside this cone,
+    float spot_cos_inner; // full light inside this one
+    light_shadow shadow;
+
+    // Derived by lighting_bin every frame
+    vec3d half_vector; // directional: halfway to the viewer, for the highlight
+    float inverse_range_squared;
+    float inverse_spot_width;
+} light;
+
+ARRAY_DEFINE(light_array, light)
+
+typedef struct {
+    light_array lights;
+
+    // Light lists of the screen tiles for this frame: the lights of tile t
+    // are tile_lights[tile_offsets[t]] up to tile_lights[tile_offsets[t + 1]]
+    int width;
+    int height;
+    int tiles_x;
+    int tiles_y;
+    uint32_t* tile_offsets;
+    uint32_t* tile_lights;
+
+    // Screen pixels back to view space at depth 1
+    float pixel_to_view_x;
+    float pixel_to_view_y;
+} lighting;
+
+void lighting_init(lighting* l) {
+    lighting empty = { 0 };
+    *l = empty;
+    light_array_init(&l->lights);
+}
+
+bool lighting_add(lighting* l, light source) {
+    return light_array_push(&l->lights, source);
+}
+
+void lighting_free(lighting* l) {
+    light_array_free(&l->lights);
+    lighting_init(l);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Range of screen tiles the sphere of a point or spot light can cover;
+// false when it is entirely behind the near plane or off screen
+// The sphere is bounded by a box whose corners are projected, which is
+// conservative, and a sphere crossing the near plane covers the screen.
+///////////////////////////////////////////////////////////////////////////////
+bool light_screen_tiles(const lighting* l, const light* source, const mat4x4* proj, float znear, int tiles[4]) {
+    vec3d p = source->position;
+    float r = source->range;
+    if (p.z + r < znear)
+        return false;
+
+    float screen[4] = { 0, 0, (float)l->width, (float)l->height };
+    if (p.z - r > znear) {
+        float z_near = p.z - r, z_far = p.z + r;
+        float min_x = fminf((p.x - r) / z_near, (p.x - r) / z_far);
+        float max_x = fmaxf((p.x + r) / z_near, (p.x + r) / z_far);
+        float min_y = fminf((p.y - r) / z_near, (p.y - r) / z_far);
+        float max_y = fmaxf((p.y + r) / z_near, (p.y + r) / z_far);
+        screen[0] = (min_x * proj->m[0][0] + 1) * (l->width / 2.0f);
+        screen[1] = (min_y * proj->m[1][1] + 1) * (l->height / 2.0f);
+        screen[2] = (max_x * proj->m[0][0] + 1) * (l->width / 2.0f);
+        screen[3] = (max_y * proj->m[1][1] + 1) * (l->height / 2.0f);
+        if (screen[2] < 0 || screen[3] < 0 || screen[0] >= l->width || screen[1] >= l->height)
+            return false;
+    }
+
+    for (int k = 0; k < 4; k++) {
+        int limit = (k & 1) ? l->tiles_y - 1 : l->tiles_x - 1;
+        int tile = screen[k] > 0 ? (int)screen[k] >> LIGHT_TILE_SHIFT : 0;
+        tiles[k] = tile < limit ? tile : limit;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the light list of every screen tile for this frame, taking the lists
+// from the frame arena; false when it is out of memory
+///////////////////////////////////////////////////////////////////////////////
+bool lighting_bin(lighting* l, arena* frame, const mat4x4* proj, int width, int height, float znear) {
+    l->width = width;
+    l->height = height;
+    l->tiles_x = (width + (1 << LIGHT_TILE_SHIFT) - 1) >> LIGHT_TILE_SHIFT;
+    l->tiles_y = (height + (1 << LIGHT_TILE_SHIFT) - 1) >> LIGHT_TILE_SHIFT;
+    l->pixel_to_view_x = 1 / (proj->m[0][0] * (width / 2.0f));
+    l->pixel_to_view_y = 1 / (proj->m[1][1] * (height / 2.0f));
+
+    int num_tiles = l->tiles_x * l->tiles_y;
+    int num_lights = l->lights.length;
+    l->tile_offsets = arena_alloc(frame, sizeof(uint32_t) * (num_tiles + 1));
+    int* covered = arena_alloc(frame, sizeof(int) * 4 * (num_lights > 0 ? num_lights : 1));
+    if (!l->tile_offsets || !covered)
+        return false;
+
+    // Count the lights of every tile, keeping the tiles each light covers
+    memset(l->tile_offsets, 0, sizeof(uint32_t) * (num_tiles + 1));
+    for (int i = 0; i < num_lights; i++) {
+        light* source = &l->lights.elements[i];
+        int* tiles = &covered[i * 4];
+        if (source->type == LIGHT_DIRECTIONAL) {
+            vec3d towards_viewer = { .x = 0, .y = 0, .z = -1 };
+            source->half_vector = vector_add(source->direction, towards_viewer);
+            if (vector_length(source->half_vector) > 0)
+                vector_normalize(&source->half_vector);
+            else
+                source->half_vector = towards_viewer;
+            tiles[0] = tiles[1] = 0;
+            tiles[2] = l->tiles_x - 1;
+            tiles[3] = l->tiles_y - 1;
+        } else {
+            source->inverse_range_squared = 1 / (source->range * source->range);
+            float spot_width = source->spot_cos_inner - source->spot_cos_outer;
+            source->inverse_spot_width = spot_width > 0 ? 1 / spot_width : 1e20f;
+            if (!light_screen_tiles(l, source, proj, znear, tiles)) {
+                tiles[0] = tiles[1] = 0;
+                tiles[2] = tiles[3] = -1;
+            }
+        }
+        for (int y = tiles[1]; y <= tiles[3]; y++) {
+            for (int x = tiles[0]; x <= tiles[2]; x++)
+                l->tile_offsets[y * l->tiles_x + x + 1]++;
+        }
+    }
+
+    // Turn the counts into offsets, and fill the lists
+    for (int t = 0; t < num_tiles; t++)
+        l->tile_offsets[t + 1] += l->tile_offsets[t];
+    uint32_t total = l->tile_offsets[num_tiles];
+    l->tile_lights = arena_alloc(frame, sizeof(uint32_t) * (total > 0 ? total : 1));
+    uint32_t* fill = arena_alloc(frame, sizeof(uint32_t) * num_tiles);
+    if (!l->tile_lights || !fill) {
+        l->tile_offsets = NULL;
+        return false;
+    }
+    memcpy(fill, l->tile_offsets, sizeof(uint32_t) * num_tiles);
+    for (int i = 0; i < num_lights; i++) {
+        const int* tiles = &covered[i * 4];
+        for (int y = tiles[1]; y <= tiles[3]; y++) {
+            for (int x = tiles[0]; x <= tiles[2]; x++)
+                l->tile_lights[fill[y * l->tiles_x + x]++] = (uint32_t)i;
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Light list of the tile holding a screen point, clamped to the screen
+///////////////////////////////////////////////////////////////////////////////
+const uint32_t* lighting_tile_lights(const lighting* l, int x, int y, int* count) {
+    int tile_x = x > 0 ? x >> LIGHT_TILE_SHIFT : 0;
+    int tile_y = y > 0 ? y >> LIGHT_TILE_SHIFT : 0;
+    if (tile_x >= l->tiles_x) tile_x = l->tiles_x - 1;
+    if (tile_y >= l->tiles_y) tile_y = l->tiles_y - 1;
+    int tile = tile_y * l->tiles_x + tile_x;
+    *count = (int)(l->tile_offsets[tile + 1] - l->tile_offsets[tile]);
+    return &l->tile_lights[l->tile_offsets[tile]];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fraction of a light reaching a world position past its shadow map, 0 to 1
+///////////////////////////////////////////////////////////////////////////////
+float shadow_texel(const light_shadow* s, int x, int y, float depth) {
+    if (x < 0 || y < 0 || x >= s->size || y >= s->size)
+        return 1;
+    return depth >= s->depth[y * s->size + x] * (1 - SHADOW_BIAS) ? 1 : 0;
+}
+
+// Keeps texel coordinates in the range of int, NaN included
+float shadow_clamp(float value, float limit) {
+    return value > -1 ? (value < limit ? value : limit) : -1;
+}
+
+float light_shadow_factor(const light_shadow* s, vec3d position) {
+    const float (*m)[4] = s->matrix.m;
+    float x = position.x * m[0][0] + position.y * m[1][0] + position.z * m[2][0] + m[3][0];
+    float y = position.x * m[0][1] + position.y * m[1][1] + position.z * m[2][1] + m[3][1];
+    float depth = position.x * m[0][2] + position.y * m[1][2] + position.z * m[2][2] + m[3][2];
+    if (s->perspective) {
+        float w = position.x * m[0][3] + position.y * m[1][3] + position.z * m[2][3] + m[3][3];
+        if (!(w > 0))
+            return 1;
+        depth = 1 / w;
+        x *= depth;
+        y *= depth;
+    }
+    x = shadow_clamp(x, (float)s->size);
+    y = shadow_clamp(y, (float)s->size);
+    if (!s->pcf)
+        return shadow_texel(s, (int)floorf(x), (int)floorf(y), depth);
+
+    // Bilinear weights of the four texels whose centers surround the point
+    x -= 0.5f;
+    y -= 0.5f;
+    float left = floorf(x), top = floorf(y);
+    float wx = x - left, wy = y - top;
+    int tx = (int)left, ty = (int)top;
+    float upper = shadow_texel(s, tx, ty, depth) * (1 - wx) + shadow_texel(s, tx + 1, ty, depth) * wx;
+    float lower = shadow_texel(s, tx, ty + 1, depth) * (1 - wx) + shadow_texel(s, tx + 1, ty + 1, depth) * wx;
+    return upper * (1 - wy) + lower * wy;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Light reaching a surface point with a unit normal from the listed lights:
+// the sum of their Lambert diffuse terms, and of their Blinn highlights for
+// a viewer far away along -z, each light dimmed by its shadow map
+///////////////////////////////////////////////////////////////////////////////
+void light_surface(const lighting* l, const uint32_t* list, int count, vec3d position, vec3d normal, float* diffuse, float* specular) {
+    float diffuse_sum = 0, specular_sum = 0;
+    for (int k = 0; k < count; k++) {
+        const light* source = &l->lights.elements[list[k]];
+        float attenuation = source->intensity;
+        float lx, ly, lz, hx, hy, hz;
+        if (source->type == LIGHT_DIRECTIONAL) {
+            lx = source->direction.x;
+            ly = source->direction.y;
+            lz = source->direction.z;
+            hx = source->half_vector.x;
+            hy = source->half_vector.y;
+            hz = source->half_vector.z;
+        } else {
+            lx = source->position.x - position.x;
+            ly = source->position.y - position.y;
+            lz = source->position.z - position.z;
+            float distance_squared = lx * lx + ly * ly + lz * lz;
+            if (!(distance_squared < source->range * source->range))
+                continue;
+            float falloff = 1 - distance_squared * source->inverse_range_squared;
+            attenuation *= falloff * falloff;
+            float inverse_distance = 1 / sqrtf(distance_squared > 1e-20f ? distance_squared : 1e-20f);
+            lx *= inverse_distance;
+            ly *= inverse_distance;
+            lz *= inverse_distance;
+            if (source->type == LIGHT_SPOT) {
+                float cone = -(lx * source->direction.x + ly * source->direction.y + lz * source->direction.z);
+                float spot = (cone - source->spot_cos_outer) * source->inverse_spot_width;
+                attenuation *= spot > 0 ? (spot < 1 ? spot : 1) : 0;
+            }
+            hx = lx;
+            hy = ly;
+            hz = lz - 1;
+            float half_squared = hx * hx + hy * hy + hz * hz;
+            float inverse_half = 1 / sqrtf(half_squared > 1e-20f ? half_squared : 1e-20f);
+            hx *= inverse_half;
+            hy *= inverse_half;
+            hz *= inverse_half;
+        }
+
+        float lambert = normal.x * lx + normal.y * ly + normal.z * lz;
+        if (!(lambert > 0))
+            continue;
+        if (source->shadow.depth)
+            attenuation *= light_shadow_factor(&source->shadow, position);
+        float highlight = normal.x * hx + normal.y * hy + normal.z * hz;
+        highlight = highlight > 0 ? (highlight < 1 ? highlight : 1) : 0;
+        for (int s = 0; s < LIGHT_SHININESS_SQUARINGS; s++)
+            highlight *= highlight;
+        diffuse_sum += attenuation * lambert;
+        specular_sum += attenuation * highlight;
+    }
+    *diffuse = diffuse_sum;
+    *specular = specular_sum;
+}
+
+#ifdef LIGHTING_SIMD_X86
+// Same steps as light_surface for four surface points, the lanes a light
+// does not reach adding nothing; shadow maps are looked up one lane at a time
+LIGHTING_TARGET_SSE2 void light_surface_sse2(
+    const lighting* l, const uint32_t* list, int count,
+    __m128 px, __m128 py, __m128 pz, __m128 nx, __m128 ny, __m128 nz,
+    __m128* diffuse, __m128* specular
+) {
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1);
+    __m128 tiny = _mm_set1_ps(1e-20f);
+    __m128 diffuse_sum = zero, specular_sum = zero;
+    for (int k = 0; k < count; k++) {
+        const light* source = &l->lights.elements[list[k]];
+        __m128 attenuation = _mm_set1_ps(source->intensity);
+        __m128 reached = _mm_cmpeq_ps(zero, zero);
+        __m128 lx, ly, lz, hx, hy, hz;
+        if (source->type == LIGHT_DIRECTIONAL) {
+            lx = _mm_set1_ps(source->direction.x);
+            ly = _mm_set1_ps(source->direction.y);
+            lz = _mm_set1_ps(source->direction.z);
+            hx = _mm_set1_ps(source->half_vector.x);
+            hy = _mm_set1_ps(source->half_vector.y);
+            hz = _mm_set1_ps(source->half_vector.z);
+        } else {
+            lx = _mm_sub_ps(_mm_set1_ps(source->position.x), px);
+            ly = _mm_sub_ps(_mm_set1_ps(source->position.y), py);
+            lz = _mm_sub_ps(_mm_set1_ps(source->position.z), pz);
+            __m128 distance_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz));
+            reached = _mm_cmplt_ps(distance_squared, _mm_set1_ps(source->range * source->range));
+            if (_mm_movemask_ps(reached) == 0)
+                continue;
+            __m128 falloff = _mm_sub_ps(one, _mm_mul_ps(distance_squared, _mm_set1_ps(source->inverse_range_squared)));
+            attenuation = _mm_mul_ps(attenuation, _mm_mul_ps(falloff, falloff));
+            __m128 inverse_distance = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(distance_squared, tiny)));
+            lx = _mm_mul_ps(lx, inverse_distance);
+            ly = _mm_mul_ps(ly, inverse_distance);
+            lz = _mm_mul_ps(lz, inverse_distance);
+            if (source->type == LIGHT_SPOT) {
+                __m128 cone = _mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(lx, _mm_set1_ps(source->direction.x)),
+                    _mm_mul_ps(ly, _mm_set1_ps(source->direction.y))),
+                    _mm_mul_ps(lz, _mm_set1_ps(source->direction.z)));
+                cone = _mm_xor_ps(cone, _mm_set1_ps(-0.0f));
+                __m128 spot = _mm_mul_ps(_mm_sub_ps(cone, _mm_set1_ps(source->spot_cos_outer)), _mm_set1_ps(source->inverse_spot_width));
+                attenuation = _mm_mul_ps(attenuation, _mm_max_ps(_mm_min_ps(spot, one), zero));
+            }
+            hx = lx;
+            hy = ly;
+            hz = _mm_sub_ps(lz, one);
+            __m128 half_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(hx, hx), _mm_mul_ps(hy, hy)), _mm_mul_ps(hz, hz));
+            __m128 inverse_half = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(half_squared, tiny)));
+            hx = _mm_mul_ps(hx, inverse_half);
+            hy = _mm_mul_ps(hy, inverse_half);
+            hz = _mm_mul_ps(hz, inverse_half);
+        }
+
+        __m128 lambert = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(ny, ly)), _mm_mul_ps(nz, lz));
+        __m128 lit = _mm_and_ps(reached, _mm_cmpgt_ps(lambert, zero));
+        int lit_lanes = _mm_movemask_ps(lit);
+        if (lit_lanes == 0)
+            continue;
+        if (source->shadow.depth) {
+            float lane_x[4], lane_y[4], lane_z[4], shadow[4];
+            _mm_storeu_ps(lane_x, px);
+            _mm_storeu_ps(lane_y, py);
+            _mm_storeu_ps(lane_z, pz);
+            for (int lane = 0; lane < 4; lane++) {
+                vec3d position = { .x = lane_x[lane], .y = lane_y[lane], .z = lane_z[lane], .w = 1 };
+                shadow[lane] = (lit_lanes >> lane) & 1 ? light_shadow_factor(&source->shadow, position) : 0;
+            }
+            attenuation = _mm_mul_ps(attenuation, _mm_loadu_ps(shadow));
+        }
+        __m128 highlight = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, hx), _mm_mul_ps(ny, hy)), _mm_mul_ps(nz, hz));
+        highlight = _mm_max_ps(_mm_min_ps(highlight, one), zero);
+        for (int s = 0; s < LIGHT_SHININESS_SQUARINGS; s++)
+            highlight = _mm_mul_ps(highlight, highlight);
+        diffuse_sum = _mm_add_ps(diffuse_sum, _mm_and_ps(lit, _mm_mul_ps(attenuation, lambert)));
+        specular_sum = _mm_add_ps(specular_sum, _mm_and_ps(lit, _mm_mul_ps(attenuation, highlight)));
+    }
+    *diffuse = diffuse_sum;
+    *specular = specular_sum;
+}
+#endif
+
+#endif
@@ -1,36 +1,192 @@
+// POSIX file functions (mkstemp, fdopen) used by the texture cache
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <math.h>
 #include <SDL2/SDL.h>
 #include "upng.h"
-#include "arraylist.h"
 #include "graphics.h"
 #include "texture.h"
+#include "texture_loader.h"
 #include "vector.h"
 #include "matrix.h"
 #include "triangle.h"
+#include "frustum.h"
+#include "mesh.h"
+#include "meshlet.h"
 #include "mesh_data.h"
+#include "arena.h"
+#include "scene.h"
+#include "occlusion.h"
 #include "texture_data.h"
+#include "shadow_map.h"
+#include "deferred.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Objects drawn by the engine and the models they share
+///////////////////////////////////////////////////////////////////////////////
+scene main_scene;
+
+///////////////////////////////////////////////////////////////////////////////
+// Objects that survived frustum culling this frame, grouped by model and LOD
+// level so every group is transformed in one batched pass. Each one owns the
+// working vertices from vertex_base on.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int model;
+    int lod;
+    int object;
+    int vertex_base;
+} instance_draw;
+
+instance_draw* instance_draws = NULL;
+int num_instance_draws = 0;
+
+int* visible_objects = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+// All the arrays above and below only live for one frame, and are taken from
+// an arena reset at the start of every frame
+///////////////////////////////////////////////////////////////////////////////
+#define FRAME_ARENA_SIZE (4 * 1024 * 1024)
+
+arena frame_arena;
+
+///////////////////////////////////////////////////////////////////////////////
+// Occlusion culling: the objects covering the most of the screen are drawn
+// into a small depth buffer as occluders, and the boxes of the other visible
+// objects are tested against it before their meshes are transformed
+///////////////////////////////////////////////////////////////////////////////
+#define OCCLUSION_MAX_OCCLUDERS 16
+#define OCCLUSION_MIN_OCCLUDER_PIXELS 32.0f // screen height of the bounding sphere
+
+occlusion_buffer occlusion;
+int num_occluders = 0;
+int num_occluded_objects = 0;
+
+// With --occlusion-stats, the counts are printed about once a second
+bool report_occlusion_stats = false;
+unsigned int occlusion_report_time = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// With --depth-stats, how much the depth pyramid saved is printed about
+// once a second
+///////////////////////////////////////////////////////////////////////////////
+bool report_depth_stats = false;
+unsigned int depth_report_time = 0;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Array of updated vertices, triangle faces, and vertex depth values
 ///////////////////////////////////////////////////////////////////////////////
-vec3d projected_points[N_VERTICES];
-float vertex_depth_list[N_VERTICES];
-vec3d working_mesh_vertices[N_VERTICES];
+vec3d* projected_points = NULL;
+float* vertex_depth_list = NULL;
+vec3d* working_mesh_vertices = NULL;
+vec3d* working_mesh_normals = NULL; // world normals, only for smooth shading
+
+///////////////////////////////////////////////////////////////////////////////
+// Faces of the meshlets that survived culling this frame, with the draw they
+// belong to and their average depth. The faces of transparent objects are
+// kept apart, to be blended back to front over the opaque ones.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    uint32_t draw;
+    uint32_t face;
+    float depth;
+} visible_face;
+
+visible_face* visible_faces = NULL;
+int num_visible_faces = 0;
+visible_face* transparent_faces = NULL;
+int num_transparent_faces = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Optional mesh file (OBJ or baked .mesh) given on the command line,
+// rendered instead of the cube, how many copies of it to place, and whether
+// to store its vertices quantized (--quantize)
+///////////////////////////////////////////////////////////////////////////////
+const char* mesh_filename = NULL;
+int num_instances = 1;
+bool quantize_vertices = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// With --transparent, every other copy (or the single one) is drawn half
+// transparent
+///////////////////////////////////////////////////////////////////////////////
+#define TRANSPARENT_OBJECT_TRANSPARENCY 0.5f
+
+bool transparent_objects = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// Shading of the filled triangles, flat unless --gouraud, --phong (per
+// pixel) or --deferred is given. Deferred shading draws into the G-buffer,
+// with a material for every model, and lights it once at the end.
+///////////////////////////////////////////////////////////////////////////////
+shading_mode triangle_shading_mode = SHADING_FLAT;
+gbuffer frame_gbuffer;
+
+///////////////////////////////////////////////////////////////////////////////
+// Light the colors in linear light with --gamma, through the lookup tables
+// of color_ramp.h
+///////////////////////////////////////////////////////////////////////////////
+bool gamma_correct = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// Lights of the scene: a light coming from behind the camera, plus the
+// point and spot lights asked for with --lights, each circling the scene on
+// its own orbit
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int light;
+    vec3d center;
+    float radius;
+    float height;
+    float angle;
+    float speed;
+} light_orbit;
+
+ARRAY_DEFINE(light_orbit_array, light_orbit)
+
+lighting scene_lighting;
+light_orbit_array light_orbits;
+int num_moving_lights = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Shadow maps of the directional light and the first spot lights, drawn
+// every frame with --shadows and filtered with --pcf. The directional light
+// then comes in at an angle, so the shadows can be seen.
+///////////////////////////////////////////////////////////////////////////////
+shadow_map shadow_maps[SHADOW_MAX_MAPS];
+int num_shadow_maps = 0;
+bool cast_shadows = false;
+bool filter_shadows = false;
+vec3d shadow_scene_center;
+float shadow_scene_radius = 0;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Projection matrix
 ///////////////////////////////////////////////////////////////////////////////
 mat4x4 proj_matrix;
+frustum view_frustum;
 
 ///////////////////////////////////////////////////////////////////////////////
-// Declare the camera position, rotation, and FOV distortion variables
+// Texture of the mesh, decoded in the background while a placeholder is used
+///////////////////////////////////////////////////////////////////////////////
+texture_handle* mesh_texture_handle = NULL;
+
+// With --texture-stats, the load time of the texture is printed once it is in
+bool report_texture_stats = false;
+bool texture_load_reported = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// Declare the camera position and FOV distortion variables
 ///////////////////////////////////////////////////////////////////////////////
 float fov_factor = 640.0f;
 vec3d camera_position = { .x = 0, .y = 0, .z = 0 };
-vec3d cube_rotation = { .x = 0, .y = 0, .z = 0 };
 
 ///////////////////////////////////////////////////////////////////////////////
 // Global variables for SDL Window, Renderer, and execution status
@@ -39,15 +195,22 @@ bool is_running = false;
 unsigned int previous_frame_time = 0;
 
 ///////////////////////////////////////////////////////////////////////////////
-// Dot product between two vectors
+// Report the object under a pixel, casting a ray from the camera through it
 ///////////////////////////////////////////////////////////////////////////////
-uint32_t apply_light(uint32_t color, float percentage_factor) {
-    uint32_t a = (color & 0xFF000000);
-    uint32_t r = (color & 0x00FF0000) * percentage_factor;
-    uint32_t g = (color & 0x0000FF00) * percentage_factor;
-    uint32_t b = (color & 0x000000FF) * percentage_factor;
-    uint32_t new_color = a | (r & 0x00FF0000) | (g & 0x0000FF00) | (b & 0x000000FF);
-    return new_color;
+void pick_object(int x, int y) {
+    // Undo the viewport transform and the projection scale at depth 1
+    vec3d direction = {
+        .x = (x - (float)window_width / 2) / ((float)window_width / 2) / proj_matrix.m[0][0],
+        .y = (y - (float)window_height / 2) / ((float)window_height / 2) / proj_matrix.m[1][1],
+        .z = 1,
+        .w = 0
+    };
+    float distance;
+    int picked = scene_pick(&main_scene, camera_position, direction, &distance);
+    if (picked >= 0)
+        printf("Picked object %d at depth %.3f\n", picked, distance);
+    else
+        printf("Picked nothing\n");
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -65,6 +228,180 @@ void process_input(void) {
             if (event.key.keysym.sym == SDLK_ESCAPE)
                 is_running = false;
             break;
+        case SDL_MOUSEBUTTONDOWN:
+            if (event.button.button == SDL_BUTTON_LEFT)
+                pick_object(event.button.x, event.button.y);
+            break;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Place copies of a model on a lattice filling a 40 unit cube in front of the
+// camera, each with its own starting orientation; a single copy sits 6 units
+// ahead like the cube always did
+// Only one copy in LATTICE_SPIN_EVERY keeps spinning, carrying a small copy
+// attached to its side, and the rest of the lattice stays still.
+///////////////////////////////////////////////////////////////////////////////
+#define LATTICE_SPIN_EVERY 16
+
+void place_instances(int model_index, int count) {
+    const mesh_lod* base = &main_scene.models.elements[model_index].lods[0];
+    int side = 1;
+    while (side * side * side < count)
+        side++;
+    float spacing = 40.0f / side;
+    float scale = base->bounds_radius > 0 ? spacing / (2.5f * base->bounds_radius) : 1;
+
+    // Every copy plus the children of the spinning ones, without regrowing
+    scene_reserve_objects(&main_scene, main_scene.objects.length + count + count / LATTICE_SPIN_EVERY + 1);
+
+    for (int i = 0; i < count; i++) {
+        int x = i % side;
+        int y = (i / side) % side;
+        int z = i / (side * side);
+        bool spinning = count == 1 || i % LATTICE_SPIN_EVERY == 0;
+        bool transparent = transparent_objects && i % 2 == 0;
+        object placed = {
+            .model = model_index,
+            .scale = scale,
+            .transparency = transparent ? TRANSPARENT_OBJECT_TRANSPARENCY : 0,
+            .rotation = { .x = i * 0.37f, .y = i * 0.61f, .z = i * 0.23f },
+            .spin = { .x = spinning ? 0.02f : 0, .y = spinning ? 0.03f : 0, .z = spinning ? 0.02f : 0 },
+            .position = {
+                .x = (x + 0.5f) * spacing - 20,
+                .y = (y + 0.5f) * spacing - 20,
+                .z = (z + 0.5f) * spacing + 40,
+                .w = 1
+            }
+        };
+        if (count == 1) {
+            vec3d upright = { .x = 0, .y = 0, .z = 0, .w = 0 };
+            vec3d ahead = { .x = 0, .y = 0, .z = 6, .w = 1 };
+            placed.scale = 1;
+            placed.rotation = upright;
+            placed.position = ahead;
+        }
+        int parent = scene_add_object(&main_scene, placed);
+
+        // A quarter-size copy next to it, in the model space of its parent
+        if (count > 1 && spinning && parent >= 0) {
+            object attached = {
+                .model = model_index,
+                .scale = 0.25f,
+                .transparency = placed.transparency,
+                .position = {
+                    .x = 0.75f * base->bounds_center.x + 1.1f * base->bounds_radius,
+                    .y = 0.75f * base->bounds_center.y,
+                    .z = 0.75f * base->bounds_center.z,
+                    .w = 1
+                }
+            };
+            scene_add_child(&main_scene, parent, attached);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Box around the bounding spheres of every object
+///////////////////////////////////////////////////////////////////////////////
+void measure_scene(float low[3], float high[3]) {
+    for (int k = 0; k < 3; k++) {
+        low[k] = FLT_MAX;
+        high[k] = -FLT_MAX;
+    }
+    for (int i = 0; i < main_scene.objects.length; i++) {
+        const object* o = &main_scene.objects.elements[i];
+        vec3d center = object_bounds_center(&main_scene, o);
+        float radius = object_bounds_radius(&main_scene, o);
+        float c[3] = { center.x, center.y, center.z };
+        for (int k = 0; k < 3; k++) {
+            low[k] = fminf(low[k], c[k] - radius);
+            high[k] = fmaxf(high[k], c[k] + radius);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Add point lights circling the scene at different heights and speeds,
+// every fourth one a spot light aimed at the middle of the scene
+///////////////////////////////////////////////////////////////////////////////
+void place_lights(int count) {
+    if (count <= 0 || main_scene.objects.length == 0)
+        return;
+
+    float low[3], high[3];
+    measure_scene(low, high);
+    vec3d middle = { .x = (low[0] + high[0]) / 2, .y = (low[1] + high[1]) / 2, .z = (low[2] + high[2]) / 2, .w = 1 };
+    float extent = fmaxf(fmaxf(high[0] - low[0], high[1] - low[1]), high[2] - low[2]) / 2;
+
+    light_orbit_array_reserve(&light_orbits, count);
+    for (int i = 0; i < count; i++) {
+        // Spread the orbits with the fractional parts of multiples of irrational steps
+        float spread = i * 0.6180339f - floorf(i * 0.6180339f);
+        float rise = i * 0.7548777f - floorf(i * 0.7548777f);
+        light_orbit orbit = {
+            .light = scene_lighting.lights.length,
+            .center = middle,
+            .radius = extent * (0.2f + 0.8f * spread),
+            .height = extent * (2 * rise - 1),
+            .angle = i * 2.3999632f,
+            .speed = (i & 1 ? -1 : 1) * (0.3f + 0.7f * rise)
+        };
+        light source = {
+            .type = i % 4 == 3 ? LIGHT_SPOT : LIGHT_POINT,
+            .intensity = 1,
+            .range = extent * 0.35f,
+            .spot_cos_outer = 0.85f,
+            .spot_cos_inner = 0.95f
+        };
+        if (lighting_add(&scene_lighting, source))
+            light_orbit_array_push(&light_orbits, orbit);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Move the circling lights along their orbits
+///////////////////////////////////////////////////////////////////////////////
+void update_lights(float delta_time) {
+    for (int i = 0; i < light_orbits.length; i++) {
+        light_orbit* orbit = &light_orbits.elements[i];
+        light* source = &scene_lighting.lights.elements[orbit->light];
+        orbit->angle += orbit->speed * delta_time;
+        source->position.x = orbit->center.x + orbit->radius * cosf(orbit->angle);
+        source->position.y = orbit->center.y + orbit->height;
+        source->position.z = orbit->center.z + orbit->radius * sinf(orbit->angle);
+        source->position.w = 1;
+        if (source->type == LIGHT_SPOT) {
+            source->direction = vector_sub(orbit->center, source->position);
+            source->direction.w = 0;
+            if (vector_length(source->direction) > 0)
+                vector_normalize(&source->direction);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Give a shadow map to the directional light and to the first spot lights,
+// all seeing the sphere around the scene
+///////////////////////////////////////////////////////////////////////////////
+void setup_shadow_maps(void) {
+    if (main_scene.objects.length == 0)
+        return;
+    float low[3], high[3];
+    measure_scene(low, high);
+    shadow_scene_center.x = (low[0] + high[0]) / 2;
+    shadow_scene_center.y = (low[1] + high[1]) / 2;
+    shadow_scene_center.z = (low[2] + high[2]) / 2;
+    shadow_scene_center.w = 1;
+    float size[3] = { high[0] - low[0], high[1] - low[1], high[2] - low[2] };
+    shadow_scene_radius = sqrtf(size[0] * size[0] + size[1] * size[1] + size[2] * size[2]) / 2;
+
+    for (int i = 0; i < scene_lighting.lights.length && num_shadow_maps < SHADOW_MAX_MAPS; i++) {
+        if (scene_lighting.lights.elements[i].type == LIGHT_POINT)
+            continue;
+        if (!shadow_map_init(&shadow_maps[num_shadow_maps], i, SHADOW_MAP_SIZE))
+            break;
+        num_shadow_maps++;
     }
 }
 
@@ -76,6 +413,16 @@ void setup(void) {
         sizeof(uint32_t) * (uint32_t)window_width * (uint32_t) window_height
     );
 
+    if (!depth_buffer_init(&z_buffer, window_width, window_height) ||
+        !arena_init(&frame_arena, FRAME_ARENA_SIZE)) {
+        is_running = false;
+    }
+    if (triangle_shading_mode == SHADING_DEFERRED &&
+        (!gbuffer_init(&frame_gbuffer, window_width, window_height, MODEL_DEFAULT_SPECULAR) || !deferred_init())) {
+        is_running = false;
+    }
+    color_tables_init(&light_tables, gamma_correct);
+
     color_buffer_texture = SDL_CreateTexture(
         renderer,
         SDL_PIXELFORMAT_RGBA32,
@@ -84,17 +431,9 @@ void setup(void) {
         window_height
     );
 
-    //texture = (uint32_t*) REDBRICK_TEXTURE;
-    // allocate the total amount of bytes in memory to hold our wall texture
-    mesh_texture = (uint32_t*) malloc(sizeof(uint32_t) * (uint32_t)texture_width * (uint32_t)texture_height);
-
-    // load an external texture using the upng library to decode the file
-    png_texture = upng_new_from_file(TEXTURE_FILENAME);
-    if (png_texture != NULL) {
-        upng_decode(png_texture);
-        if (upng_get_error(png_texture) == UPNG_EOK)
-            mesh_texture = (uint32_t*)upng_get_buffer(png_texture);
-    }
+    // decode the external texture in the background, using the red brick until it's ready
+    texture_loader_init();
+    mesh_texture_handle = texture_load_async(TEXTURE_FILENAME, (uint32_t*) REDBRICK_TEXTURE, 64, 64);
 
     // Initialize the projection matrix elements
     float aspect_ratio = ((float)window_height / (float)window_width);
@@ -107,8 +446,402 @@ void setup(void) {
     proj_matrix.m[2][2] = zfar / (zfar - znear);
     proj_matrix.m[3][2] = (-zfar * znear) / (zfar - znear);
     proj_matrix.m[2][3] = 1.0;
+    view_frustum = frustum_from_projection(&proj_matrix, znear, zfar);
 
-    load_mesh_data();
+    // Load the mesh file given on the command line and place its copies
+    scene_init(&main_scene);
+    main_scene.quantize_vertices = quantize_vertices;
+    int model_index = scene_load_model(&main_scene, mesh_filename, mesh_texture_handle);
+    if (model_index >= 0)
+        place_instances(model_index, num_instances);
+
+    // Every model has its own material in the G-buffer
+    if (triangle_shading_mode == SHADING_DEFERRED) {
+        for (int m = 0; m < main_scene.models.length && m < GBUFFER_MAX_MATERIALS - 1; m++)
+            frame_gbuffer.material_table[m].specular = main_scene.models.elements[m].specular;
+    }
+
+    // Build the BVH over the placed objects before the first frame
+    scene_update(&main_scene, 0);
+    printf("Built BVH over %d objects: %d nodes, SAH cost %.2f, in %.3f ms\n",
+           main_scene.tree.num_items, main_scene.tree.num_nodes, main_scene.tree.build_cost, main_scene.tree.build_ms);
+
+    // Light shining along the view direction, dimmed when other lights join it
+    lighting_init(&scene_lighting);
+    light_orbit_array_init(&light_orbits);
+    light from_camera = {
+        .type = LIGHT_DIRECTIONAL,
+        .direction = { .x = 0, .y = 0, .z = -1 },
+        .intensity = num_moving_lights > 0 ? 0.3f : 1
+    };
+    if (cast_shadows) {
+        vec3d above_left = { .x = -0.4f, .y = -0.6f, .z = -0.7f, .w = 0 };
+        vector_normalize(&above_left);
+        from_camera.direction = above_left;
+    }
+    lighting_add(&scene_lighting, from_camera);
+    place_lights(num_moving_lights);
+    if (cast_shadows)
+        setup_shadow_maps();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Project a camera-space point into the occlusion buffer
+///////////////////////////////////////////////////////////////////////////////
+vec3d project_to_occlusion_buffer(vec3d point) {
+    vec3d projected = {
+        .x = (point.x * proj_matrix.m[0][0] / point.z + 1) * (OCCLUSION_WIDTH / 2),
+        .y = (point.y * proj_matrix.m[1][1] / point.z + 1) * (OCCLUSION_HEIGHT / 2),
+        .z = point.z,
+        .w = 1
+    };
+    return projected;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw the front faces of an object as an occluder, from the same LOD level
+// render() will draw so nothing is hidden behind a silhouette that is not on
+// screen. Triangles crossing the near plane are left out, which only makes
+// the occluder smaller.
+///////////////////////////////////////////////////////////////////////////////
+void draw_occluder(const object* occluder, int level, float znear) {
+    const mesh_lod* lod = &main_scene.models.elements[occluder->model].lods[level];
+    mat4x4 position_matrix = mesh_lod_position_matrix(lod, &occluder->world);
+    for (int f = 0; f < lod->num_faces; f++) {
+        int a, b, c;
+        mesh_lod_face(lod, f, &a, &b, &c);
+        vec3d v0 = transform_point_mat4x4(mesh_lod_stored_position(lod, a), &position_matrix);
+        vec3d v1 = transform_point_mat4x4(mesh_lod_stored_position(lod, b), &position_matrix);
+        vec3d v2 = transform_point_mat4x4(mesh_lod_stored_position(lod, c), &position_matrix);
+        if (v0.z < znear || v1.z < znear || v2.z < znear)
+            continue;
+
+        // Same back-face test as render()
+        vec3d vector_ab = { .x = v1.x - v0.x, .y = v1.y - v0.y, .z = v1.z - v0.z };
+        vec3d vector_ac = { .x = v2.x - v0.x, .y = v2.y - v0.y, .z = v2.z - v0.z };
+        vec3d normal = {
+            .x = (vector_ab.y * vector_ac.z - vector_ab.z * vector_ac.y),
+            .y = (vector_ab.z * vector_ac.x - vector_ab.x * vector_ac.z),
+            .z = (vector_ab.x * vector_ac.y - vector_ab.y * vector_ac.x)
+        };
+        vec3d vector_normal_camera = vector_sub(v0, camera_position);
+        if (vector_dot(normal, vector_normal_camera) > 0)
+            continue;
+
+        occlusion_draw_triangle(&occlusion,
+            project_to_occlusion_buffer(v0),
+            project_to_occlusion_buffer(v1),
+            project_to_occlusion_buffer(v2));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Remove the objects hidden behind the biggest ones from a list of visible
+// objects; returns how many are left
+///////////////////////////////////////////////////////////////////////////////
+int cull_occluded_objects(int* objects, int count) {
+    float pixel_scale = proj_matrix.m[1][1] * ((float)window_height / 2);
+    float znear = -view_frustum.planes[4].distance;
+    float zfar = view_frustum.planes[5].distance;
+
+    // Keep the objects covering the most pixels, largest first
+    int occluders[OCCLUSION_MAX_OCCLUDERS];
+    float occluder_sizes[OCCLUSION_MAX_OCCLUDERS];
+    int occluder_levels[OCCLUSION_MAX_OCCLUDERS];
+    num_occluders = 0;
+    num_occluded_objects = 0;
+    for (int i = 0; i < count; i++) {
+        const object* candidate = &main_scene.objects.elements[objects[i]];
+        if (candidate->transparency > 0)
+            continue;
+        vec3d center = object_bounds_center(&main_scene, candidate);
+        float radius = object_bounds_radius(&main_scene, candidate);
+        float depth = center.z - camera_position.z - radius;
+        if (depth <= znear)
+            continue;
+        float size = 2 * radius * pixel_scale / center.z;
+        if (size < OCCLUSION_MIN_OCCLUDER_PIXELS)
+            continue;
+
+        int slot = num_occluders < OCCLUSION_MAX_OCCLUDERS ? num_occluders++ : OCCLUSION_MAX_OCCLUDERS;
+        while (slot > 0 && occluder_sizes[slot - 1] < size) {
+            if (slot < OCCLUSION_MAX_OCCLUDERS) {
+                occluders[slot] = occluders[slot - 1];
+                occluder_sizes[slot] = occluder_sizes[slot - 1];
+                occluder_levels[slot] = occluder_levels[slot - 1];
+            }
+            slot--;
+        }
+        if (slot < OCCLUSION_MAX_OCCLUDERS) {
+            occluders[slot] = objects[i];
+            occluder_sizes[slot] = size;
+            occluder_levels[slot] = model_select_lod(&main_scene.models.elements[candidate->model], candidate->world_scale, depth, pixel_scale);
+        }
+    }
+    if (num_occluders == 0)
+        return count;
+
+    occlusion_clear(&occlusion, zfar);
+    for (int i = 0; i < num_occluders; i++)
+        draw_occluder(&main_scene.objects.elements[occluders[i]], occluder_levels[i], znear);
+
+    // Test the screen rectangle of every other box at its nearest depth
+    int num_kept = 0;
+    for (int i = 0; i < count; i++) {
+        int index = objects[i];
+        const aabb* box = &main_scene.object_bounds.elements[index];
+        bool occluded = box->min[2] > znear;
+
+        for (int o = 0; occluded && o < num_occluders; o++)
+            occluded = occluders[o] != index;
+        if (occluded) {
+            float x_min = FLT_MAX, y_min = FLT_MAX;
+            float x_max = -FLT_MAX, y_max = -FLT_MAX;
+            for (int corner = 0; corner < 8; corner++) {
+                vec3d point = {
+                    .x = corner & 1 ? box->max[0] : box->min[0],
+                    .y = corner & 2 ? box->max[1] : box->min[1],
+                    .z = corner & 4 ? box->max[2] : box->min[2],
+                    .w = 1
+                };
+                vec3d projected = project_to_occlusion_buffer(point);
+                x_min = fminf(x_min, projected.x);
+                x_max = fmaxf(x_max, projected.x);
+                y_min = fminf(y_min, projected.y);
+                y_max = fmaxf(y_max, projected.y);
+            }
+            occluded = occlusion_test_rect(&occlusion, x_min, y_min, x_max, y_max, box->min[2]);
+        }
+
+        if (occluded)
+            num_occluded_objects++;
+        else
+            objects[num_kept++] = index;
+    }
+    return num_kept;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw every object that can cast a shadow into the map of a light, from
+// the LOD level the map resolution needs. The vertices of each object are
+// projected once into the scratch array, which holds the finest level of
+// any model.
+///////////////////////////////////////////////////////////////////////////////
+void draw_shadow_casters(shadow_map* map, vec3d* scratch) {
+    light* source = &scene_lighting.lights.elements[map->light];
+    shadow_map_begin(map, source, shadow_scene_center, shadow_scene_radius, filter_shadows);
+    const light_shadow* shadow = &source->shadow;
+
+    for (int i = 0; i < main_scene.objects.length; i++) {
+        const object* caster = &main_scene.objects.elements[i];
+        const model* caster_model = &main_scene.models.elements[caster->model];
+        vec3d center = object_bounds_center(&main_scene, caster);
+        float radius = object_bounds_radius(&main_scene, caster);
+
+        // A spot light only reaches the objects ahead of it within its
+        // range, and measures them from their nearest point like the camera
+        float depth = 1;
+        if (shadow->perspective) {
+            vec3d offset = vector_sub(center, source->position);
+            float ahead = vector_dot(offset, source->direction);
+            if (ahead + radius < SHADOW_ZNEAR || vector_length(offset) - radius > source->range)
+                continue;
+            depth = ahead - radius > SHADOW_ZNEAR ? ahead - radius : SHADOW_ZNEAR;
+        }
+        int level = model_select_lod(caster_model, caster->world_scale, depth, map->pixel_scale);
+        const mesh_lod* lod = &caster_model->lods[level];
+
+        mat4x4 position_matrix = mesh_lod_position_matrix(lod, &caster->world);
+        mat4x4 light_matrix = multiply_mat4x4(&position_matrix, &shadow->matrix);
+        for (int v = 0; v < lod->num_vertices; v++)
+            scratch[v] = shadow_map_project(shadow, &light_matrix, mesh_lod_stored_position(lod, v));
+        for (int f = 0; f < lod->num_faces; f++) {
+            int a, b, c;
+            mesh_lod_face(lod, f, &a, &b, &c);
+            shadow_map_draw_face(map, scratch[a], scratch[b], scratch[c]);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Group the instance draws by model and LOD level with a counting sort into a
+// new array from the frame arena, keeping the order of the draws within a group
+///////////////////////////////////////////////////////////////////////////////
+void group_instance_draws(void) {
+    int num_groups = main_scene.models.length * MESH_MAX_LODS;
+    int* offsets = arena_alloc(&frame_arena, sizeof(int) * num_groups);
+    instance_draw* grouped = arena_alloc(&frame_arena, sizeof(instance_draw) * num_instance_draws);
+    if (!offsets || !grouped)
+        return;
+
+    memset(offsets, 0, sizeof(int) * num_groups);
+    for (int i = 0; i < num_instance_draws; i++)
+        offsets[instance_draws[i].model * MESH_MAX_LODS + instance_draws[i].lod]++;
+    int offset = 0;
+    for (int g = 0; g < num_groups; g++) {
+        int count = offsets[g];
+        offsets[g] = offset;
+        offset += count;
+    }
+    for (int i = 0; i < num_instance_draws; i++)
+        grouped[offsets[instance_draws[i].model * MESH_MAX_LODS + instance_draws[i].lod]++] = instance_draws[i];
+    instance_draws = grouped;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sort faces by their depth with a radix sort: the opaque ones front to
+// back, so the depth buffer can reject what is drawn behind them, and the
+// transparent ones back to front, so each blends over what is behind it
+// The float bits are flipped into an unsigned key that orders the same way,
+// inverted for back to front, and the four byte-sized passes bounce between
+// the faces and a scratch array from the frame arena.
+///////////////////////////////////////////////////////////////////////////////
+uint32_t visible_face_key(float depth, bool back_to_front) {
+    uint32_t bits;
+    memcpy(&bits, &depth, sizeof(bits));
+    uint32_t key = bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+    return back_to_front ? ~key : key;
+}
+
+void sort_faces(visible_face* faces, int count, bool back_to_front) {
+    if (count < 2)
+        return;
+    visible_face* scratch = arena_alloc(&frame_arena, sizeof(visible_face) * count);
+    if (!scratch)
+        return;
+
+    uint32_t counts[4][256] = { { 0 } };
+    for (int i = 0; i < count; i++) {
+        uint32_t key = visible_face_key(faces[i].depth, back_to_front);
+        for (int pass = 0; pass < 4; pass++)
+            counts[pass][(key >> (pass * 8)) & 0xFF]++;
+    }
+
+    visible_face* from = faces;
+    visible_face* to = scratch;
+    for (int pass = 0; pass < 4; pass++) {
+        // Skip the passes where every key has the same byte
+        uint32_t first = (visible_face_key(from[0].depth, back_to_front) >> (pass * 8)) & 0xFF;
+        if (counts[pass][first] == (uint32_t)count)
+            continue;
+
+        uint32_t offsets[256];
+        uint32_t offset = 0;
+        for (int b = 0; b < 256; b++) {
+            offsets[b] = offset;
+            offset += counts[pass][b];
+        }
+        for (int i = 0; i < count; i++) {
+            uint32_t key = visible_face_key(from[i].depth, back_to_front);
+            to[offsets[(key >> (pass * 8)) & 0xFF]++] = from[i];
+        }
+        visible_face* swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != faces)
+        memcpy(faces, from, sizeof(visible_face) * count);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Transform a batch of copies of one model level with their world matrices
+// Whole meshlets are culled against the view frustum and their normal cones,
+// and only the vertices of the clusters that survive are transformed.
+// Quantized vertices are decoded by the transform itself, through a world
+// matrix with the decoding folded in.
+///////////////////////////////////////////////////////////////////////////////
+void transform_instances(const mesh_lod* lod, const instance_draw* draws, int draw_offset, int count) {
+    for (int d = 0; d < count; d++) {
+        const instance_draw* draw = &draws[draw_offset + d];
+        const object* instance = &main_scene.objects.elements[draw->object];
+        const mat4x4* world = &instance->world;
+        mat4x4 position_matrix = mesh_lod_position_matrix(lod, world);
+        vec3d* instance_vertices = &working_mesh_vertices[draw->vertex_base];
+
+        for (int m = 0; m < lod->num_meshlets; m++) {
+            const meshlet* cluster = &lod->meshlets[m];
+
+            vec3d center = { .x = cluster->center[0], .y = cluster->center[1], .z = cluster->center[2] };
+            center = transform_point_mat4x4(center, world);
+
+            vec3d cone_apex = { .x = cluster->cone_apex[0], .y = cluster->cone_apex[1], .z = cluster->cone_apex[2] };
+            cone_apex = transform_point_mat4x4(cone_apex, world);
+
+            vec3d cone_axis = { .x = cluster->cone_axis[0], .y = cluster->cone_axis[1], .z = cluster->cone_axis[2] };
+            cone_axis = transform_direction_mat4x4(cone_axis, world);
+            vector_normalize(&cone_axis);
+
+            if (!frustum_intersects_sphere(&view_frustum, center, cluster->radius * instance->world_scale) ||
+                meshlet_is_backfacing(cone_apex, cone_axis, cluster->cone_cutoff, camera_position)) {
+                continue;
+            }
+
+            // Scale, rotate and translate the meshlet vertices into the
+            // world, saving them in the range of this instance
+            const uint32_t* cluster_vertices = &lod->meshlet_vertices[cluster->vertex_offset];
+            // Smooth shading lights the vertices from their world normals,
+            // which quantized meshes decode in the same pass
+            vec3d* instance_normals = working_mesh_normals ? &working_mesh_normals[draw->vertex_base] : NULL;
+            if (lod->quantized_vertices) {
+                transform_quantized_vertices(lod->quantized_vertices, cluster_vertices, cluster->vertex_count, &position_matrix, instance_vertices, world, instance_normals);
+            } else {
+                for (uint32_t v = 0; v < cluster->vertex_count; v++)
+                    instance_vertices[cluster_vertices[v]] = transform_point_mat4x4(lod->vertex_data[cluster_vertices[v]], world);
+
+                // The world scale is uniform, so dividing it out keeps the
+                // normals unit
+                if (instance_normals) {
+                    float inverse_scale = instance->world_scale > 0 ? 1 / instance->world_scale : 1;
+                    for (uint32_t v = 0; v < cluster->vertex_count; v++) {
+                        uint32_t index = cluster_vertices[v];
+                        vec3d normal = transform_direction_mat4x4(mesh_lod_normal(lod, index), world);
+                        normal.x *= inverse_scale;
+                        normal.y *= inverse_scale;
+                        normal.z *= inverse_scale;
+                        instance_normals[index] = normal;
+                    }
+                }
+            }
+
+            // Loop the meshlet vertices, projecting them
+            for (uint32_t v = 0; v < cluster->vertex_count; v++) {
+                int w = draw->vertex_base + cluster_vertices[v];
+                vec3d working_vertex = working_mesh_vertices[w];
+
+                // Return the projection of the current point working point
+                vec3d projected_point = multiply_vec3d_mat4x4(&working_vertex, &proj_matrix);
+
+                // Scale into view
+                projected_point.x *= (float)window_width / 2;
+                projected_point.y *= (float)window_height / 2;
+
+                // Translate into view
+                projected_point.x += (float)window_width / 2;
+                projected_point.y += (float)window_height / 2;
+
+                // Save the 2d projected points
+                projected_points[w] = projected_point;
+
+                // Save the depth of all vertices
+                vertex_depth_list[w] = working_vertex.z;
+            }
+
+            // calculate the average z-depth of each face of the meshlet
+            for (uint32_t f = 0; f < cluster->face_count; f++) {
+                uint32_t face_index = cluster->face_offset + f;
+                int a, b, c;
+                mesh_lod_face(lod, face_index, &a, &b, &c);
+                visible_face* visible = instance->transparency > 0 ?
+                    &transparent_faces[num_transparent_faces++] : &visible_faces[num_visible_faces++];
+                visible->draw = draw_offset + d;
+                visible->face = face_index;
+                visible->depth = vertex_depth_list[draw->vertex_base + a];
+                visible->depth += vertex_depth_list[draw->vertex_base + b];
+                visible->depth += vertex_depth_list[draw->vertex_base + c];
+                visible->depth /= 3.0;
+            }
+        }
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -124,155 +857,278 @@ void update(void) {
     // Store the milliseconds of the current frame
     previous_frame_time = SDL_GetTicks();
 
-    // Loop all cube vertices, rotating and projecting them
-    for (int i = 0; i < N_VERTICES; i++) {
-        vec3d working_vertex = *(vec3d*)arraylist_get(&mesh_vertices, i);
+    // Everything the last frame rendered is done with
+    arena_reset(&frame_arena);
 
-        // Rotate the original 3d point in the x, y, and z axis
-        working_vertex = rotate_x(working_vertex, cube_rotation.x += 0.02 * delta_time);
-        working_vertex = rotate_y(working_vertex, cube_rotation.y += 0.03 * delta_time);
-        working_vertex = rotate_z(working_vertex, cube_rotation.z += 0.02 * delta_time);
+    // Advance the rotation of every object and the lights once per frame
+    scene_update(&main_scene, delta_time);
+    update_lights(delta_time);
 
-        // After rotation, translate the cube 5 units in the z-axis
-        working_vertex.z -= -6.0;
+    // Cull whole objects against the view frustum through the scene BVH
+    int num_visible_objects = 0;
+    num_instance_draws = 0;
+    num_visible_faces = 0;
+    num_transparent_faces = 0;
+    visible_objects = arena_alloc(&frame_arena, sizeof(int) * main_scene.objects.length);
+    instance_draws = arena_alloc(&frame_arena, sizeof(instance_draw) * main_scene.objects.length);
+    if (visible_objects && instance_draws)
+        num_visible_objects = scene_cull(&main_scene, &view_frustum, visible_objects);
 
-        // Save the rotated and transleted vertex in a list
-        working_mesh_vertices[i] = working_vertex;
-
-        // Return the projection of the current point working point
-        vec3d projected_point = multiply_vec3d_mat4x4(&working_vertex, &proj_matrix);
+    // Drop the objects hidden behind the biggest ones on screen
+    num_visible_objects = cull_occluded_objects(visible_objects, num_visible_objects);
+    if (report_occlusion_stats && SDL_TICKS_PASSED(SDL_GetTicks(), occlusion_report_time + 1000)) {
+        printf("Occlusion culling: %d occluders, %d of %d objects culled\n",
+               num_occluders, num_occluded_objects, num_visible_objects + num_occluded_objects);
+        occlusion_report_time = SDL_GetTicks();
+    }
 
-        // Scale into view
-        projected_point.x *= (float)window_width / 2;
-        projected_point.y *= (float)window_height / 2;
+    // Pick the LOD level of every visible object
+    float pixel_scale = proj_matrix.m[1][1] * ((float)window_height / 2);
+    float znear = -view_frustum.planes[4].distance;
+    for (int i = 0; i < num_visible_objects; i++) {
+        const object* instance = &main_scene.objects.elements[visible_objects[i]];
+        const model* instance_model = &main_scene.models.elements[instance->model];
+        vec3d center = object_bounds_center(&main_scene, instance);
+        float radius = object_bounds_radius(&main_scene, instance);
 
-        // Translate into view
-        projected_point.x += (float)window_width / 2;
-        projected_point.y += (float)window_height / 2;
+        // Measure from the nearest point of the bounding sphere, never closer than znear
+        float depth = center.z - camera_position.z - radius;
+        if (depth < znear)
+            depth = znear;
 
-        // Save the 2d projected points
-        projected_points[i] = projected_point;
+        instance_draw* draw = &instance_draws[num_instance_draws++];
+        draw->model = instance->model;
+        draw->lod = model_select_lod(instance_model, instance->world_scale, depth, pixel_scale);
+        draw->object = visible_objects[i];
+    }
+    group_instance_draws();
 
-        // Save the depth of all vertices
-        vertex_depth_list[i] = working_vertex.z;
+    // Give every draw its own range of working vertices, and room for all
+    // the faces of its level in the opaque or the transparent list
+    int num_working_vertices = 0;
+    int max_visible_faces = 0;
+    int max_transparent_faces = 0;
+    for (int i = 0; i < num_instance_draws; i++) {
+        instance_draw* draw = &instance_draws[i];
+        const mesh_lod* lod = &main_scene.models.elements[draw->model].lods[draw->lod];
+        draw->vertex_base = num_working_vertices;
+        num_working_vertices += lod->num_vertices;
+        if (main_scene.objects.elements[draw->object].transparency > 0)
+            max_transparent_faces += lod->num_faces;
+        else
+            max_visible_faces += lod->num_faces;
     }
+    projected_points = arena_alloc(&frame_arena, sizeof(vec3d) * num_working_vertices);
+    vertex_depth_list = arena_alloc(&frame_arena, sizeof(float) * num_working_vertices);
+    working_mesh_vertices = arena_alloc(&frame_arena, sizeof(vec3d) * num_working_vertices);
+    visible_faces = arena_alloc(&frame_arena, sizeof(visible_face) * max_visible_faces);
+    transparent_faces = arena_alloc(&frame_arena, sizeof(visible_face) * max_transparent_faces);
+    working_mesh_normals = NULL;
+    if (triangle_shading_mode != SHADING_FLAT)
+        working_mesh_normals = arena_alloc(&frame_arena, sizeof(vec3d) * num_working_vertices);
+    if (!projected_points || !vertex_depth_list || !working_mesh_vertices || !visible_faces || !transparent_faces ||
+        (triangle_shading_mode != SHADING_FLAT && !working_mesh_normals))
+        num_instance_draws = 0;
+
+    // List the lights that can reach every screen tile
+    if (!lighting_bin(&scene_lighting, &frame_arena, &proj_matrix, window_width, window_height, znear))
+        num_instance_draws = 0;
 
-    // calculate the average z-depth of each triangle
-    float average_depth_list[N_FACES];
-    for (int i = 0; i < N_FACES; i++) {
-        average_depth_list[i] = vertex_depth_list[mesh_faces[i].a - 1];
-        average_depth_list[i] += vertex_depth_list[mesh_faces[i].b - 1];
-        average_depth_list[i] += vertex_depth_list[mesh_faces[i].c - 1];
-        average_depth_list[i] /= 3.0;
+    // Draw the shadow casters into the map of every light that has one
+    if (num_shadow_maps > 0) {
+        int max_vertices = 0;
+        for (int m = 0; m < main_scene.models.length; m++) {
+            if (main_scene.models.elements[m].lods[0].num_vertices > max_vertices)
+                max_vertices = main_scene.models.elements[m].lods[0].num_vertices;
+        }
+        vec3d* shadow_vertices = arena_alloc(&frame_arena, sizeof(vec3d) * max_vertices);
+        if (!shadow_vertices)
+            num_instance_draws = 0;
+        for (int s = 0; shadow_vertices && s < num_shadow_maps; s++)
+            draw_shadow_casters(&shadow_maps[s], shadow_vertices);
     }
 
-    // sort triangles by their average depth value
-    for (int i = 0; i < N_FACES; i++) {
-        for (int j = 0; j < N_FACES - 1; j++) {
-            if (average_depth_list[i] > average_depth_list[j]) {
-                // swap the triangls in the original triangle list
-                triangle temp_triangle = mesh_faces[i];
-                mesh_faces[i] = mesh_faces[j];
-                mesh_faces[j] = temp_triangle;
-                // also swap the depth value in the depth array
-                float temp_depth = average_depth_list[i];
-                average_depth_list[i] = average_depth_list[j];
-                average_depth_list[j] = temp_depth;
-            }
+    // Transform the copies of each model level together
+    for (int first = 0; first < num_instance_draws;) {
+        int last = first + 1;
+        while (last < num_instance_draws &&
+               instance_draws[last].model == instance_draws[first].model &&
+               instance_draws[last].lod == instance_draws[first].lod) {
+            last++;
         }
+        const mesh_lod* lod = &main_scene.models.elements[instance_draws[first].model].lods[instance_draws[first].lod];
+        transform_instances(lod, instance_draws, first, last - first);
+        first = last;
     }
+
+    // sort the visible triangles by their average depth value, front to back,
+    // and the transparent ones back to front
+    sort_faces(visible_faces, num_visible_faces, false);
+    sort_faces(transparent_faces, num_transparent_faces, true);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Render function to draw objects on the display
+// Draw one visible face, blended over the color buffer when it belongs to a
+// transparent object; current_texture tracks the texture in use between
+// faces
 ///////////////////////////////////////////////////////////////////////////////
-void render(void) {
-    // Clear the render background with a black color
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
+void draw_visible_face(const visible_face* visible, bool transparent, texture_handle** current_texture) {
+    const instance_draw* draw = &instance_draws[visible->draw];
+    const model* face_model = &main_scene.models.elements[draw->model];
+    const mesh_lod* lod = &face_model->lods[draw->lod];
+    uint32_t face = visible->face;
 
-    // Loop all cube face triangles to render them one by one
-    for (int i = 0; i < N_FACES; i++) {
-        vec3d point_a = projected_points[mesh_faces[i].a - 1];
-        vec3d point_b = projected_points[mesh_faces[i].b - 1];
-        vec3d point_c = projected_points[mesh_faces[i].c - 1];
+    // Pick up the model texture, decoded or still the placeholder
+    if (face_model->texture != *current_texture) {
+        *current_texture = face_model->texture;
+        mesh_texture = texture_get_pixels(*current_texture);
+        texture_width = texture_get_width(*current_texture);
+        texture_height = texture_get_height(*current_texture);
+    }
 
-        uint32_t triangle_color = mesh_faces[i].color;
+    int a, b, c;
+    mesh_lod_face(lod, face, &a, &b, &c);
+    a += draw->vertex_base;
+    b += draw->vertex_base;
+    c += draw->vertex_base;
 
-        // Get back the vertices of each triangle face
-        vec3d v0 = working_mesh_vertices[mesh_faces[i].a - 1];
-        vec3d v1 = working_mesh_vertices[mesh_faces[i].b - 1];
-        vec3d v2 = working_mesh_vertices[mesh_faces[i].c - 1];
+    vec3d point_a = projected_points[a];
+    vec3d point_b = projected_points[b];
+    vec3d point_c = projected_points[c];
 
-        // Get the triangle UV coordinates
-        tex2d a_uv = mesh_faces_uvs[mesh_faces[i].face_index].a_uv;
-        tex2d b_uv = mesh_faces_uvs[mesh_faces[i].face_index].b_uv;
-        tex2d c_uv = mesh_faces_uvs[mesh_faces[i].face_index].c_uv;
+    // Transparent objects carry their opacity in the alpha of the color
+    uint32_t triangle_color = lod->face_colors[face];
+    if (transparent) {
+        float transparency = main_scene.objects.elements[draw->object].transparency;
+        uint32_t alpha = (uint32_t)((1 - transparency) * 255 + 0.5f);
+        triangle_color = (triangle_color & 0x00FFFFFF) | (alpha << 24);
+    }
 
-        // Find the two triangle vectors to calculate the face normal
-        vec3d vector_ab = { .x = v1.x - v0.x, .y = v1.y - v0.y, .z = v1.z - v0.z };
-        vec3d vector_ac = { .x = v2.x - v0.x, .y = v2.y - v0.y, .z = v2.z - v0.z };
+    // Get back the vertices of each triangle face
+    vec3d v0 = working_mesh_vertices[a];
+    vec3d v1 = working_mesh_vertices[b];
+    vec3d v2 = working_mesh_vertices[c];
 
-        // Normalize the vectors
-        vector_normalize(&vector_ab);
-        vector_normalize(&vector_ac);
+    // Find the two triangle vectors to calculate the face normal
+    vec3d vector_ab = { .x = v1.x - v0.x, .y = v1.y - v0.y, .z = v1.z - v0.z };
+    vec3d vector_ac = { .x = v2.x - v0.x, .y = v2.y - v0.y, .z = v2.z - v0.z };
 
-        // Compute the surface normal (through cross-product)
-        vec3d normal = {
-            .x = (vector_ab.y * vector_ac.z - vector_ab.z * vector_ac.y),
-            .y = (vector_ab.z * vector_ac.x - vector_ab.x * vector_ac.z),
-            .z = (vector_ab.x * vector_ac.y - vector_ab.y * vector_ac.x)
-        };
-        vector_normalize(&normal);
+    // Normalize the vectors
+    vector_normalize(&vector_ab);
+    vector_normalize(&vector_ac);
 
-        // Get the vector distance between a point in the triangle (v0) and the camera
-        vec3d vector_normal_camera = {
-            .x = v0.x - camera_position.x,
-            .y = v0.y - camera_position.y,
-            .z = v0.z - camera_position.z
+    // Compute the surface normal (through cross-product)
+    vec3d normal = {
+        .x = (vector_ab.y * vector_ac.z - vector_ab.z * vector_ac.y),
+        .y = (vector_ab.z * vector_ac.x - vector_ab.x * vector_ac.z),
+        .z = (vector_ab.x * vector_ac.y - vector_ab.y * vector_ac.x)
+    };
+    vector_normalize(&normal);
+
+    // Get the vector distance between a point in the triangle (v0) and the camera
+    vec3d vector_normal_camera = {
+        .x = v0.x - camera_position.x,
+        .y = v0.y - camera_position.y,
+        .z = v0.z - camera_position.z
+    };
+
+    // Calculate how similar it is with the normal usinng the dot product
+    float dot_normal_camera = vector_dot(normal, vector_normal_camera);
+
+    // only render the triangle that has a positive-z-poiting normal
+    if (dot_normal_camera > 0) {
+        return;
+    }
+
+    // Flat shading lights the whole face once, at its middle, from the
+    // lights of the tile it falls in; smooth shading lights it from the
+    // vertex normals while it is drawn. Transparent faces cannot go in the
+    // G-buffer, which holds one surface per pixel, so they are lit per
+    // pixel as they are blended.
+    triangle_shading shading = { .mode = triangle_shading_mode, .color = triangle_color, .lights = &scene_lighting, .blend = transparent };
+    if (transparent && shading.mode == SHADING_DEFERRED)
+        shading.mode = SHADING_PHONG;
+    if (triangle_shading_mode == SHADING_FLAT) {
+        vec3d middle = {
+            .x = (v0.x + v1.x + v2.x) / 3,
+            .y = (v0.y + v1.y + v2.y) / 3,
+            .z = (v0.z + v1.z + v2.z) / 3
         };
+        int middle_x = (int)((point_a.x + point_b.x + point_c.x) / 3);
+        int middle_y = (int)((point_a.y + point_b.y + point_c.y) / 3);
+        float light_shade_factor = light_diffuse(&scene_lighting, middle_x, middle_y, middle, normal);
+        shading.color = apply_light(triangle_color, light_shade_factor);
+    } else {
+        shading.positions[0] = v0;
+        shading.positions[1] = v1;
+        shading.positions[2] = v2;
+        shading.normals[0] = working_mesh_normals[a];
+        shading.normals[1] = working_mesh_normals[b];
+        shading.normals[2] = working_mesh_normals[c];
+        shading.specular = face_model->specular;
+        shading.target = &frame_gbuffer;
+        shading.material = gbuffer_material_id(draw->model);
+    }
 
-        // Calculate how similar it is with the normal usinng the dot product
-        float dot_normal_camera = vector_dot(normal, vector_normal_camera);
+    // Draw a textured triangle
+    // triangle_uv face_uvs = mesh_lod_face_uvs(lod, face);
+    // draw_textured_triangle(
+    //     point_a.x, point_a.y, point_a.z, point_a.w, face_uvs.a_uv.u, face_uvs.a_uv.v,
+    //     point_b.x, point_b.y, point_b.z, point_b.w, face_uvs.b_uv.u, face_uvs.b_uv.v,
+    //     point_c.x, point_c.y, point_c.z, point_c.w, face_uvs.c_uv.u, face_uvs.c_uv.v,
+    //     mesh_texture
+    // );
 
-        // only render the triangle that has a positive-z-poiting normal
-        if (dot_normal_camera > 0) {
-            continue;
-        }
+    // Draw a filled triangle
+    draw_filled_triangle(
+        point_a.x, point_a.y, point_a.w,
+        point_b.x, point_b.y, point_b.w,
+        point_c.x, point_c.y, point_c.w,
+        &shading
+    );
+
+    // Draw triangle face lines
+    // draw_triangle(
+    //     point_a.x, point_a.y,
+    //     point_b.x, point_b.y,
+    //     point_c.x, point_c.y,
+    //     0xFF000000
+    // );
+}
 
-        // Define a vector to represent a light coming from a direction
-        vec3d light_direction = { .x = 0, .y = 0, .z = -1 };
-        vector_normalize(&light_direction);
-
-        // Shade the triangle based on how aligned is the normal and the light direction
-        float light_shade_factor = vector_dot(normal, light_direction);
-
-        // Apply a % light factor to a color
-        triangle_color = apply_light(triangle_color, light_shade_factor);
-
-        // Draw a textured triangle
-        // draw_textured_triangle(
-        //     point_a.x, point_a.y, point_a.z, point_a.w, a_uv.u, a_uv.v,
-        //     point_b.x, point_b.y, point_b.z, point_b.w, b_uv.u, b_uv.v,
-        //     point_c.x, point_c.y, point_c.z, point_c.w, c_uv.u, c_uv.v,
-        //     mesh_texture
-        // );
-
-        // Draw a filled triangle
-        draw_filled_triangle(
-            point_a.x, point_a.y,
-            point_b.x, point_b.y,
-            point_c.x, point_c.y,
-            triangle_color
-        );
-
-        // Draw triangle face lines
-        // draw_triangle(
-        //     point_a.x, point_a.y,
-        //     point_b.x, point_b.y,
-        //     point_c.x, point_c.y,
-        //     0xFF000000
-        // );
+///////////////////////////////////////////////////////////////////////////////
+// Render function to draw objects on the display
+///////////////////////////////////////////////////////////////////////////////
+void render(void) {
+    // Clear the render background with a black color
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    depth_buffer_clear(&z_buffer);
+
+    // Loop all visible face triangles to render them one by one
+    texture_handle* current_texture = NULL;
+    for (int i = 0; i < num_visible_faces; i++)
+        draw_visible_face(&visible_faces[i], false, &current_texture);
+
+    // Light the G-buffer now that every triangle is in it
+    if (triangle_shading_mode == SHADING_DEFERRED && num_visible_faces > 0)
+        deferred_light(&frame_gbuffer, z_buffer.pixels, &scene_lighting, color_buffer);
+
+    // Blend the transparent faces over everything else, back to front
+    for (int i = 0; i < num_transparent_faces; i++)
+        draw_visible_face(&transparent_faces[i], true, &current_texture);
+
+    // Report how much the depth pyramid saved, and how long the texture took
+    // to load, when asked to
+    if (report_depth_stats && SDL_TICKS_PASSED(SDL_GetTicks(), depth_report_time + 1000)) {
+        printf("Hierarchical Z: %d of %d triangles and %d tiles rejected\n",
+               z_buffer.triangles_rejected, z_buffer.triangles_drawn, z_buffer.tiles_rejected);
+        depth_report_time = SDL_GetTicks();
+    }
+    if (report_texture_stats && !texture_load_reported && texture_is_ready(mesh_texture_handle)) {
+        printf("Loaded %s in %.3f ms (%s)\n", mesh_texture_handle->filename, mesh_texture_handle->load_ms,
+               mesh_texture_handle->cache_hit ? "warm, texture cache" : "cold, png decode");
+        texture_load_reported = true;
     }
 
     // Render the color buffer using a SDL texture
@@ -288,6 +1144,39 @@ void render(void) {
 // Main function
 ///////////////////////////////////////////////////////////////////////////////
 int main(int argc, char **argv) {
+    // Options can go anywhere; the other arguments are the mesh file and the copy count
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quantize") == 0)
+            quantize_vertices = true;
+        else if (strcmp(argv[i], "--gouraud") == 0)
+            triangle_shading_mode = SHADING_GOURAUD;
+        else if (strcmp(argv[i], "--phong") == 0)
+            triangle_shading_mode = SHADING_PHONG;
+        else if (strcmp(argv[i], "--deferred") == 0)
+            triangle_shading_mode = SHADING_DEFERRED;
+        else if (strcmp(argv[i], "--shadows") == 0)
+            cast_shadows = true;
+        else if (strcmp(argv[i], "--pcf") == 0)
+            filter_shadows = true;
+        else if (strcmp(argv[i], "--transparent") == 0)
+            transparent_objects = true;
+        else if (strcmp(argv[i], "--gamma") == 0)
+            gamma_correct = true;
+        else if (strcmp(argv[i], "--depth-stats") == 0)
+            report_depth_stats = true;
+        else if (strcmp(argv[i], "--occlusion-stats") == 0)
+            report_occlusion_stats = true;
+        else if (strcmp(argv[i], "--texture-stats") == 0)
+            report_texture_stats = true;
+        else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+            num_moving_lights = atoi(argv[++i]);
+        else if (positional++ == 0)
+            mesh_filename = argv[i];
+        else if (atoi(argv[i]) > 0)
+            num_instances = atoi(argv[i]);
+    }
+
     is_running = initialize_window();
 
     setup();
@@ -300,8 +1189,19 @@ int main(int argc, char **argv) {
 
     destroy_window();
 
+    texture_loader_shutdown();
+    texture_free(mesh_texture_handle);
+
     free(color_buffer);
-    arraylist_free(&mesh_vertices);
+    depth_buffer_free(&z_buffer);
+    deferred_shutdown();
+    gbuffer_free(&frame_gbuffer);
+    arena_free(&frame_arena);
+    for (int s = 0; s < num_shadow_maps; s++)
+        shadow_map_free(&shadow_maps[s]);
+    lighting_free(&scene_lighting);
+    light_orbit_array_free(&light_orbits);
+    scene_free(&main_scene);
 
     return 0;
 }
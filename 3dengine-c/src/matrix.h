@@ -1,6 +1,9 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <math.h>
+#include "vector.h"
+
 ///////////////////////////////////////////////////////////////////////////////
 // Type definition for 4x4 Matrices
 ///////////////////////////////////////////////////////////////////////////////
@@ -31,4 +34,115 @@ vec3d multiply_vec3d_mat4x4(vec3d* v, mat4x4* m) {
     return result_vector;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Affine transforms, for row vectors (p' = p * M, translation in row 3)
+///////////////////////////////////////////////////////////////////////////////
+mat4x4 identity_mat4x4(void) {
+    mat4x4 m = { .m = {
+        { 1, 0, 0, 0 },
+        { 0, 1, 0, 0 },
+        { 0, 0, 1, 0 },
+        { 0, 0, 0, 1 }
+    } };
+    return m;
+}
+
+mat4x4 scale_mat4x4(float scale) {
+    mat4x4 m = identity_mat4x4();
+    m.m[0][0] = scale;
+    m.m[1][1] = scale;
+    m.m[2][2] = scale;
+    return m;
+}
+
+mat4x4 translation_mat4x4(vec3d translation) {
+    mat4x4 m = identity_mat4x4();
+    m.m[3][0] = translation.x;
+    m.m[3][1] = translation.y;
+    m.m[3][2] = translation.z;
+    return m;
+}
+
+// Same rotations as rotate_x, rotate_y and rotate_z
+mat4x4 rotation_x_mat4x4(float angle) {
+    mat4x4 m = identity_mat4x4();
+    m.m[1][1] = cos(angle);
+    m.m[1][2] = sin(angle);
+    m.m[2][1] = -sin(angle);
+    m.m[2][2] = cos(angle);
+    return m;
+}
+
+mat4x4 rotation_y_mat4x4(float angle) {
+    mat4x4 m = identity_mat4x4();
+    m.m[0][0] = cos(angle);
+    m.m[0][2] = sin(angle);
+    m.m[2][0] = -sin(angle);
+    m.m[2][2] = cos(angle);
+    return m;
+}
+
+mat4x4 rotation_z_mat4x4(float angle) {
+    mat4x4 m = identity_mat4x4();
+    m.m[0][0] = cos(angle);
+    m.m[0][1] = sin(angle);
+    m.m[1][0] = -sin(angle);
+    m.m[1][1] = cos(angle);
+    return m;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Matrix product: transforming by the result applies a, then b
+///////////////////////////////////////////////////////////////////////////////
+mat4x4 multiply_mat4x4(const mat4x4* a, const mat4x4* b) {
+    mat4x4 result;
+    for (int row = 0; row < 4; row++) {
+        for (int col = 0; col < 4; col++) {
+            result.m[row][col] =
+                a->m[row][0] * b->m[0][col] + a->m[row][1] * b->m[1][col] +
+                a->m[row][2] * b->m[2][col] + a->m[row][3] * b->m[3][col];
+        }
+    }
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Object to world transform: scale, rotate in x, y and z, then translate
+///////////////////////////////////////////////////////////////////////////////
+mat4x4 world_mat4x4(float scale, vec3d rotation, vec3d translation) {
+    mat4x4 world = scale_mat4x4(scale);
+    mat4x4 rotation_x = rotation_x_mat4x4(rotation.x);
+    mat4x4 rotation_y = rotation_y_mat4x4(rotation.y);
+    mat4x4 rotation_z = rotation_z_mat4x4(rotation.z);
+    mat4x4 position = translation_mat4x4(translation);
+    world = multiply_mat4x4(&world, &rotation_x);
+    world = multiply_mat4x4(&world, &rotation_y);
+    world = multiply_mat4x4(&world, &rotation_z);
+    world = multiply_mat4x4(&world, &position);
+    return world;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Transform a point (w = 1) or a direction (w = 0) by an affine matrix
+///////////////////////////////////////////////////////////////////////////////
+vec3d transform_point_mat4x4(vec3d v, const mat4x4* m) {
+    vec3d result = {
+        .x = v.x * m->m[0][0] + v.y * m->m[1][0] + v.z * m->m[2][0] + m->m[3][0],
+        .y = v.x * m->m[0][1] + v.y * m->m[1][1] + v.z * m->m[2][1] + m->m[3][1],
+        .z = v.x * m->m[0][2] + v.y * m->m[1][2] + v.z * m->m[2][2] + m->m[3][2],
+        .w = 1
+    };
+    return result;
+}
+
+vec3d transform_direction_mat4x4(vec3d v, const mat4x4* m) {
+    vec3d result = {
+        .x = v.x * m->m[0][0] + v.y * m->m[1][0] + v.z * m->m[2][0],
+        .y = v.x * m->m[0][1] + v.y * m->m[1][1] + v.z * m->m[2][1],
+        .z = v.x * m->m[0][2] + v.y * m->m[1][2] + v.z * m->m[2][2],
+        .w = 0
+    };
+    return result;
+}
+
 #endif
@@ -0,0 +1,104 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <float.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Cluster of up to 64 vertices and 124 consecutive faces of a mesh
+// The bounding sphere and normal cone (apex, axis and cosine of its half
+// angle, all in model space) let a whole cluster be culled before any of
+// its vertices are transformed. A cutoff of -1 marks a cone too wide to cull.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    uint32_t vertex_offset;
+    uint32_t vertex_count;
+    uint32_t face_offset;
+    uint32_t face_count;
+    float center[3];
+    float radius;
+    float cone_apex[3];
+    float cone_axis[3];
+    float cone_cutoff;
+} meshlet;
+
+///////////////////////////////////////////////////////////////////////////////
+// Indexed triangle mesh with every vertex attribute in its own array
+// Faces are triangles given by three 0-based entries of the index buffer.
+// Optional attributes (UVs, normals) are NULL when the source had none.
+// UVs come either per vertex (u, v) or as one UV set per face (face_uvs,
+// six floats per face) when faces share positions but not texture coords.
+// A simplified LOD level records its geometric error (roughly how far its
+// surface strays from the full mesh, in model units) in lod_error.
+// Meshlets cover the faces in order; meshlet_vertices lists the vertices
+// each one uses.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int num_vertices;
+    int num_faces;
+
+    float* x;
+    float* y;
+    float* z;
+
+    float* u;
+    float* v;
+
+    float* nx;
+    float* ny;
+    float* nz;
+
+    uint32_t* indices;
+    uint32_t* colors;
+    float* face_uvs;
+
+    float bounds_min[3];
+    float bounds_max[3];
+    float lod_error;
+
+    int num_meshlets;
+    int num_meshlet_vertices;
+    meshlet* meshlets;
+    uint32_t* meshlet_vertices;
+} mesh;
+
+///////////////////////////////////////////////////////////////////////////////
+// Compute the axis-aligned bounding box of the vertex positions
+///////////////////////////////////////////////////////////////////////////////
+void mesh_compute_bounds(mesh* m) {
+    for (int axis = 0; axis < 3; axis++) {
+        m->bounds_min[axis] = m->num_vertices > 0 ? FLT_MAX : 0;
+        m->bounds_max[axis] = m->num_vertices > 0 ? -FLT_MAX : 0;
+    }
+    for (int i = 0; i < m->num_vertices; i++) {
+        float position[3] = { m->x[i], m->y[i], m->z[i] };
+        for (int axis = 0; axis < 3; axis++) {
+            if (position[axis] < m->bounds_min[axis]) m->bounds_min[axis] = position[axis];
+            if (position[axis] > m->bounds_max[axis]) m->bounds_max[axis] = position[axis];
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Release every buffer owned by a mesh and reset it to empty
+///////////////////////////////////////////////////////////////////////////////
+void mesh_free(mesh* m) {
+    free(m->x);
+    free(m->y);
+    free(m->z);
+    free(m->u);
+    free(m->v);
+    free(m->nx);
+    free(m->ny);
+    free(m->nz);
+    free(m->indices);
+    free(m->colors);
+    free(m->face_uvs);
+    free(m->meshlets);
+    free(m->meshlet_vertices);
+    mesh empty = { 0 };
+    *m = empty;
+}
+
+#endif
@@ -1,11 +1,23 @@
 #ifndef MESH_DATA_H
 #define MESH_DATA_H
 
-const unsigned int N_VERTICES = 8;
-const unsigned int N_FACES = 6 * 2; // 6 faces, 2 triangles per face
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mesh.h"
+#include "texture.h"
+#include "vertex_format.h"
+#include "mesh_optimizer.h"
+#include "meshlet.h"
+#include "mesh_simplifier.h"
 
-// Test dynamic array
-vec3d vertices[N_VERTICES] = {
+///////////////////////////////////////////////////////////////////////////////
+// Built-in cube, used when no mesh file is given
+///////////////////////////////////////////////////////////////////////////////
+#define N_CUBE_VERTICES 8
+#define N_CUBE_FACES (6 * 2) // 6 faces, 2 triangles per face
+
+vec3d cube_vertices[N_CUBE_VERTICES] = {
     { .x = -1, .y = -1, .z = -1, .w = 1 }, // 0
     { .x = -1, .y =  1, .z = -1, .w = 1 }, // 1
     { .x =  1, .y =  1, .z = -1, .w = 1 }, // 2
@@ -16,37 +28,37 @@ vec3d vertices[N_VERTICES] = {
     { .x = -1, .y = -1, .z =  1, .w = 1 }  // 7
 };
 
-arraylist mesh_vertices;
-
-void load_mesh_data() {
-    arraylist_init(&mesh_vertices);
-    for (int i = 0; i < N_VERTICES; i++) {
-        arraylist_add(&mesh_vertices, &vertices[i]);
-    }
-}
-
-triangle mesh_faces[N_FACES] = {
+uint32_t cube_indices[N_CUBE_FACES * 3] = {
     // front
-    { .a = 1, .b = 2, .c = 3, .color = 0xFFFF0000, .face_index = 0 },
-    { .a = 1, .b = 3, .c = 4, .color = 0xFFFF0000, .face_index = 1 },
+    0, 1, 2,
+    0, 2, 3,
     // right
-    { .a = 4, .b = 3, .c = 5, .color = 0xFF00FF00, .face_index = 2 },
-    { .a = 4, .b = 5, .c = 6, .color = 0xFF00FF00, .face_index = 3 },
-    // // back
-    { .a = 6, .b = 5, .c = 7, .color = 0xFF0000FF, .face_index = 4 },
-    { .a = 6, .b = 7, .c = 8, .color = 0xFF0000FF, .face_index = 5 },
+    3, 2, 4,
+    3, 4, 5,
+    // back
+    5, 4, 6,
+    5, 6, 7,
     // left
-    { .a = 8, .b = 7, .c = 2, .color = 0xFFFFFF00, .face_index = 6 },
-    { .a = 8, .b = 2, .c = 1, .color = 0xFFFFFF00, .face_index = 7 },
+    7, 6, 1,
+    7, 1, 0,
     // top
-    { .a = 2, .b = 7, .c = 5, .color = 0xFF00FFFF, .face_index = 8 },
-    { .a = 2, .b = 5, .c = 3, .color = 0xFF00FFFF, .face_index = 9 },
+    1, 6, 4,
+    1, 4, 2,
     // bottom
-    { .a = 6, .b = 8, .c = 1, .color = 0xFFFFFFFF, .face_index = 10 },
-    { .a = 6, .b = 1, .c = 4, .color = 0xFFFFFFFF, .face_index = 11 }
+    5, 7, 0,
+    5, 0, 3
+};
+
+uint32_t cube_colors[N_CUBE_FACES] = {
+    0xFFFF0000, 0xFFFF0000, // front
+    0xFF00FF00, 0xFF00FF00, // right
+    0xFF0000FF, 0xFF0000FF, // back
+    0xFFFFFF00, 0xFFFFFF00, // left
+    0xFF00FFFF, 0xFF00FFFF, // top
+    0xFFFFFFFF, 0xFFFFFFFF  // bottom
 };
 
-triangle_uv mesh_faces_uvs[N_FACES] = {
+triangle_uv cube_faces_uvs[N_CUBE_FACES] = {
     // front
     { .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 } },
     { .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 } },
@@ -67,4 +79,464 @@ triangle_uv mesh_faces_uvs[N_FACES] = {
     { .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 } }
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// One level of detail of a mesh rendered by the engine, sized at runtime
+// Level 0 is the full mesh; every further level is a simplified copy with
+// its own vertices, faces and meshlets, and the object-space error it adds.
+// Faces are split into streams, so each pass only reads what it uses: a
+// 0-based index buffer, 16-bit when every vertex index fits and 32-bit
+// otherwise (only one of the two is allocated), a color per face and a UV
+// set per face.
+// Vertices and face UVs are stored either as floats or quantized (see
+// vertex_format.h); the accessors below read both, and the batched
+// transform works on the quantized vertices directly.
+// Levels loaded from a baked file point into its mapping (see mesh_file.h),
+// which the owner of the levels keeps open and releases.
+///////////////////////////////////////////////////////////////////////////////
+#define MESH_LOD_MAX_16BIT_VERTICES 65536
+
+typedef struct {
+    int num_vertices;
+    int num_faces;
+
+    // Float format: positions, and normals when the mesh has them
+    vec3d* vertex_data;
+    vec3d* vertex_normals;
+    // Quantized format: position and normal of each vertex in 8 bytes
+    quantized_vertex* quantized_vertices;
+    quantization position_quantization;
+    bool has_normals;
+
+    uint16_t* indices16;
+    uint32_t* indices32;
+    uint32_t* face_colors;
+    triangle_uv* face_uvs;
+    uint16_t* quantized_face_uvs; // u, v of each corner
+    quantization uv_quantization;
+
+    int num_meshlets;
+    int num_meshlet_vertices;
+    meshlet* meshlets;
+    uint32_t* meshlet_vertices;
+
+    vec3d bounds_center;
+    float bounds_radius;
+    float error;
+    bool mapped; // the arrays belong to a file mapping and are not freed
+} mesh_lod;
+
+bool allocate_mesh_lod(mesh_lod* lod, int vertex_count, int face_count, bool has_normals, bool quantized) {
+    lod->num_vertices = vertex_count;
+    lod->num_faces = face_count;
+    lod->has_normals = has_normals;
+    int vertices = vertex_count > 0 ? vertex_count : 1;
+    int faces = face_count > 0 ? face_count : 1;
+    bool vertices_ok;
+    if (quantized) {
+        lod->quantized_vertices = (quantized_vertex*) malloc(sizeof(quantized_vertex) * vertices);
+        lod->quantized_face_uvs = (uint16_t*) malloc(sizeof(uint16_t) * 6 * faces);
+        vertices_ok = lod->quantized_vertices && lod->quantized_face_uvs;
+    } else {
+        lod->vertex_data = (vec3d*) malloc(sizeof(vec3d) * vertices);
+        if (has_normals)
+            lod->vertex_normals = (vec3d*) malloc(sizeof(vec3d) * vertices);
+        lod->face_uvs = (triangle_uv*) malloc(sizeof(triangle_uv) * faces);
+        vertices_ok = lod->vertex_data && (!has_normals || lod->vertex_normals) && lod->face_uvs;
+    }
+    if (vertex_count <= MESH_LOD_MAX_16BIT_VERTICES)
+        lod->indices16 = (uint16_t*) malloc(sizeof(uint16_t) * 3 * faces);
+    else
+        lod->indices32 = (uint32_t*) malloc(sizeof(uint32_t) * 3 * faces);
+    lod->face_colors = (uint32_t*) malloc(sizeof(uint32_t) * faces);
+    if (!vertices_ok || (!lod->indices16 && !lod->indices32) || !lod->face_colors) {
+        fprintf(stderr, "Error trying to allocate memory for mesh data.\n");
+        return false;
+    }
+    return true;
+}
+
+void free_mesh_lod(mesh_lod* lod) {
+    mesh_lod empty = { 0 };
+    if (lod->mapped) {
+        *lod = empty;
+        return;
+    }
+    free(lod->vertex_data);
+    free(lod->vertex_normals);
+    free(lod->quantized_vertices);
+    free(lod->quantized_face_uvs);
+    free(lod->indices16);
+    free(lod->indices32);
+    free(lod->face_colors);
+    free(lod->face_uvs);
+    free(lod->meshlets);
+    free(lod->meshlet_vertices);
+    *lod = empty;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Vertex indices of the three corners of a face of a LOD level
+///////////////////////////////////////////////////////////////////////////////
+void mesh_lod_face(const mesh_lod* lod, int face, int* a, int* b, int* c) {
+    if (lod->indices16) {
+        const uint16_t* corners = &lod->indices16[face * 3];
+        *a = corners[0];
+        *b = corners[1];
+        *c = corners[2];
+    } else {
+        const uint32_t* corners = &lod->indices32[face * 3];
+        *a = (int)corners[0];
+        *b = (int)corners[1];
+        *c = (int)corners[2];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Vertex positions as stored, and the matrix taking them to world space:
+// model-space positions and the world matrix itself, or quantized positions
+// and the world matrix with the decoding folded in
+///////////////////////////////////////////////////////////////////////////////
+vec3d mesh_lod_stored_position(const mesh_lod* lod, int vertex) {
+    if (!lod->quantized_vertices)
+        return lod->vertex_data[vertex];
+    const uint16_t* position = lod->quantized_vertices[vertex].position;
+    vec3d stored = { .x = position[0], .y = position[1], .z = position[2], .w = 1 };
+    return stored;
+}
+
+mat4x4 mesh_lod_position_matrix(const mesh_lod* lod, const mat4x4* world) {
+    if (!lod->quantized_vertices)
+        return *world;
+    return quantized_position_matrix(&lod->position_quantization, world);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Model-space position and unit normal of a vertex, in either format; the
+// normal is zero when the mesh has none
+///////////////////////////////////////////////////////////////////////////////
+vec3d mesh_lod_position(const mesh_lod* lod, int vertex) {
+    if (!lod->quantized_vertices)
+        return lod->vertex_data[vertex];
+    const uint16_t* position = lod->quantized_vertices[vertex].position;
+    vec3d decoded = {
+        .x = dequantize_component(position[0], &lod->position_quantization, 0),
+        .y = dequantize_component(position[1], &lod->position_quantization, 1),
+        .z = dequantize_component(position[2], &lod->position_quantization, 2),
+        .w = 1
+    };
+    return decoded;
+}
+
+vec3d mesh_lod_normal(const mesh_lod* lod, int vertex) {
+    vec3d none = { 0, 0, 0, 0 };
+    if (!lod->has_normals)
+        return none;
+    if (!lod->quantized_vertices)
+        return lod->vertex_normals[vertex];
+    return octahedral_decode(lod->quantized_vertices[vertex].normal);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// UV set of a face, in either format
+///////////////////////////////////////////////////////////////////////////////
+triangle_uv mesh_lod_face_uvs(const mesh_lod* lod, int face) {
+    if (!lod->quantized_face_uvs)
+        return lod->face_uvs[face];
+    const uint16_t* uvs = &lod->quantized_face_uvs[face * 6];
+    const quantization* q = &lod->uv_quantization;
+    triangle_uv decoded = {
+        .a_uv = { dequantize_component(uvs[0], q, 0), dequantize_component(uvs[1], q, 1) },
+        .b_uv = { dequantize_component(uvs[2], q, 0), dequantize_component(uvs[3], q, 1) },
+        .c_uv = { dequantize_component(uvs[4], q, 0), dequantize_component(uvs[5], q, 1) }
+    };
+    return decoded;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build an indexed mesh out of the built-in cube arrays
+///////////////////////////////////////////////////////////////////////////////
+bool load_cube_mesh(mesh* m) {
+    mesh empty = { 0 };
+    *m = empty;
+    m->num_vertices = N_CUBE_VERTICES;
+    m->num_faces = N_CUBE_FACES;
+    m->x = (float*) malloc(sizeof(float) * N_CUBE_VERTICES);
+    m->y = (float*) malloc(sizeof(float) * N_CUBE_VERTICES);
+    m->z = (float*) malloc(sizeof(float) * N_CUBE_VERTICES);
+    m->indices = (uint32_t*) malloc(sizeof(uint32_t) * N_CUBE_FACES * 3);
+    m->colors = (uint32_t*) malloc(sizeof(uint32_t) * N_CUBE_FACES);
+    m->face_uvs = (float*) malloc(sizeof(float) * N_CUBE_FACES * 6);
+    if (!m->x || !m->y || !m->z || !m->indices || !m->colors || !m->face_uvs) {
+        fprintf(stderr, "Error trying to allocate memory for the cube mesh.\n");
+        mesh_free(m);
+        return false;
+    }
+
+    for (int i = 0; i < N_CUBE_VERTICES; i++) {
+        m->x[i] = cube_vertices[i].x;
+        m->y[i] = cube_vertices[i].y;
+        m->z[i] = cube_vertices[i].z;
+    }
+    memcpy(m->indices, cube_indices, sizeof(cube_indices));
+    memcpy(m->colors, cube_colors, sizeof(cube_colors));
+    for (int i = 0; i < N_CUBE_FACES; i++) {
+        const triangle_uv* uvs = &cube_faces_uvs[i];
+        float face_uvs[6] = { uvs->a_uv.u, uvs->a_uv.v, uvs->b_uv.u, uvs->b_uv.v, uvs->c_uv.u, uvs->c_uv.v };
+        memcpy(&m->face_uvs[i * 6], face_uvs, sizeof(face_uvs));
+    }
+    mesh_compute_bounds(m);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// UV set of a face of a loaded mesh, from per-face or per-vertex UVs
+///////////////////////////////////////////////////////////////////////////////
+triangle_uv mesh_face_uvs(const mesh* m, int face) {
+    triangle_uv face_uvs = { { 0, 0 }, { 0, 0 }, { 0, 0 } };
+    if (m->face_uvs != NULL) {
+        const float* uvs = &m->face_uvs[face * 6];
+        face_uvs.a_uv.u = uvs[0]; face_uvs.a_uv.v = uvs[1];
+        face_uvs.b_uv.u = uvs[2]; face_uvs.b_uv.v = uvs[3];
+        face_uvs.c_uv.u = uvs[4]; face_uvs.c_uv.v = uvs[5];
+    } else if (m->u != NULL) {
+        uint32_t a = m->indices[face * 3];
+        uint32_t b = m->indices[face * 3 + 1];
+        uint32_t c = m->indices[face * 3 + 2];
+        face_uvs.a_uv.u = m->u[a]; face_uvs.a_uv.v = m->v[a];
+        face_uvs.b_uv.u = m->u[b]; face_uvs.b_uv.v = m->v[b];
+        face_uvs.c_uv.u = m->u[c]; face_uvs.c_uv.v = m->v[c];
+    }
+    return face_uvs;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Smooth normals for a mesh that has none: each vertex gets the sum of the
+// normals of the faces around it, weighted by their area (the length of the
+// cross product), normalized later by load_mesh_lod
+///////////////////////////////////////////////////////////////////////////////
+vec3d* mesh_vertex_normals(const mesh* m) {
+    vec3d* normals = (vec3d*) calloc(m->num_vertices > 0 ? m->num_vertices : 1, sizeof(vec3d));
+    if (!normals) {
+        fprintf(stderr, "Error trying to allocate memory for mesh normals.\n");
+        return NULL;
+    }
+    for (int i = 0; i < m->num_faces; i++) {
+        uint32_t a = m->indices[i * 3];
+        uint32_t b = m->indices[i * 3 + 1];
+        uint32_t c = m->indices[i * 3 + 2];
+        vec3d ab = { .x = m->x[b] - m->x[a], .y = m->y[b] - m->y[a], .z = m->z[b] - m->z[a] };
+        vec3d ac = { .x = m->x[c] - m->x[a], .y = m->y[c] - m->y[a], .z = m->z[c] - m->z[a] };
+        vec3d face_normal = {
+            .x = ab.y * ac.z - ab.z * ac.y,
+            .y = ab.z * ac.x - ab.x * ac.z,
+            .z = ab.x * ac.y - ab.y * ac.x
+        };
+        normals[a] = vector_add(normals[a], face_normal);
+        normals[b] = vector_add(normals[b], face_normal);
+        normals[c] = vector_add(normals[c], face_normal);
+    }
+    return normals;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copy a LOD level in the float format into the quantized one, with the
+// positions spread over its bounding box and the UVs over their range
+///////////////////////////////////////////////////////////////////////////////
+void quantize_mesh_lod(const mesh_lod* source, mesh_lod* lod) {
+    mesh_lod empty = { 0 };
+    *lod = empty;
+    if (!allocate_mesh_lod(lod, source->num_vertices, source->num_faces, source->has_normals, true))
+        return;
+    lod->bounds_center = source->bounds_center;
+    lod->bounds_radius = source->bounds_radius;
+    lod->error = source->error;
+
+    float position_min[3] = { 0, 0, 0 };
+    float position_max[3] = { 0, 0, 0 };
+    for (int i = 0; i < source->num_vertices; i++) {
+        const float position[3] = { source->vertex_data[i].x, source->vertex_data[i].y, source->vertex_data[i].z };
+        for (int axis = 0; axis < 3; axis++) {
+            if (i == 0 || position[axis] < position_min[axis]) position_min[axis] = position[axis];
+            if (i == 0 || position[axis] > position_max[axis]) position_max[axis] = position[axis];
+        }
+    }
+    lod->position_quantization = quantization_from_range(position_min, position_max, 3);
+    for (int i = 0; i < source->num_vertices; i++) {
+        vec3d none = { 0, 0, 0, 0 };
+        quantized_vertex* stored = &lod->quantized_vertices[i];
+        const quantization* q = &lod->position_quantization;
+        stored->position[0] = quantize_component(source->vertex_data[i].x, q, 0);
+        stored->position[1] = quantize_component(source->vertex_data[i].y, q, 1);
+        stored->position[2] = quantize_component(source->vertex_data[i].z, q, 2);
+        octahedral_encode(source->has_normals ? source->vertex_normals[i] : none, stored->normal);
+    }
+
+    float uv_min[2] = { FLT_MAX, FLT_MAX };
+    float uv_max[2] = { -FLT_MAX, -FLT_MAX };
+    for (int i = 0; i < source->num_faces; i++) {
+        const tex2d corners[3] = { source->face_uvs[i].a_uv, source->face_uvs[i].b_uv, source->face_uvs[i].c_uv };
+        for (int k = 0; k < 3; k++) {
+            uv_min[0] = fminf(uv_min[0], corners[k].u);
+            uv_min[1] = fminf(uv_min[1], corners[k].v);
+            uv_max[0] = fmaxf(uv_max[0], corners[k].u);
+            uv_max[1] = fmaxf(uv_max[1], corners[k].v);
+        }
+    }
+    lod->uv_quantization = quantization_from_range(uv_min, uv_max, 2);
+    for (int i = 0; i < source->num_faces; i++) {
+        const triangle_uv* face_uvs = &source->face_uvs[i];
+        const float uvs[6] = {
+            face_uvs->a_uv.u, face_uvs->a_uv.v, face_uvs->b_uv.u, face_uvs->b_uv.v, face_uvs->c_uv.u, face_uvs->c_uv.v
+        };
+        for (int k = 0; k < 6; k++)
+            lod->quantized_face_uvs[i * 6 + k] = quantize_component(uvs[k], &lod->uv_quantization, k & 1);
+    }
+
+    // Both levels pick the index width from the same vertex count
+    if (lod->indices16)
+        memcpy(lod->indices16, source->indices16, sizeof(uint16_t) * 3 * source->num_faces);
+    else
+        memcpy(lod->indices32, source->indices32, sizeof(uint32_t) * 3 * source->num_faces);
+    memcpy(lod->face_colors, source->face_colors, sizeof(uint32_t) * source->num_faces);
+
+    lod->meshlets = (meshlet*) malloc(sizeof(meshlet) * (source->num_meshlets > 0 ? source->num_meshlets : 1));
+    lod->meshlet_vertices = (uint32_t*) malloc(sizeof(uint32_t) * (source->num_meshlet_vertices > 0 ? source->num_meshlet_vertices : 1));
+    if (!lod->meshlets || !lod->meshlet_vertices) {
+        fprintf(stderr, "Error trying to allocate memory for mesh data.\n");
+        return;
+    }
+    lod->num_meshlets = source->num_meshlets;
+    lod->num_meshlet_vertices = source->num_meshlet_vertices;
+    memcpy(lod->meshlets, source->meshlets, sizeof(meshlet) * source->num_meshlets);
+    memcpy(lod->meshlet_vertices, source->meshlet_vertices, sizeof(uint32_t) * source->num_meshlet_vertices);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load a mesh produced by one of the loaders into a LOD level, in the float
+// or the quantized vertex format
+// Its index buffer is narrowed to 16 bits when the vertices allow it, and
+// per-vertex UVs are gathered into one UV set per face. Meshes without
+// normals get smooth ones for the Gouraud and per-pixel shading.
+///////////////////////////////////////////////////////////////////////////////
+void load_mesh_lod(const mesh* m, mesh_lod* lod, bool quantized) {
+    mesh_lod empty = { 0 };
+    *lod = empty;
+    if (quantized) {
+        mesh_lod floats;
+        load_mesh_lod(m, &floats, false);
+        quantize_mesh_lod(&floats, lod);
+        free_mesh_lod(&floats);
+        return;
+    }
+
+    vec3d* generated_normals = m->nx ? NULL : mesh_vertex_normals(m);
+    bool has_normals = m->nx != NULL || generated_normals != NULL;
+    if (!allocate_mesh_lod(lod, m->num_vertices, m->num_faces, has_normals, false)) {
+        free(generated_normals);
+        return;
+    }
+
+    for (int i = 0; i < m->num_vertices; i++) {
+        vec3d vertex = { .x = m->x[i], .y = m->y[i], .z = m->z[i], .w = 1 };
+        vec3d normal = { .x = 0, .y = 0, .z = 0, .w = 0 };
+        if (generated_normals) {
+            normal = generated_normals[i];
+            if (vector_length(normal) > 0)
+                vector_normalize(&normal);
+        } else if (has_normals) {
+            normal.x = m->nx[i];
+            normal.y = m->ny[i];
+            normal.z = m->nz[i];
+            vector_normalize(&normal);
+        }
+        lod->vertex_data[i] = vertex;
+        if (has_normals)
+            lod->vertex_normals[i] = normal;
+    }
+    free(generated_normals);
+
+    vec3d extent = {
+        .x = (m->bounds_max[0] - m->bounds_min[0]) * 0.5f,
+        .y = (m->bounds_max[1] - m->bounds_min[1]) * 0.5f,
+        .z = (m->bounds_max[2] - m->bounds_min[2]) * 0.5f
+    };
+    lod->bounds_center.x = m->bounds_min[0] + extent.x;
+    lod->bounds_center.y = m->bounds_min[1] + extent.y;
+    lod->bounds_center.z = m->bounds_min[2] + extent.z;
+    lod->bounds_radius = vector_length(extent);
+    lod->error = m->lod_error;
+
+    for (int i = 0; i < m->num_faces; i++) {
+        uint32_t a = m->indices[i * 3];
+        uint32_t b = m->indices[i * 3 + 1];
+        uint32_t c = m->indices[i * 3 + 2];
+        if (lod->indices16) {
+            lod->indices16[i * 3] = (uint16_t)a;
+            lod->indices16[i * 3 + 1] = (uint16_t)b;
+            lod->indices16[i * 3 + 2] = (uint16_t)c;
+        } else {
+            lod->indices32[i * 3] = a;
+            lod->indices32[i * 3 + 1] = b;
+            lod->indices32[i * 3 + 2] = c;
+        }
+        lod->face_colors[i] = m->colors[i];
+        lod->face_uvs[i] = mesh_face_uvs(m, i);
+    }
+
+    // Keep the meshlets, or treat the whole mesh as one cluster that is never culled
+    if (m->num_meshlets > 0) {
+        lod->num_meshlets = m->num_meshlets;
+        lod->num_meshlet_vertices = m->num_meshlet_vertices;
+        lod->meshlets = (meshlet*) malloc(sizeof(meshlet) * m->num_meshlets);
+        lod->meshlet_vertices = (uint32_t*) malloc(sizeof(uint32_t) * (m->num_meshlet_vertices > 0 ? m->num_meshlet_vertices : 1));
+        if (lod->meshlets && lod->meshlet_vertices) {
+            memcpy(lod->meshlets, m->meshlets, sizeof(meshlet) * m->num_meshlets);
+            memcpy(lod->meshlet_vertices, m->meshlet_vertices, sizeof(uint32_t) * m->num_meshlet_vertices);
+            return;
+        }
+        free(lod->meshlets);
+        free(lod->meshlet_vertices);
+    }
+    meshlet whole = {
+        .vertex_count = m->num_vertices, .face_count = m->num_faces,
+        .radius = FLT_MAX, .cone_cutoff = -1
+    };
+    lod->num_meshlets = 1;
+    lod->num_meshlet_vertices = m->num_vertices;
+    lod->meshlets = (meshlet*) malloc(sizeof(meshlet));
+    lod->meshlet_vertices = (uint32_t*) malloc(sizeof(uint32_t) * (m->num_vertices > 0 ? m->num_vertices : 1));
+    if (!lod->meshlets || !lod->meshlet_vertices) {
+        fprintf(stderr, "Error trying to allocate memory for mesh data.\n");
+        lod->num_meshlets = 0;
+        lod->num_meshlet_vertices = 0;
+        return;
+    }
+    lod->meshlets[0] = whole;
+    for (int i = 0; i < m->num_vertices; i++)
+        lod->meshlet_vertices[i] = i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Optimize a loaded mesh, split it into meshlets and load it with its
+// simplified copies (for when it covers fewer pixels) into a LOD chain of up
+// to MESH_MAX_LODS levels; returns the number of levels
+///////////////////////////////////////////////////////////////////////////////
+int load_mesh_lod_chain(mesh* m, mesh_lod* lods, bool quantized) {
+    mesh_optimize(m);
+    if (m->num_meshlets == 0)
+        mesh_build_meshlets(m);
+    int num_lods = 0;
+    load_mesh_lod(m, &lods[num_lods++], quantized);
+
+    mesh lod_meshes[MESH_MAX_LODS - 1];
+    int num_simplified = mesh_build_lod_chain(m, lod_meshes, MESH_MAX_LODS - 1);
+    for (int i = 0; i < num_simplified; i++) {
+        mesh_optimize(&lod_meshes[i]);
+        mesh_build_meshlets(&lod_meshes[i]);
+        load_mesh_lod(&lod_meshes[i], &lods[num_lods++], quantized);
+        mesh_free(&lod_meshes[i]);
+    }
+    return num_lods;
+}
+
 #endif
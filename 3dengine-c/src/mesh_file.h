@@ -0,0 +1,278 @@
+#ifndef MESH_FILE_H
+#define MESH_FILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "file_map.h"
+#include "mesh_data.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Baked binary mesh files
+// A .mesh file holds the whole LOD chain of a model exactly as the engine
+// draws it: every level in the float vertex format of mesh_lod (vec3d
+// positions and normals, 16 or 32-bit indices, a color and a UV set per
+// face) with its meshlets. Loading one is a single mmap: the levels point
+// straight into the mapping, and nothing is parsed, copied or simplified.
+//
+// File layout (every stream starts on a 64-byte boundary):
+//   mesh_file_header | pad | level 0 vertices | pad | normals | ... | level 1 vertices | ...
+// The normals of a level without them have a size of zero. Indices are
+// 16-bit when the level has few enough vertices, as in allocate_mesh_lod.
+///////////////////////////////////////////////////////////////////////////////
+#define MESH_FILE_MAGIC 0x4853454D // "MESH"
+#define MESH_FILE_VERSION 3
+#define MESH_FILE_ALIGNMENT 64
+
+typedef enum {
+    MESH_STREAM_VERTICES,
+    MESH_STREAM_NORMALS,
+    MESH_STREAM_INDICES,
+    MESH_STREAM_COLORS,
+    MESH_STREAM_FACE_UVS,
+    MESH_STREAM_MESHLETS,
+    MESH_STREAM_MESHLET_VERTICES,
+    MESH_STREAM_COUNT
+} mesh_stream;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} mesh_file_stream;
+
+typedef struct {
+    uint32_t num_vertices;
+    uint32_t num_faces;
+    uint32_t num_meshlets;
+    uint32_t num_meshlet_vertices;
+    float bounds_center[3];
+    float bounds_radius;
+    float error;
+    uint32_t reserved;
+    mesh_file_stream streams[MESH_STREAM_COUNT];
+} mesh_file_level;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_levels;
+    uint32_t reserved;
+    mesh_file_level levels[MESH_MAX_LODS];
+} mesh_file_header;
+
+size_t mesh_file_align(size_t offset) {
+    return (offset + MESH_FILE_ALIGNMENT - 1) & ~(size_t)(MESH_FILE_ALIGNMENT - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Byte size of every stream of a level, from its counts
+///////////////////////////////////////////////////////////////////////////////
+void mesh_file_stream_sizes(const mesh_file_level* level, bool has_normals, uint64_t sizes[MESH_STREAM_COUNT]) {
+    uint64_t vertex_size = (uint64_t)level->num_vertices * sizeof(vec3d);
+    uint64_t faces = level->num_faces;
+    uint64_t index_size = level->num_vertices <= MESH_LOD_MAX_16BIT_VERTICES ? sizeof(uint16_t) : sizeof(uint32_t);
+
+    sizes[MESH_STREAM_VERTICES] = vertex_size;
+    sizes[MESH_STREAM_NORMALS] = has_normals ? vertex_size : 0;
+    sizes[MESH_STREAM_INDICES] = faces * 3 * index_size;
+    sizes[MESH_STREAM_COLORS] = faces * sizeof(uint32_t);
+    sizes[MESH_STREAM_FACE_UVS] = faces * sizeof(triangle_uv);
+    sizes[MESH_STREAM_MESHLETS] = (uint64_t)level->num_meshlets * sizeof(meshlet);
+    sizes[MESH_STREAM_MESHLET_VERTICES] = (uint64_t)level->num_meshlet_vertices * sizeof(uint32_t);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Write the LOD chain of a model, in the float format, to a .mesh file
+///////////////////////////////////////////////////////////////////////////////
+bool mesh_file_write(const char* path, const mesh_lod* lods, int num_lods) {
+    if (num_lods <= 0 || num_lods > MESH_MAX_LODS) {
+        fprintf(stderr, "Error writing mesh file %s: %d levels of detail.\n", path, num_lods);
+        return false;
+    }
+
+    mesh_file_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MESH_FILE_MAGIC;
+    header.version = MESH_FILE_VERSION;
+    header.num_levels = num_lods;
+
+    const void* data[MESH_MAX_LODS][MESH_STREAM_COUNT];
+    size_t offset = mesh_file_align(sizeof(mesh_file_header));
+    for (int l = 0; l < num_lods; l++) {
+        const mesh_lod* lod = &lods[l];
+        if (lod->quantized_vertices) {
+            fprintf(stderr, "Error writing mesh file %s: quantized levels cannot be baked.\n", path);
+            return false;
+        }
+        mesh_file_level* level = &header.levels[l];
+        level->num_vertices = lod->num_vertices;
+        level->num_faces = lod->num_faces;
+        level->num_meshlets = lod->num_meshlets;
+        level->num_meshlet_vertices = lod->num_meshlet_vertices;
+        level->bounds_center[0] = lod->bounds_center.x;
+        level->bounds_center[1] = lod->bounds_center.y;
+        level->bounds_center[2] = lod->bounds_center.z;
+        level->bounds_radius = lod->bounds_radius;
+        level->error = lod->error;
+
+        data[l][MESH_STREAM_VERTICES] = lod->vertex_data;
+        data[l][MESH_STREAM_NORMALS] = lod->vertex_normals;
+        data[l][MESH_STREAM_INDICES] = lod->indices16 ? (const void*) lod->indices16 : (const void*) lod->indices32;
+        data[l][MESH_STREAM_COLORS] = lod->face_colors;
+        data[l][MESH_STREAM_FACE_UVS] = lod->face_uvs;
+        data[l][MESH_STREAM_MESHLETS] = lod->meshlets;
+        data[l][MESH_STREAM_MESHLET_VERTICES] = lod->meshlet_vertices;
+
+        uint64_t sizes[MESH_STREAM_COUNT];
+        mesh_file_stream_sizes(level, lod->vertex_normals != NULL, sizes);
+        for (int i = 0; i < MESH_STREAM_COUNT; i++) {
+            level->streams[i].offset = sizes[i] > 0 ? offset : 0;
+            level->streams[i].size = sizes[i];
+            offset = mesh_file_align(offset + sizes[i]);
+        }
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Error opening %s for writing.\n", path);
+        return false;
+    }
+
+    static const uint8_t padding[MESH_FILE_ALIGNMENT] = { 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    size_t written = sizeof(header);
+    for (int l = 0; ok && l < num_lods; l++) {
+        for (int i = 0; ok && i < MESH_STREAM_COUNT; i++) {
+            const mesh_file_stream* stream = &header.levels[l].streams[i];
+            if (stream->size == 0)
+                continue;
+            size_t pad = stream->offset - written;
+            ok = fwrite(padding, 1, pad, file) == pad &&
+                 fwrite(data[l][i], 1, stream->size, file) == stream->size;
+            written = stream->offset + stream->size;
+        }
+    }
+
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "Error writing mesh file %s.\n", path);
+        remove(path);
+    }
+    return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Check one level of a mapped file against its counts and point the streams
+// at it; data is NULL for an empty stream
+///////////////////////////////////////////////////////////////////////////////
+bool mesh_file_check_level(const mapped_file* file, const mesh_file_level* level, const void* data[MESH_STREAM_COUNT]) {
+    bool valid = level->num_vertices <= INT32_MAX &&
+        level->num_faces <= INT32_MAX / 3 &&
+        level->num_meshlets > 0 &&
+        level->num_meshlets <= level->num_faces + 1 &&
+        level->num_meshlet_vertices <= level->num_faces * 3 + level->num_vertices;
+
+    uint64_t expected[MESH_STREAM_COUNT];
+    mesh_file_stream_sizes(level, level->streams[MESH_STREAM_NORMALS].size > 0, expected);
+    for (int i = 0; valid && i < MESH_STREAM_COUNT; i++) {
+        const mesh_file_stream* stream = &level->streams[i];
+        data[i] = NULL;
+        if (expected[i] == 0) {
+            valid = stream->size == 0;
+            continue;
+        }
+        valid = stream->size == expected[i] &&
+            stream->offset % MESH_FILE_ALIGNMENT == 0 &&
+            stream->offset >= sizeof(mesh_file_header) &&
+            stream->offset <= file->size &&
+            stream->size <= file->size - stream->offset;
+        data[i] = (const uint8_t*) file->data + stream->offset;
+    }
+    if (!valid)
+        return false;
+
+    const void* indices = data[MESH_STREAM_INDICES];
+    bool narrow = level->num_vertices <= MESH_LOD_MAX_16BIT_VERTICES;
+    for (uint32_t i = 0; valid && i < level->num_faces * 3; i++) {
+        uint32_t index = narrow ? ((const uint16_t*) indices)[i] : ((const uint32_t*) indices)[i];
+        valid = index < level->num_vertices;
+    }
+
+    const meshlet* meshlets = (const meshlet*) data[MESH_STREAM_MESHLETS];
+    const uint32_t* meshlet_vertices = (const uint32_t*) data[MESH_STREAM_MESHLET_VERTICES];
+    for (uint32_t i = 0; valid && i < level->num_meshlets; i++) {
+        valid = meshlets[i].vertex_offset <= level->num_meshlet_vertices &&
+            meshlets[i].vertex_count <= level->num_meshlet_vertices - meshlets[i].vertex_offset &&
+            meshlets[i].face_offset <= level->num_faces &&
+            meshlets[i].face_count <= level->num_faces - meshlets[i].face_offset;
+    }
+    for (uint32_t i = 0; valid && i < level->num_meshlet_vertices; i++)
+        valid = meshlet_vertices[i] < level->num_vertices;
+    return valid;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Map a .mesh file and point the levels of a LOD chain into it; returns the
+// number of levels, or 0 on failure
+// Every stream is checked against the counts in the header before use, so a
+// truncated or stale file is rejected instead of read out of bounds. The
+// mapping must stay open for as long as the levels are drawn.
+///////////////////////////////////////////////////////////////////////////////
+int mesh_file_load(const char* path, mesh_lod* lods, mapped_file* mapping) {
+    mapped_file file;
+    if (!map_file(path, &file)) {
+        fprintf(stderr, "Error mapping mesh file %s.\n", path);
+        return 0;
+    }
+
+    const mesh_file_header* header = (const mesh_file_header*) file.data;
+    if (file.size < sizeof(mesh_file_header) ||
+        header->magic != MESH_FILE_MAGIC ||
+        header->version != MESH_FILE_VERSION ||
+        header->num_levels == 0 || header->num_levels > MESH_MAX_LODS) {
+        fprintf(stderr, "Error reading mesh file %s: invalid or unsupported format.\n", path);
+        unmap_file(&file);
+        return 0;
+    }
+
+    const void* data[MESH_MAX_LODS][MESH_STREAM_COUNT];
+    for (uint32_t l = 0; l < header->num_levels; l++) {
+        if (!mesh_file_check_level(&file, &header->levels[l], data[l])) {
+            fprintf(stderr, "Error reading mesh file %s: level %u out of range.\n", path, l);
+            unmap_file(&file);
+            return 0;
+        }
+    }
+
+    for (uint32_t l = 0; l < header->num_levels; l++) {
+        const mesh_file_level* level = &header->levels[l];
+        bool narrow = level->num_vertices <= MESH_LOD_MAX_16BIT_VERTICES;
+        mesh_lod empty = { 0 };
+        mesh_lod* lod = &lods[l];
+        *lod = empty;
+        lod->mapped = true;
+        lod->num_vertices = level->num_vertices;
+        lod->num_faces = level->num_faces;
+        lod->vertex_data = (vec3d*) data[l][MESH_STREAM_VERTICES];
+        lod->vertex_normals = (vec3d*) data[l][MESH_STREAM_NORMALS];
+        lod->has_normals = lod->vertex_normals != NULL;
+        lod->indices16 = narrow ? (uint16_t*) data[l][MESH_STREAM_INDICES] : NULL;
+        lod->indices32 = narrow ? NULL : (uint32_t*) data[l][MESH_STREAM_INDICES];
+        lod->face_colors = (uint32_t*) data[l][MESH_STREAM_COLORS];
+        lod->face_uvs = (triangle_uv*) data[l][MESH_STREAM_FACE_UVS];
+        lod->num_meshlets = level->num_meshlets;
+        lod->num_meshlet_vertices = level->num_meshlet_vertices;
+        lod->meshlets = (meshlet*) data[l][MESH_STREAM_MESHLETS];
+        lod->meshlet_vertices = (uint32_t*) data[l][MESH_STREAM_MESHLET_VERTICES];
+        lod->bounds_center.x = level->bounds_center[0];
+        lod->bounds_center.y = level->bounds_center[1];
+        lod->bounds_center.z = level->bounds_center[2];
+        lod->bounds_radius = level->bounds_radius;
+        lod->error = level->error;
+    }
+    *mapping = file;
+    return header->num_levels;
+}
+
+#endif
@@ -0,0 +1,392 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mesh.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// LOD chain generation by quadric edge-collapse simplification
+// (Garland & Heckbert 1997). Every collapse moves a vertex onto one of its
+// neighbours, so the surviving vertices keep their exact position, UVs and
+// normals. Vertices on a UV seam (several mesh vertices at one position) or
+// on an open border are locked in place, which keeps seams and outlines
+// intact. One simplification run produces the whole chain: each time the
+// face count reaches the next target, the current faces become a LOD level.
+// The chain ends early once collapses would move the surface by more than
+// a tenth of the mesh radius.
+///////////////////////////////////////////////////////////////////////////////
+#define MESH_MAX_LODS 5
+#define MESH_LOD_MIN_FACES 64
+#define MESH_LOD_MAX_ERROR 0.1f // fraction of the mesh bounding radius
+
+///////////////////////////////////////////////////////////////////////////////
+// Symmetric 4x4 error quadric (upper triangle only) of area-weighted planes
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    double weight;
+} quadric;
+
+void quadric_add_plane(quadric* q, double a, double b, double c, double d, double weight) {
+    q->a2 += weight * a * a; q->ab += weight * a * b; q->ac += weight * a * c; q->ad += weight * a * d;
+    q->b2 += weight * b * b; q->bc += weight * b * c; q->bd += weight * b * d;
+    q->c2 += weight * c * c; q->cd += weight * c * d;
+    q->d2 += weight * d * d;
+    q->weight += weight;
+}
+
+void quadric_add(quadric* q, const quadric* other) {
+    q->a2 += other->a2; q->ab += other->ab; q->ac += other->ac; q->ad += other->ad;
+    q->b2 += other->b2; q->bc += other->bc; q->bd += other->bd;
+    q->c2 += other->c2; q->cd += other->cd;
+    q->d2 += other->d2;
+    q->weight += other->weight;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Area-weighted sum of squared distances from a point to the planes
+///////////////////////////////////////////////////////////////////////////////
+double quadric_error(const quadric* q, double x, double y, double z) {
+    double error =
+        q->a2 * x * x + 2 * q->ab * x * y + 2 * q->ac * x * z + 2 * q->ad * x +
+        q->b2 * y * y + 2 * q->bc * y * z + 2 * q->bd * y +
+        q->c2 * z * z + 2 * q->cd * z +
+        q->d2;
+    return error > 0 ? error : 0;
+}
+
+typedef struct {
+    float cost;
+    float distance;
+    uint32_t from;
+    uint32_t to;
+} mesh_collapse;
+
+int mesh_collapse_compare(const void* a, const void* b) {
+    float cost_a = ((const mesh_collapse*)a)->cost;
+    float cost_b = ((const mesh_collapse*)b)->cost;
+    return (cost_a > cost_b) - (cost_a < cost_b);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unnormalized normal of a triangle given by three positions
+///////////////////////////////////////////////////////////////////////////////
+void mesh_simplifier_normal(const mesh* m, uint32_t a, uint32_t b, uint32_t c, uint32_t moved, uint32_t target, double normal[3]) {
+    uint32_t corners[3] = { a, b, c };
+    double p[3][3];
+    for (int k = 0; k < 3; k++) {
+        uint32_t vertex = corners[k] == moved ? target : corners[k];
+        p[k][0] = m->x[vertex];
+        p[k][1] = m->y[vertex];
+        p[k][2] = m->z[vertex];
+    }
+    double ab[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+    double ac[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+    normal[0] = ab[1] * ac[2] - ab[2] * ac[1];
+    normal[1] = ab[2] * ac[0] - ab[0] * ac[2];
+    normal[2] = ab[0] * ac[1] - ab[1] * ac[0];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Lock vertices that must not move: UV/normal seams and open borders
+///////////////////////////////////////////////////////////////////////////////
+const mesh* mesh_position_compare_mesh;
+
+int mesh_position_compare(const void* a, const void* b) {
+    const mesh* m = mesh_position_compare_mesh;
+    uint32_t i = *(const uint32_t*)a, j = *(const uint32_t*)b;
+    if (m->x[i] != m->x[j]) return m->x[i] < m->x[j] ? -1 : 1;
+    if (m->y[i] != m->y[j]) return m->y[i] < m->y[j] ? -1 : 1;
+    if (m->z[i] != m->z[j]) return m->z[i] < m->z[j] ? -1 : 1;
+    return (i > j) - (i < j);
+}
+
+bool mesh_simplifier_lock_vertices(const mesh* m, bool* locked) {
+    int num_vertices = m->num_vertices;
+    uint32_t* order = (uint32_t*) malloc(sizeof(uint32_t) * (num_vertices > 0 ? num_vertices : 1));
+    uint32_t* edge_counts = (uint32_t*) calloc(num_vertices + 1, sizeof(uint32_t));
+    uint32_t* edges = (uint32_t*) malloc(sizeof(uint32_t) * (m->num_faces > 0 ? m->num_faces * 3 : 1));
+    if (!order || !edge_counts || !edges) {
+        free(order);
+        free(edge_counts);
+        free(edges);
+        return false;
+    }
+
+    // Seams: runs of vertices sharing one position
+    for (int v = 0; v < num_vertices; v++)
+        order[v] = v;
+    mesh_position_compare_mesh = m;
+    qsort(order, num_vertices, sizeof(uint32_t), mesh_position_compare);
+    for (int i = 0; i + 1 < num_vertices; i++) {
+        uint32_t a = order[i], b = order[i + 1];
+        if (m->x[a] == m->x[b] && m->y[a] == m->y[b] && m->z[a] == m->z[b])
+            locked[a] = locked[b] = true;
+    }
+
+    // Borders: a directed edge a->b whose twin b->a is used by no face.
+    // Outgoing edges are bucketed by their start vertex.
+    for (int i = 0; i < m->num_faces * 3; i++)
+        edge_counts[m->indices[i] + 1]++;
+    for (int v = 0; v < num_vertices; v++)
+        edge_counts[v + 1] += edge_counts[v];
+    memcpy(order, edge_counts, sizeof(uint32_t) * num_vertices);
+    for (int f = 0; f < m->num_faces; f++) {
+        for (int k = 0; k < 3; k++) {
+            uint32_t a = m->indices[f * 3 + k];
+            uint32_t b = m->indices[f * 3 + (k + 1) % 3];
+            edges[order[a]++] = b;
+        }
+    }
+    for (int a = 0; a < num_vertices; a++) {
+        for (uint32_t e = edge_counts[a]; e < edge_counts[a + 1]; e++) {
+            uint32_t b = edges[e];
+            bool has_twin = false;
+            for (uint32_t t = edge_counts[b]; t < edge_counts[b + 1] && !has_twin; t++)
+                has_twin = edges[t] == (uint32_t)a;
+            if (!has_twin)
+                locked[a] = locked[b] = true;
+        }
+    }
+
+    free(order);
+    free(edge_counts);
+    free(edges);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copy the faces still alive into a compact LOD mesh of their own
+///////////////////////////////////////////////////////////////////////////////
+bool mesh_simplifier_snapshot(const mesh* m, const uint32_t* indices, const uint32_t* face_ids, int num_faces, float error, mesh* lod) {
+    mesh empty = { 0 };
+    *lod = empty;
+
+    uint32_t* remap = (uint32_t*) malloc(sizeof(uint32_t) * m->num_vertices);
+    if (!remap)
+        return false;
+    memset(remap, 0xFF, sizeof(uint32_t) * m->num_vertices);
+    int num_vertices = 0;
+    for (int i = 0; i < num_faces * 3; i++) {
+        if (remap[indices[i]] == UINT32_MAX)
+            remap[indices[i]] = num_vertices++;
+    }
+
+    lod->num_vertices = num_vertices;
+    lod->num_faces = num_faces;
+    lod->lod_error = error;
+    float** streams[8] = { &lod->x, &lod->y, &lod->z, &lod->u, &lod->v, &lod->nx, &lod->ny, &lod->nz };
+    const float* sources[8] = { m->x, m->y, m->z, m->u, m->v, m->nx, m->ny, m->nz };
+    bool ok = true;
+    for (int s = 0; s < 8; s++) {
+        if (sources[s] == NULL)
+            continue;
+        *streams[s] = (float*) malloc(sizeof(float) * (num_vertices > 0 ? num_vertices : 1));
+        ok = ok && *streams[s] != NULL;
+    }
+    lod->indices = (uint32_t*) malloc(sizeof(uint32_t) * num_faces * 3);
+    lod->colors = (uint32_t*) malloc(sizeof(uint32_t) * num_faces);
+    ok = ok && lod->indices && lod->colors;
+    if (!ok) {
+        free(remap);
+        mesh_free(lod);
+        return false;
+    }
+
+    for (int v = 0; v < m->num_vertices; v++) {
+        if (remap[v] == UINT32_MAX)
+            continue;
+        for (int s = 0; s < 8; s++) {
+            if (sources[s] != NULL)
+                (*streams[s])[remap[v]] = sources[s][v];
+        }
+    }
+    for (int i = 0; i < num_faces * 3; i++)
+        lod->indices[i] = remap[indices[i]];
+    for (int f = 0; f < num_faces; f++)
+        lod->colors[f] = m->colors[face_ids[f]];
+    mesh_compute_bounds(lod);
+    free(remap);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build up to max_lods simplified versions of a mesh, each with about half
+// the faces of the one before. Returns the number of levels written to lods.
+// Meshes with per-face UV sets cannot be collapsed without resampling their
+// UVs and get no LOD chain.
+///////////////////////////////////////////////////////////////////////////////
+int mesh_build_lod_chain(const mesh* m, mesh* lods, int max_lods) {
+    if (m->face_uvs != NULL || m->num_vertices <= 0 || m->num_faces < MESH_LOD_MIN_FACES * 2 || max_lods <= 0)
+        return 0;
+
+    int num_vertices = m->num_vertices;
+    int num_faces = m->num_faces;
+    size_t vertex_count = (size_t)num_vertices;
+    size_t corner_count = (size_t)num_faces * 3;
+    quadric* quadrics = (quadric*) calloc(vertex_count, sizeof(quadric));
+    bool* locked = (bool*) calloc(vertex_count, sizeof(bool));
+    bool* touched = (bool*) malloc(sizeof(bool) * vertex_count);
+    uint32_t* remap = (uint32_t*) malloc(sizeof(uint32_t) * vertex_count);
+    uint32_t* offsets = (uint32_t*) malloc(sizeof(uint32_t) * (vertex_count + 1));
+    uint32_t* adjacency = (uint32_t*) malloc(sizeof(uint32_t) * corner_count);
+    uint32_t* indices = (uint32_t*) malloc(sizeof(uint32_t) * corner_count);
+    uint32_t* face_ids = (uint32_t*) malloc(sizeof(uint32_t) * (size_t)num_faces);
+    mesh_collapse* collapses = (mesh_collapse*) malloc(sizeof(mesh_collapse) * corner_count);
+    bool ok = quadrics && locked && touched && remap && offsets && adjacency && indices && face_ids && collapses &&
+        mesh_simplifier_lock_vertices(m, locked);
+
+    int num_lods = 0;
+    if (ok) {
+        memcpy(indices, m->indices, sizeof(uint32_t) * corner_count);
+        for (int f = 0; f < num_faces; f++)
+            face_ids[f] = f;
+
+        // Each vertex starts with the planes of the faces around it
+        for (int f = 0; f < num_faces; f++) {
+            const uint32_t* face = &indices[f * 3];
+            double normal[3];
+            mesh_simplifier_normal(m, face[0], face[1], face[2], UINT32_MAX, 0, normal);
+            double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            if (length == 0)
+                continue;
+            double a = normal[0] / length, b = normal[1] / length, c = normal[2] / length;
+            double d = -(a * m->x[face[0]] + b * m->y[face[0]] + c * m->z[face[0]]);
+            for (int k = 0; k < 3; k++)
+                quadric_add_plane(&quadrics[face[k]], a, b, c, d, length * 0.5);
+        }
+
+        // Largest error allowed for any collapse, relative to the mesh size
+        float extent[3];
+        for (int axis = 0; axis < 3; axis++)
+            extent[axis] = (m->bounds_max[axis] - m->bounds_min[axis]) * 0.5f;
+        float max_distance = MESH_LOD_MAX_ERROR *
+            sqrtf(extent[0] * extent[0] + extent[1] * extent[1] + extent[2] * extent[2]);
+
+        double max_error = 0;
+        int target_faces = num_faces / 2;
+        while (num_lods < max_lods && target_faces >= MESH_LOD_MIN_FACES) {
+            // Vertex to face adjacency of the current faces
+            memset(offsets, 0, sizeof(uint32_t) * (vertex_count + 1));
+            for (int i = 0; i < num_faces * 3; i++)
+                offsets[indices[i] + 1]++;
+            for (int v = 0; v < num_vertices; v++)
+                offsets[v + 1] += offsets[v];
+            memcpy(remap, offsets, sizeof(uint32_t) * vertex_count);
+            for (int i = 0; i < num_faces * 3; i++)
+                adjacency[remap[indices[i]]++] = i / 3;
+
+            // Rank every edge collapse (from an unlocked vertex onto a neighbour) by its error
+            int num_collapses = 0;
+            for (int f = 0; f < num_faces; f++) {
+                for (int k = 0; k < 3; k++) {
+                    uint32_t from = indices[f * 3 + k];
+                    uint32_t to = indices[f * 3 + (k + 1) % 3];
+                    if (locked[from])
+                        continue;
+                    quadric sum = quadrics[from];
+                    quadric_add(&sum, &quadrics[to]);
+                    double error = quadric_error(&sum, m->x[to], m->y[to], m->z[to]);
+                    mesh_collapse collapse = {
+                        .cost = (float)error,
+                        .distance = (float)sqrt(sum.weight > 0 ? error / sum.weight : 0),
+                        .from = from,
+                        .to = to
+                    };
+                    collapses[num_collapses++] = collapse;
+                }
+            }
+            qsort(collapses, num_collapses, sizeof(mesh_collapse), mesh_collapse_compare);
+
+            // Apply the cheapest collapses that do not touch each other
+            for (int v = 0; v < num_vertices; v++)
+                remap[v] = v;
+            memset(touched, 0, sizeof(bool) * vertex_count);
+            int faces_left = num_faces;
+            for (int c = 0; c < num_collapses && faces_left > target_faces; c++) {
+                const mesh_collapse* collapse = &collapses[c];
+                if (touched[collapse->from] || touched[collapse->to] || collapse->distance > max_distance)
+                    continue;
+
+                // Reject collapses that would flip a face around the moving vertex
+                bool flips = false;
+                int removed = 0;
+                for (uint32_t a = offsets[collapse->from]; a < offsets[collapse->from + 1] && !flips; a++) {
+                    const uint32_t* face = &indices[adjacency[a] * 3];
+                    if (face[0] == collapse->to || face[1] == collapse->to || face[2] == collapse->to) {
+                        removed++;
+                        continue;
+                    }
+                    double before[3], after[3];
+                    mesh_simplifier_normal(m, face[0], face[1], face[2], UINT32_MAX, 0, before);
+                    mesh_simplifier_normal(m, face[0], face[1], face[2], collapse->from, collapse->to, after);
+                    flips = before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0;
+                }
+                if (flips)
+                    continue;
+
+                remap[collapse->from] = collapse->to;
+                quadric_add(&quadrics[collapse->to], &quadrics[collapse->from]);
+                if (collapse->distance > max_error)
+                    max_error = collapse->distance;
+                faces_left -= removed;
+
+                // Faces around the moved vertex changed shape; freeze them for this pass
+                for (uint32_t a = offsets[collapse->from]; a < offsets[collapse->from + 1]; a++) {
+                    const uint32_t* face = &indices[adjacency[a] * 3];
+                    touched[face[0]] = touched[face[1]] = touched[face[2]] = true;
+                }
+            }
+
+            // Rewrite the faces, dropping the ones that collapsed
+            int kept = 0;
+            for (int f = 0; f < num_faces; f++) {
+                uint32_t a = remap[indices[f * 3]];
+                uint32_t b = remap[indices[f * 3 + 1]];
+                uint32_t c = remap[indices[f * 3 + 2]];
+                if (a == b || b == c || a == c)
+                    continue;
+                indices[kept * 3] = a;
+                indices[kept * 3 + 1] = b;
+                indices[kept * 3 + 2] = c;
+                face_ids[kept++] = face_ids[f];
+            }
+            bool progress = kept < num_faces;
+            num_faces = kept;
+
+            if (num_faces <= target_faces || !progress) {
+                // Stop once collapses no longer get far below the previous level
+                int previous_faces = num_lods > 0 ? lods[num_lods - 1].num_faces : m->num_faces;
+                if (num_faces > previous_faces * 3 / 4)
+                    break;
+                if (!mesh_simplifier_snapshot(m, indices, face_ids, num_faces, (float)max_error, &lods[num_lods])) {
+                    ok = false;
+                    break;
+                }
+                num_lods++;
+                target_faces = num_faces / 2;
+            }
+        }
+    }
+
+    if (!ok)
+        fprintf(stderr, "Error trying to allocate memory for the LOD chain.\n");
+
+    free(quadrics);
+    free(locked);
+    free(touched);
+    free(remap);
+    free(offsets);
+    free(adjacency);
+    free(indices);
+    free(face_ids);
+    free(collapses);
+    return num_lods;
+}
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include "vector.h"
+#include "mesh.h"
+#include "mesh_optimizer.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Meshlet clustering
+// Faces are grouped into clusters of at most 64 distinct vertices and 124
+// triangles. Each cluster gets a bounding sphere and a cone bounding its
+// face normals.
+///////////////////////////////////////////////////////////////////////////////
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit normal of a face, in the same orientation render() uses for culling;
+// zero for degenerate faces
+///////////////////////////////////////////////////////////////////////////////
+vec3d mesh_face_normal(const mesh* m, int face) {
+    const uint32_t* indices = &m->indices[face * 3];
+    vec3d a = { m->x[indices[0]], m->y[indices[0]], m->z[indices[0]], 0 };
+    vec3d b = { m->x[indices[1]], m->y[indices[1]], m->z[indices[1]], 0 };
+    vec3d c = { m->x[indices[2]], m->y[indices[2]], m->z[indices[2]], 0 };
+    vec3d ab = vector_sub(b, a);
+    vec3d ac = vector_sub(c, a);
+    vec3d normal = {
+        .x = (ab.y * ac.z - ab.z * ac.y),
+        .y = (ab.z * ac.x - ab.x * ac.z),
+        .z = (ab.x * ac.y - ab.y * ac.x)
+    };
+    float length = vector_length(normal);
+    if (length > 0) {
+        normal.x /= length;
+        normal.y /= length;
+        normal.z /= length;
+    }
+    return normal;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compute the bounding sphere and normal cone of a finished meshlet
+///////////////////////////////////////////////////////////////////////////////
+void meshlet_compute_bounds(const mesh* m, meshlet* cluster) {
+    const uint32_t* vertices = &m->meshlet_vertices[cluster->vertex_offset];
+
+    // Sphere around the center of the bounding box
+    float box_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float box_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (uint32_t i = 0; i < cluster->vertex_count; i++) {
+        float position[3] = { m->x[vertices[i]], m->y[vertices[i]], m->z[vertices[i]] };
+        for (int axis = 0; axis < 3; axis++) {
+            if (position[axis] < box_min[axis]) box_min[axis] = position[axis];
+            if (position[axis] > box_max[axis]) box_max[axis] = position[axis];
+        }
+    }
+    float radius_squared = 0;
+    for (int axis = 0; axis < 3; axis++)
+        cluster->center[axis] = (box_min[axis] + box_max[axis]) * 0.5f;
+    for (uint32_t i = 0; i < cluster->vertex_count; i++) {
+        float dx = m->x[vertices[i]] - cluster->center[0];
+        float dy = m->y[vertices[i]] - cluster->center[1];
+        float dz = m->z[vertices[i]] - cluster->center[2];
+        float distance_squared = dx * dx + dy * dy + dz * dz;
+        if (distance_squared > radius_squared) radius_squared = distance_squared;
+    }
+    cluster->radius = sqrtf(radius_squared);
+
+    // Normal cone: average of the unit face normals, widened to contain them all
+    vec3d normals_sum = { 0, 0, 0, 0 };
+    for (uint32_t f = cluster->face_offset; f < cluster->face_offset + cluster->face_count; f++) {
+        vec3d normal = mesh_face_normal(m, f);
+        normals_sum = vector_add(normals_sum, normal);
+    }
+    cluster->cone_cutoff = -1;
+    for (int axis = 0; axis < 3; axis++) {
+        cluster->cone_apex[axis] = cluster->center[axis];
+        cluster->cone_axis[axis] = 0;
+    }
+    float sum_length = vector_length(normals_sum);
+    if (sum_length < 1e-6f)
+        return;
+
+    vec3d axis = { normals_sum.x / sum_length, normals_sum.y / sum_length, normals_sum.z / sum_length, 0 };
+    float cutoff = 1;
+    for (uint32_t f = cluster->face_offset; f < cluster->face_offset + cluster->face_count; f++) {
+        vec3d normal = mesh_face_normal(m, f);
+        if (vector_length(normal) == 0)
+            continue;
+        float similarity = vector_dot(normal, axis);
+        if (similarity < cutoff) cutoff = similarity;
+    }
+    if (cutoff <= 0)
+        return;
+
+    // Slide the apex back along the axis from the center until it is behind
+    // (or on) the plane of every face
+    vec3d center = { cluster->center[0], cluster->center[1], cluster->center[2], 0 };
+    float apex_distance = 0;
+    for (uint32_t f = cluster->face_offset; f < cluster->face_offset + cluster->face_count; f++) {
+        vec3d normal = mesh_face_normal(m, f);
+        uint32_t corner = m->indices[f * 3];
+        vec3d point = { m->x[corner], m->y[corner], m->z[corner], 0 };
+        float alignment = vector_dot(normal, axis);
+        if (alignment <= 0)
+            continue;
+        float distance = vector_dot(vector_sub(center, point), normal) / alignment;
+        if (distance > apex_distance) apex_distance = distance;
+    }
+    cluster->cone_apex[0] = center.x - axis.x * apex_distance;
+    cluster->cone_apex[1] = center.y - axis.y * apex_distance;
+    cluster->cone_apex[2] = center.z - axis.z * apex_distance;
+    cluster->cone_axis[0] = axis.x;
+    cluster->cone_axis[1] = axis.y;
+    cluster->cone_axis[2] = axis.z;
+    cluster->cone_cutoff = cutoff;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Grow meshlets out of the faces of a mesh, replacing any previous ones
+// Each meshlet starts at the first face not taken yet and grows through
+// faces sharing its vertices, preferring faces that add the fewest new
+// vertices and then faces whose normal is closest to the cluster's so far,
+// which keeps clusters compact and their normal cones narrow. Faces are then
+// reordered so every meshlet covers a contiguous range, and vertices are
+// renumbered to follow the new face order.
+///////////////////////////////////////////////////////////////////////////////
+bool mesh_build_meshlets(mesh* m) {
+    int num_vertices = m->num_vertices;
+    int num_faces = m->num_faces;
+    int max_meshlets = num_faces > 0 ? num_faces : 1;
+
+    uint32_t* offsets = (uint32_t*) calloc(num_vertices + 1, sizeof(uint32_t));
+    uint32_t* live = (uint32_t*) calloc(num_vertices > 0 ? num_vertices : 1, sizeof(uint32_t));
+    uint32_t* stamp = (uint32_t*) calloc(num_vertices > 0 ? num_vertices : 1, sizeof(uint32_t));
+    uint32_t* adjacency = (uint32_t*) malloc(sizeof(uint32_t) * max_meshlets * 3);
+    uint32_t* face_order = (uint32_t*) malloc(sizeof(uint32_t) * max_meshlets);
+    vec3d* normals = (vec3d*) malloc(sizeof(vec3d) * max_meshlets);
+    bool* emitted = (bool*) calloc(max_meshlets, sizeof(bool));
+    meshlet* meshlets = (meshlet*) malloc(sizeof(meshlet) * max_meshlets);
+    uint32_t* meshlet_vertices = (uint32_t*) malloc(sizeof(uint32_t) * max_meshlets * 3);
+    bool ok = offsets && live && stamp && adjacency && face_order && normals && emitted && meshlets && meshlet_vertices;
+
+    int num_meshlets = 0;
+    int num_meshlet_vertices = 0;
+    if (ok) {
+        // Vertex to face adjacency, as offsets into one flat list
+        for (int i = 0; i < num_faces * 3; i++)
+            live[m->indices[i]]++;
+        for (int v = 0; v < num_vertices; v++)
+            offsets[v + 1] = offsets[v] + live[v];
+        for (int i = 0; i < num_faces * 3; i++) {
+            uint32_t vertex = m->indices[i];
+            adjacency[offsets[vertex] + stamp[vertex]++] = i / 3;
+        }
+        memset(stamp, 0, sizeof(uint32_t) * num_vertices);
+        for (int f = 0; f < num_faces; f++)
+            normals[f] = mesh_face_normal(m, f);
+
+        // stamp[v] is one past the index of the meshlet that took vertex v
+        int num_emitted = 0;
+        int seed = 0;
+        while (num_emitted < num_faces) {
+            while (emitted[seed])
+                seed++;
+
+            uint32_t id = num_meshlets + 1;
+            meshlet current = { .vertex_offset = num_meshlet_vertices, .face_offset = num_emitted };
+            vec3d normals_sum = { 0, 0, 0, 0 };
+            int next = seed;
+            while (next >= 0) {
+                const uint32_t* face = &m->indices[next * 3];
+                for (int k = 0; k < 3; k++) {
+                    live[face[k]]--;
+                    if (stamp[face[k]] != id) {
+                        stamp[face[k]] = id;
+                        meshlet_vertices[num_meshlet_vertices++] = face[k];
+                        current.vertex_count++;
+                    }
+                }
+                emitted[next] = true;
+                face_order[num_emitted++] = next;
+                normals_sum = vector_add(normals_sum, normals[next]);
+                if (++current.face_count == MESHLET_MAX_TRIANGLES)
+                    break;
+
+                // Pick the best face around the vertices taken so far
+                next = -1;
+                int best_new_vertices = 3;
+                float best_similarity = -FLT_MAX;
+                for (uint32_t i = 0; i < current.vertex_count; i++) {
+                    uint32_t vertex = meshlet_vertices[current.vertex_offset + i];
+                    if (live[vertex] == 0)
+                        continue;
+                    for (uint32_t a = offsets[vertex]; a < offsets[vertex + 1]; a++) {
+                        uint32_t candidate = adjacency[a];
+                        if (emitted[candidate])
+                            continue;
+                        const uint32_t* corners = &m->indices[candidate * 3];
+                        int new_vertices = (stamp[corners[0]] != id) +
+                            (stamp[corners[1]] != id && corners[1] != corners[0]) +
+                            (stamp[corners[2]] != id && corners[2] != corners[0] && corners[2] != corners[1]);
+                        if (current.vertex_count + new_vertices > MESHLET_MAX_VERTICES)
+                            continue;
+                        float similarity = vector_dot(normals[candidate], normals_sum);
+                        if (new_vertices < best_new_vertices ||
+                            (new_vertices == best_new_vertices && similarity > best_similarity)) {
+                            best_new_vertices = new_vertices;
+                            best_similarity = similarity;
+                            next = candidate;
+                        }
+                    }
+                }
+            }
+            meshlets[num_meshlets++] = current;
+        }
+
+        ok = mesh_reorder_faces(m, face_order) && mesh_optimize_vertex_fetch(m);
+    }
+
+    free(offsets);
+    free(live);
+    free(adjacency);
+    free(face_order);
+    free(normals);
+    free(emitted);
+
+    if (!ok) {
+        fprintf(stderr, "Error trying to allocate memory for meshlets.\n");
+        free(stamp);
+        free(meshlets);
+        free(meshlet_vertices);
+        return false;
+    }
+
+    // Rebuild the vertex lists against the renumbered vertices
+    memset(stamp, 0, sizeof(uint32_t) * num_vertices);
+    num_meshlet_vertices = 0;
+    for (int i = 0; i < num_meshlets; i++) {
+        meshlet* cluster = &meshlets[i];
+        cluster->vertex_offset = num_meshlet_vertices;
+        for (uint32_t f = cluster->face_offset; f < cluster->face_offset + cluster->face_count; f++) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t vertex = m->indices[f * 3 + k];
+                if (stamp[vertex] != (uint32_t)i + 1) {
+                    stamp[vertex] = i + 1;
+                    meshlet_vertices[num_meshlet_vertices++] = vertex;
+                }
+            }
+        }
+    }
+    free(stamp);
+
+    // Give back the worst-case reservation
+    if (num_meshlets > 0) {
+        meshlet* shrunk_meshlets = (meshlet*) realloc(meshlets, sizeof(meshlet) * num_meshlets);
+        uint32_t* shrunk_vertices = (uint32_t*) realloc(meshlet_vertices, sizeof(uint32_t) * num_meshlet_vertices);
+        if (shrunk_meshlets) meshlets = shrunk_meshlets;
+        if (shrunk_vertices) meshlet_vertices = shrunk_vertices;
+    }
+
+    free(m->meshlets);
+    free(m->meshlet_vertices);
+    m->meshlets = meshlets;
+    m->meshlet_vertices = meshlet_vertices;
+    m->num_meshlets = num_meshlets;
+    m->num_meshlet_vertices = num_meshlet_vertices;
+    for (int i = 0; i < num_meshlets; i++)
+        meshlet_compute_bounds(m, &m->meshlets[i]);
+
+    printf("Built %d meshlets, vertex cache ACMR (FIFO %d): %.3f\n",
+           num_meshlets, MESH_VERTEX_CACHE_SIZE, mesh_acmr(m, MESH_VERTEX_CACHE_SIZE));
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// True if every face of a meshlet faces away from the camera
+// Takes the cone apex and axis already in camera space. The apex is behind
+// the plane of every face and every face normal is within the cone half
+// angle a of the axis, so the camera sees only back faces when the direction
+// from it to the apex is less than 90 - a degrees off the axis.
+///////////////////////////////////////////////////////////////////////////////
+bool meshlet_is_backfacing(vec3d cone_apex, vec3d cone_axis, float cone_cutoff, vec3d camera) {
+    if (cone_cutoff <= 0)
+        return false;
+    vec3d direction = vector_sub(cone_apex, camera);
+    float distance = vector_length(direction);
+    float sin_a = sqrtf(1 - cone_cutoff * cone_cutoff);
+    return vector_dot(direction, cone_axis) > sin_a * distance;
+}
+
+#endif
@@ -0,0 +1,389 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mesh.h"
+#include "array.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Streaming Wavefront OBJ loader
+// The file is read through a fixed-size buffer one line at a time. Positions,
+// UVs and normals are parsed with a hand-rolled number parser. Every distinct
+// position/UV/normal combination used by a face becomes one mesh vertex, found
+// through a hash map, and polygons are triangulated as fans.
+///////////////////////////////////////////////////////////////////////////////
+#define OBJ_READ_BUFFER_SIZE (64 * 1024)
+#define OBJ_MISSING -1
+
+typedef struct {
+    // Raw attribute lists, in file order, 3, 2 and 3 floats per entry
+    float_array positions;
+    float_array uvs;
+    float_array normals;
+
+    // Position/UV/normal triple of every emitted vertex, and the hash map over them
+    int_array vertex_keys;
+    int vertices_capacity;
+    int* slots;
+    int num_slots;
+
+    // Triangles, handed over to the mesh once the whole file is parsed
+    uint32_array indices;
+    uint32_array colors;
+
+    bool has_uvs;
+    bool has_normals;
+    mesh* out;
+} obj_parser;
+
+///////////////////////////////////////////////////////////////////////////////
+// Number parsing without strtod/sscanf
+// Up to 19 significant digits are accumulated in an integer and scaled once
+// by a power of ten, which is exact for the short decimals OBJ exporters write.
+///////////////////////////////////////////////////////////////////////////////
+const char* obj_skip_spaces(const char* p) {
+    while (*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+const char* obj_parse_int(const char* p, int* value) {
+    bool negative = false;
+    if (*p == '-' || *p == '+')
+        negative = (*p++ == '-');
+    int result = 0;
+    while (*p >= '0' && *p <= '9')
+        result = result * 10 + (*p++ - '0');
+    *value = negative ? -result : result;
+    return p;
+}
+
+const char* obj_parse_float(const char* p, float* value) {
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    bool negative = false;
+    if (*p == '-' || *p == '+')
+        negative = (*p++ == '-');
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    for (; *p >= '0' && *p <= '9'; p++) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            if (mantissa) digits++;
+        } else {
+            exponent++;
+        }
+    }
+    if (*p == '.') {
+        for (p++; *p >= '0' && *p <= '9'; p++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                if (mantissa) digits++;
+                exponent--;
+            }
+        }
+    }
+    if (*p == 'e' || *p == 'E') {
+        int explicit_exponent;
+        p = obj_parse_int(p + 1, &explicit_exponent);
+        exponent += explicit_exponent;
+    }
+
+    double result = (double)mantissa;
+    while (exponent > 22) {
+        result *= 1e22;
+        exponent -= 22;
+    }
+    while (exponent < -22) {
+        result /= 1e22;
+        exponent += 22;
+    }
+    result = exponent >= 0 ? result * powers_of_ten[exponent] : result / powers_of_ten[-exponent];
+
+    *value = (float)(negative ? -result : result);
+    return p;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parse up to `count` floats of a "v", "vt" or "vn" line into a raw list
+///////////////////////////////////////////////////////////////////////////////
+bool obj_parse_attribute(const char* p, int count, float_array* list) {
+    float values[3];
+    for (int i = 0; i < count; i++) {
+        p = obj_skip_spaces(p);
+        p = obj_parse_float(p, &values[i]);
+    }
+    return float_array_append(list, values, count);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Find or create the mesh vertex for a position/UV/normal index triple
+///////////////////////////////////////////////////////////////////////////////
+uint32_t obj_hash_key(int position, int uv, int normal) {
+    uint32_t hash = (uint32_t)position * 0x9E3779B1u;
+    hash ^= (uint32_t)(uv + 1) * 0x85EBCA77u;
+    hash ^= (uint32_t)(normal + 1) * 0xC2B2AE3Du;
+    return hash ^ (hash >> 15);
+}
+
+bool obj_rehash(obj_parser* parser, int num_slots) {
+    int* slots = (int*) malloc((size_t)num_slots * sizeof(int));
+    if (!slots)
+        return false;
+    for (int i = 0; i < num_slots; i++)
+        slots[i] = OBJ_MISSING;
+    for (int vertex = 0; vertex < parser->out->num_vertices; vertex++) {
+        const int* key = &parser->vertex_keys.elements[vertex * 3];
+        uint32_t slot = obj_hash_key(key[0], key[1], key[2]) & (num_slots - 1);
+        while (slots[slot] != OBJ_MISSING)
+            slot = (slot + 1) & (num_slots - 1);
+        slots[slot] = vertex;
+    }
+    free(parser->slots);
+    parser->slots = slots;
+    parser->num_slots = num_slots;
+    return true;
+}
+
+int obj_find_vertex(obj_parser* parser, int position, int uv, int normal) {
+    mesh* m = parser->out;
+
+    // Keep the map at most half full
+    if ((m->num_vertices + 1) * 2 > parser->num_slots &&
+        !obj_rehash(parser, parser->num_slots ? parser->num_slots * 2 : 4096))
+        return OBJ_MISSING;
+
+    uint32_t slot = obj_hash_key(position, uv, normal) & (parser->num_slots - 1);
+    while (parser->slots[slot] != OBJ_MISSING) {
+        const int* key = &parser->vertex_keys.elements[parser->slots[slot] * 3];
+        if (key[0] == position && key[1] == uv && key[2] == normal)
+            return parser->slots[slot];
+        slot = (slot + 1) & (parser->num_slots - 1);
+    }
+
+    // New vertex: grow every attribute stream of the mesh together
+    int vertex = m->num_vertices;
+    if (vertex + 1 > parser->vertices_capacity) {
+        int capacity = parser->vertices_capacity;
+        bool ok = true;
+        float** streams[] = { &m->x, &m->y, &m->z, &m->u, &m->v, &m->nx, &m->ny, &m->nz };
+        for (int i = 0; i < 8 && ok; i++) {
+            capacity = parser->vertices_capacity;
+            ok = array_grow((void**)streams[i], &capacity, vertex + 1, sizeof(float));
+        }
+        if (!ok)
+            return OBJ_MISSING;
+        parser->vertices_capacity = capacity;
+    }
+    int key[3] = { position, uv, normal };
+    if (!int_array_append(&parser->vertex_keys, key, 3))
+        return OBJ_MISSING;
+
+    const float* p = &parser->positions.elements[position * 3];
+    m->x[vertex] = p[0];
+    m->y[vertex] = p[1];
+    m->z[vertex] = p[2];
+    if (uv != OBJ_MISSING) {
+        // OBJ texture rows go bottom-up, the engine samples textures top-down
+        m->u[vertex] = parser->uvs.elements[uv * 2];
+        m->v[vertex] = 1.0f - parser->uvs.elements[uv * 2 + 1];
+        parser->has_uvs = true;
+    } else {
+        m->u[vertex] = m->v[vertex] = 0;
+    }
+    if (normal != OBJ_MISSING) {
+        const float* n = &parser->normals.elements[normal * 3];
+        m->nx[vertex] = n[0];
+        m->ny[vertex] = n[1];
+        m->nz[vertex] = n[2];
+        parser->has_normals = true;
+    } else {
+        m->nx[vertex] = m->ny[vertex] = m->nz[vertex] = 0;
+    }
+
+    parser->slots[slot] = vertex;
+    m->num_vertices++;
+    return vertex;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Resolve a 1-based (or negative, relative) OBJ index against a list length
+///////////////////////////////////////////////////////////////////////////////
+int obj_resolve_index(int index, int length) {
+    if (index > 0 && index <= length)
+        return index - 1;
+    if (index < 0 && -index <= length)
+        return length + index;
+    return OBJ_MISSING;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parse an "f" line: corners are v, v/vt, v//vn or v/vt/vn, fan triangulated
+///////////////////////////////////////////////////////////////////////////////
+bool obj_parse_face(obj_parser* parser, const char* p) {
+    int first = OBJ_MISSING;
+    int previous = OBJ_MISSING;
+
+    for (p = obj_skip_spaces(p); *p && *p != '\r' && *p != '#'; p = obj_skip_spaces(p)) {
+        int position, uv = 0, normal = 0;
+        p = obj_parse_int(p, &position);
+        if (*p == '/') {
+            if (p[1] != '/')
+                p = obj_parse_int(p + 1, &uv);
+            else
+                p++;
+            if (*p == '/')
+                p = obj_parse_int(p + 1, &normal);
+        }
+
+        position = obj_resolve_index(position, parser->positions.length / 3);
+        if (position == OBJ_MISSING) {
+            fprintf(stderr, "Error parsing OBJ face: vertex index out of range.\n");
+            return false;
+        }
+        uv = uv ? obj_resolve_index(uv, parser->uvs.length / 2) : OBJ_MISSING;
+        normal = normal ? obj_resolve_index(normal, parser->normals.length / 3) : OBJ_MISSING;
+
+        int vertex = obj_find_vertex(parser, position, uv, normal);
+        if (vertex == OBJ_MISSING)
+            return false;
+
+        if (first == OBJ_MISSING) {
+            first = vertex;
+        } else if (previous == OBJ_MISSING) {
+            previous = vertex;
+        } else {
+            uint32_t corners[3] = { (uint32_t)first, (uint32_t)previous, (uint32_t)vertex };
+            if (!uint32_array_append(&parser->indices, corners, 3) ||
+                !uint32_array_push(&parser->colors, 0xFFFFFFFF))
+                return false;
+            previous = vertex;
+        }
+
+        // Skip anything left of this corner (e.g. a malformed token)
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r')
+            p++;
+    }
+    return true;
+}
+
+bool obj_parse_line(obj_parser* parser, const char* line) {
+    line = obj_skip_spaces(line);
+    if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t'))
+        return obj_parse_attribute(line + 2, 3, &parser->positions);
+    if (line[0] == 'v' && line[1] == 't' && (line[2] == ' ' || line[2] == '\t'))
+        return obj_parse_attribute(line + 3, 2, &parser->uvs);
+    if (line[0] == 'v' && line[1] == 'n' && (line[2] == ' ' || line[2] == '\t'))
+        return obj_parse_attribute(line + 3, 3, &parser->normals);
+    if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t'))
+        return obj_parse_face(parser, line + 2);
+    // Comments, groups, materials and smoothing groups are ignored
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load an OBJ file into a mesh; returns false (and an empty mesh) on error
+///////////////////////////////////////////////////////////////////////////////
+bool load_obj_mesh(const char* filename, mesh* out) {
+    mesh empty = { 0 };
+    *out = empty;
+
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Error opening OBJ file %s.\n", filename);
+        return false;
+    }
+
+    char* buffer = (char*) malloc(OBJ_READ_BUFFER_SIZE + 1);
+    if (!buffer) {
+        fclose(file);
+        return false;
+    }
+
+    obj_parser parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.out = out;
+
+    bool ok = true;
+    size_t filled = 0;
+    while (ok) {
+        size_t bytes_read = fread(buffer + filled, 1, OBJ_READ_BUFFER_SIZE - filled, file);
+        bool end_of_file = bytes_read == 0;
+        filled += bytes_read;
+        buffer[filled] = '\0';
+
+        // Parse every complete line; at the end of the file the last one may lack a newline
+        char* line = buffer;
+        char* end = buffer + filled;
+        while (ok && line < end) {
+            char* newline = (char*) memchr(line, '\n', (size_t)(end - line));
+            if (!newline) {
+                if (!end_of_file)
+                    break;
+                newline = end;
+            }
+            *newline = '\0';
+            ok = obj_parse_line(&parser, line);
+            line = newline + 1;
+        }
+        if (end_of_file)
+            break;
+
+        // Move the partial line to the front of the buffer for the next read
+        filled = line < end ? (size_t)(end - line) : 0;
+        memmove(buffer, line, filled);
+        if (filled == OBJ_READ_BUFFER_SIZE) {
+            fprintf(stderr, "Error parsing OBJ file %s: line too long.\n", filename);
+            ok = false;
+        }
+    }
+
+    if (ok && ferror(file)) {
+        fprintf(stderr, "Error reading OBJ file %s.\n", filename);
+        ok = false;
+    }
+
+    fclose(file);
+    free(buffer);
+    float_array_free(&parser.positions);
+    float_array_free(&parser.uvs);
+    float_array_free(&parser.normals);
+    int_array_free(&parser.vertex_keys);
+    free(parser.slots);
+
+    if (!ok) {
+        uint32_array_free(&parser.indices);
+        uint32_array_free(&parser.colors);
+        mesh_free(out);
+        return false;
+    }
+    out->indices = parser.indices.elements;
+    out->colors = parser.colors.elements;
+    out->num_faces = parser.colors.length;
+
+    // Drop the attribute streams no face referenced
+    if (!parser.has_uvs) {
+        free(out->u);
+        free(out->v);
+        out->u = out->v = NULL;
+    }
+    if (!parser.has_normals) {
+        free(out->nx);
+        free(out->ny);
+        free(out->nz);
+        out->nx = out->ny = out->nz = NULL;
+    }
+    mesh_compute_bounds(out);
+    return true;
+}
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <float.h>
+#include <math.h>
+#include "vector.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Software occlusion culling with a masked hierarchical depth buffer
+// (Andersson et al. 2015, "Masked Software Occlusion Culling")
+// Occluder triangles are rasterized into a small 256x128 buffer kept only at
+// tile granularity: every 32x4 tile stores the farthest depth of a fully
+// covered reference layer (z_max0), and a working layer with its own
+// farthest depth (z_max1) and a coverage mask of its 128 pixels. Once the
+// working layer covers the whole tile it becomes the new reference layer.
+// Each triangle counts at the depth of its farthest vertex, so the buffer
+// never claims anything is closer than it is: a box nearer than the
+// reference depth of any tile it overlaps is visible.
+// Depths are view-space z; larger is farther.
+///////////////////////////////////////////////////////////////////////////////
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_TILE_WIDTH 32
+#define OCCLUSION_TILE_HEIGHT 4
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH) // 8, as the SSE2 query assumes
+#define OCCLUSION_TILES_Y (OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT)
+
+// The span setup and the tile queries have SSE2 versions picked at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCCLUSION_SIMD_X86 1
+#include <emmintrin.h>
+#define OCCLUSION_TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+
+typedef struct {
+    float z_max0[OCCLUSION_TILES_Y][OCCLUSION_TILES_X];
+    float z_max1[OCCLUSION_TILES_Y][OCCLUSION_TILES_X];
+    uint32_t mask[OCCLUSION_TILES_Y][OCCLUSION_TILES_X][OCCLUSION_TILE_HEIGHT]; // bit 31 is the leftmost pixel
+    bool simd;
+} occlusion_buffer;
+
+void occlusion_clear(occlusion_buffer* buffer, float zfar) {
+    for (int ty = 0; ty < OCCLUSION_TILES_Y; ty++) {
+        for (int tx = 0; tx < OCCLUSION_TILES_X; tx++) {
+            buffer->z_max0[ty][tx] = zfar;
+            buffer->z_max1[ty][tx] = 0;
+            for (int r = 0; r < OCCLUSION_TILE_HEIGHT; r++)
+                buffer->mask[ty][tx][r] = 0;
+        }
+    }
+#ifdef OCCLUSION_SIMD_X86
+    buffer->simd = __builtin_cpu_supports("sse2");
+#else
+    buffer->simd = false;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Merge a triangle's coverage of one tile into the tile's layers
+///////////////////////////////////////////////////////////////////////////////
+void occlusion_update_tile(occlusion_buffer* buffer, int tx, int ty, const uint32_t coverage[OCCLUSION_TILE_HEIGHT], float z_max) {
+    float* z_max0 = &buffer->z_max0[ty][tx];
+    float* z_max1 = &buffer->z_max1[ty][tx];
+    uint32_t* mask = buffer->mask[ty][tx];
+    if (z_max >= *z_max0)
+        return;
+
+    // A triangle far in front of the working layer starts a new one
+    if (*z_max1 - z_max > *z_max0 - *z_max1) {
+        *z_max1 = 0;
+        for (int r = 0; r < OCCLUSION_TILE_HEIGHT; r++)
+            mask[r] = 0;
+    }
+    if (z_max > *z_max1)
+        *z_max1 = z_max;
+
+    bool full = true;
+    for (int r = 0; r < OCCLUSION_TILE_HEIGHT; r++) {
+        mask[r] |= coverage[r];
+        full = full && mask[r] == UINT32_MAX;
+    }
+    if (full) {
+        *z_max0 = *z_max1;
+        *z_max1 = 0;
+        for (int r = 0; r < OCCLUSION_TILE_HEIGHT; r++)
+            mask[r] = 0;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Covered pixel columns [first, last] of the four rows of a tile row
+// Every non-horizontal edge bounds the span on one side, at an x that moves
+// linearly with y; rows outside the triangle come out empty (first > last).
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    float x;     // x of the edge at the center of row 0
+    float slope; // change of x per row
+    bool left;   // bounds the span from the left
+} occlusion_edge;
+
+void occlusion_row_spans(const occlusion_edge* edges, int num_edges, int row, int first[4], int last[4]) {
+    for (int r = 0; r < 4; r++) {
+        float left = -1;
+        float right = OCCLUSION_WIDTH;
+        for (int e = 0; e < num_edges; e++) {
+            float x = edges[e].x + edges[e].slope * (row + r);
+            if (edges[e].left && x > left) left = x;
+            if (!edges[e].left && x < right) right = x;
+        }
+        // Pixels whose centers lie inside the span
+        left = fminf(left, OCCLUSION_WIDTH + 1);
+        right = fmaxf(right, -1);
+        first[r] = (int)ceilf(left - 0.5f);
+        last[r] = (int)floorf(right - 0.5f);
+    }
+}
+
+#ifdef OCCLUSION_SIMD_X86
+OCCLUSION_TARGET_SSE2 void occlusion_row_spans_sse2(const occlusion_edge* edges, int num_edges, int row, int first[4], int last[4]) {
+    __m128 rows = _mm_add_ps(_mm_set1_ps((float)row), _mm_set_ps(3, 2, 1, 0));
+    __m128 left = _mm_set1_ps(-1);
+    __m128 right = _mm_set1_ps(OCCLUSION_WIDTH);
+    for (int e = 0; e < num_edges; e++) {
+        __m128 x = _mm_add_ps(_mm_set1_ps(edges[e].x), _mm_mul_ps(_mm_set1_ps(edges[e].slope), rows));
+        if (edges[e].left)
+            left = _mm_max_ps(left, x);
+        else
+            right = _mm_min_ps(right, x);
+    }
+
+    // ceil(left - 0.5) as -floor(0.5 - left) and floor(right - 0.5), both
+    // by truncating values offset to be non-negative
+    __m128 offset = _mm_set1_ps(512);
+    __m128 lower = _mm_max_ps(_mm_set1_ps(-1), _mm_min_ps(left, _mm_set1_ps(OCCLUSION_WIDTH + 1)));
+    __m128 upper = _mm_max_ps(_mm_set1_ps(-1), _mm_min_ps(right, _mm_set1_ps(OCCLUSION_WIDTH + 1)));
+    __m128i lower_floor = _mm_cvttps_epi32(_mm_add_ps(_mm_sub_ps(_mm_set1_ps(0.5f), lower), offset));
+    __m128i upper_floor = _mm_cvttps_epi32(_mm_add_ps(_mm_sub_ps(upper, _mm_set1_ps(0.5f)), offset));
+    __m128i offset_int = _mm_set1_epi32(512);
+    _mm_storeu_si128((__m128i*) first, _mm_sub_epi32(offset_int, lower_floor));
+    _mm_storeu_si128((__m128i*) last, _mm_sub_epi32(upper_floor, offset_int));
+}
+
+// Checks the eight tiles of a buffer row with two compares
+OCCLUSION_TARGET_SSE2 bool occlusion_test_tiles_sse2(const occlusion_buffer* buffer, int tx0, int ty0, int tx1, int ty1, float z_min) {
+    int columns = ((1 << (tx1 + 1)) - 1) & ~((1 << tx0) - 1);
+    __m128 z = _mm_set1_ps(z_min);
+    for (int ty = ty0; ty <= ty1; ty++) {
+        int in_front = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(&buffer->z_max0[ty][0]), z)) |
+                       _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(&buffer->z_max0[ty][4]), z)) << 4;
+        if (in_front & columns)
+            return false;
+    }
+    return true;
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Rasterize an occluder triangle given in buffer pixels, with view depths
+///////////////////////////////////////////////////////////////////////////////
+void occlusion_draw_triangle(occlusion_buffer* buffer, vec3d a, vec3d b, vec3d c) {
+    // Wind the triangle so that, with y pointing down, edges going up bound
+    // the span from the left and edges going down bound it from the right
+    float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+    if (area == 0)
+        return;
+    if (area < 0) {
+        vec3d swap = b;
+        b = c;
+        c = swap;
+    }
+    float z_max = a.z > b.z ? a.z : b.z;
+    z_max = z_max > c.z ? z_max : c.z;
+
+    float x_min = fminf(a.x, fminf(b.x, c.x));
+    float x_max = fmaxf(a.x, fmaxf(b.x, c.x));
+    float y_min = fminf(a.y, fminf(b.y, c.y));
+    float y_max = fmaxf(a.y, fmaxf(b.y, c.y));
+    if (x_max < 0 || y_max < 0 || x_min >= OCCLUSION_WIDTH || y_min >= OCCLUSION_HEIGHT)
+        return;
+
+    // Rows whose centers fall inside the triangle
+    y_min = fmaxf(y_min, -1);
+    y_max = fminf(y_max, OCCLUSION_HEIGHT + 1);
+    int row_first = (int)ceilf(y_min - 0.5f);
+    int row_last = (int)floorf(y_max - 0.5f);
+    if (row_first < 0) row_first = 0;
+    if (row_last > OCCLUSION_HEIGHT - 1) row_last = OCCLUSION_HEIGHT - 1;
+    if (row_first > row_last)
+        return;
+
+    occlusion_edge edges[3];
+    int num_edges = 0;
+    vec3d points[3] = { a, b, c };
+    for (int e = 0; e < 3; e++) {
+        vec3d from = points[e];
+        vec3d to = points[(e + 1) % 3];
+        if (from.y == to.y)
+            continue;
+        occlusion_edge* edge = &edges[num_edges++];
+        edge->slope = (to.x - from.x) / (to.y - from.y);
+        edge->x = from.x + edge->slope * (0.5f - from.y);
+        edge->left = to.y < from.y;
+    }
+
+    int tile_x_first = x_min < 0 ? 0 : (int)x_min / OCCLUSION_TILE_WIDTH;
+    int tile_x_last = x_max >= OCCLUSION_WIDTH ? OCCLUSION_TILES_X - 1 : (int)x_max / OCCLUSION_TILE_WIDTH;
+
+    for (int ty = row_first / OCCLUSION_TILE_HEIGHT; ty <= row_last / OCCLUSION_TILE_HEIGHT; ty++) {
+        int row = ty * OCCLUSION_TILE_HEIGHT;
+        int first[4], last[4];
+#ifdef OCCLUSION_SIMD_X86
+        if (buffer->simd)
+            occlusion_row_spans_sse2(edges, num_edges, row, first, last);
+        else
+#endif
+            occlusion_row_spans(edges, num_edges, row, first, last);
+        for (int r = 0; r < 4; r++) {
+            if (row + r < row_first || row + r > row_last) {
+                first[r] = OCCLUSION_WIDTH;
+                last[r] = -1;
+            }
+        }
+
+        for (int tx = tile_x_first; tx <= tile_x_last; tx++) {
+            uint32_t coverage[OCCLUSION_TILE_HEIGHT];
+            bool covered = false;
+            for (int r = 0; r < OCCLUSION_TILE_HEIGHT; r++) {
+                int start = first[r] - tx * OCCLUSION_TILE_WIDTH;
+                int end = last[r] - tx * OCCLUSION_TILE_WIDTH + 1;
+                if (start < 0) start = 0;
+                if (end > OCCLUSION_TILE_WIDTH) end = OCCLUSION_TILE_WIDTH;
+                coverage[r] = 0;
+                if (start < end) {
+                    uint32_t from_start = UINT32_MAX >> start;
+                    uint32_t from_end = end < OCCLUSION_TILE_WIDTH ? UINT32_MAX >> end : 0;
+                    coverage[r] = from_start & ~from_end;
+                    covered = true;
+                }
+            }
+            if (covered)
+                occlusion_update_tile(buffer, tx, ty, coverage, z_max);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// True when a screen rectangle (buffer pixels) at its nearest depth z_min is
+// behind the reference layer of every tile it overlaps
+///////////////////////////////////////////////////////////////////////////////
+bool occlusion_test_rect(const occlusion_buffer* buffer, float x_min, float y_min, float x_max, float y_max, float z_min) {
+    if (x_max < 0 || y_max < 0 || x_min >= OCCLUSION_WIDTH || y_min >= OCCLUSION_HEIGHT)
+        return false;
+    int tx0 = x_min < 0 ? 0 : (int)x_min / OCCLUSION_TILE_WIDTH;
+    int ty0 = y_min < 0 ? 0 : (int)y_min / OCCLUSION_TILE_HEIGHT;
+    int tx1 = x_max >= OCCLUSION_WIDTH ? OCCLUSION_TILES_X - 1 : (int)x_max / OCCLUSION_TILE_WIDTH;
+    int ty1 = y_max >= OCCLUSION_HEIGHT ? OCCLUSION_TILES_Y - 1 : (int)y_max / OCCLUSION_TILE_HEIGHT;
+
+#ifdef OCCLUSION_SIMD_X86
+    if (buffer->simd)
+        return occlusion_test_tiles_sse2(buffer, tx0, ty0, tx1, ty1, z_min);
+#endif
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            if (buffer->z_max0[ty][tx] >= z_min)
+                return false;
+        }
+    }
+    return true;
+}
+
+#endif
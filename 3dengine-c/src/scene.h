@@ -0,0 +1,276 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vector.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "obj_loader.h"
+#include "mesh_file.h"
+#include "mesh_optimizer.h"
+#include "meshlet.h"
+#include "mesh_simplifier.h"
+#include "mesh_data.h"
+#include "texture_loader.h"
+#include "bvh.h"
+#include "array.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Scene of objects sharing models
+// A model is a mesh (its whole LOD chain) and a texture, loaded once. A
+// model baked to a .mesh file draws straight from the file mapping. An
+// object is one placed copy of a model with its own transform, and any
+// number of objects can reference the same model: the engine draws all the
+// visible copies of a model level in one batched pass, transforming the
+// shared vertices with each object's world matrix. The world-space bounds
+// of all objects are kept in a BVH for culling and picking.
+// Objects can be attached to a parent object, their transform then being
+// relative to it. Every object is stored after its parent, so a single pass
+// in order brings the whole hierarchy up to date, and only objects whose own
+// transform or one of their ancestors changed get their matrix and bounds
+// recomputed.
+///////////////////////////////////////////////////////////////////////////////
+#define LOD_MAX_PIXEL_ERROR 1.0f
+#define MODEL_DEFAULT_SPECULAR 0.5f
+
+typedef struct {
+    mesh_lod lods[MESH_MAX_LODS];
+    int num_lods;
+    texture_handle* texture;
+    float specular; // strength of the highlights
+    mapped_file mapping; // baked file the levels point into, if any
+} model;
+
+typedef struct {
+    int model;
+    int parent; // -1 for objects placed directly in the world
+    float scale;
+    vec3d rotation;
+    vec3d spin; // radians per second around x, y and z
+    vec3d position;
+    float transparency; // 0 for opaque objects, drawn blended after them
+    bool dirty; // the transform changed since the last update
+    bool moved; // the world matrix changed in the last update
+    float world_scale;
+    mat4x4 world;
+} object;
+
+ARRAY_DEFINE(model_array, model)
+ARRAY_DEFINE(object_array, object)
+ARRAY_DEFINE(aabb_array, aabb)
+
+typedef struct {
+    model_array models;
+    object_array objects;
+    aabb_array object_bounds; // parallel to objects
+    bvh tree;
+    int_array moved_objects; // objects the last update moved
+
+    bool quantize_vertices; // store the vertices of models loaded from now on quantized
+} scene;
+
+void scene_init(scene* s) {
+    scene empty = { 0 };
+    *s = empty;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Make room for a number of objects in total, before placing many of them
+///////////////////////////////////////////////////////////////////////////////
+bool scene_reserve_objects(scene* s, int count) {
+    return object_array_reserve(&s->objects, count) && aabb_array_reserve(&s->object_bounds, count);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load a mesh file (baked .mesh or OBJ, or the cube when filename is NULL or
+// fails to load) with its LOD chain as a new model; returns its index or -1
+// A baked file already holds the whole chain in the float format, so it is
+// drawn from the mapping as it is; quantizing its levels copies them out.
+///////////////////////////////////////////////////////////////////////////////
+int scene_load_model(scene* s, const char* filename, texture_handle* texture) {
+    model loaded = { 0 };
+    loaded.texture = texture;
+    loaded.specular = MODEL_DEFAULT_SPECULAR;
+
+    size_t length = filename != NULL ? strlen(filename) : 0;
+    bool baked = length > 5 && strcmp(filename + length - 5, ".mesh") == 0;
+    if (baked)
+        loaded.num_lods = mesh_file_load(filename, loaded.lods, &loaded.mapping);
+    if (loaded.num_lods > 0 && s->quantize_vertices) {
+        for (int i = 0; i < loaded.num_lods; i++) {
+            mesh_lod mapped = loaded.lods[i];
+            quantize_mesh_lod(&mapped, &loaded.lods[i]);
+        }
+        unmap_file(&loaded.mapping);
+    }
+
+    if (loaded.num_lods == 0) {
+        mesh source_mesh;
+        bool mesh_loaded = filename != NULL && !baked && load_obj_mesh(filename, &source_mesh);
+        if (!mesh_loaded)
+            mesh_loaded = load_cube_mesh(&source_mesh);
+        if (!mesh_loaded)
+            return -1;
+        loaded.num_lods = load_mesh_lod_chain(&source_mesh, loaded.lods, s->quantize_vertices);
+        mesh_free(&source_mesh);
+    }
+
+    if (!model_array_push(&s->models, loaded)) {
+        for (int i = 0; i < loaded.num_lods; i++)
+            free_mesh_lod(&loaded.lods[i]);
+        unmap_file(&loaded.mapping);
+        return -1;
+    }
+
+    for (int i = 0; i < loaded.num_lods; i++)
+        printf("LOD %d: %d faces, error %.4f\n", i, loaded.lods[i].num_faces, loaded.lods[i].error);
+    return s->models.length - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// World-space bounding sphere of an object, from the bounds of its model
+///////////////////////////////////////////////////////////////////////////////
+vec3d object_bounds_center(const scene* s, const object* o) {
+    return transform_point_mat4x4(s->models.elements[o->model].lods[0].bounds_center, &o->world);
+}
+
+float object_bounds_radius(const scene* s, const object* o) {
+    return s->models.elements[o->model].lods[0].bounds_radius * o->world_scale;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Rebuild the world matrix and bounds of an object from its transform and
+// the world matrix of its parent
+///////////////////////////////////////////////////////////////////////////////
+void scene_place_object(scene* s, int index) {
+    object* o = &s->objects.elements[index];
+    o->world = world_mat4x4(o->scale, o->rotation, o->position);
+    o->world_scale = o->scale;
+    if (o->parent >= 0) {
+        const object* parent = &s->objects.elements[o->parent];
+        o->world = multiply_mat4x4(&o->world, &parent->world);
+        o->world_scale *= parent->world_scale;
+    }
+
+    vec3d center = object_bounds_center(s, o);
+    float radius = object_bounds_radius(s, o);
+    aabb bounds = {
+        { center.x - radius, center.y - radius, center.z - radius },
+        { center.x + radius, center.y + radius, center.z + radius }
+    };
+    s->object_bounds.elements[index] = bounds;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Place a copy of a model in the scene, attached to a parent object already
+// in it (or -1 for none); returns its index or -1
+///////////////////////////////////////////////////////////////////////////////
+int scene_add_child(scene* s, int parent, object placed) {
+    int index = s->objects.length;
+    if (placed.model < 0 || placed.model >= s->models.length || parent < -1 || parent >= index)
+        return -1;
+    if (!scene_reserve_objects(s, index + 1))
+        return -1;
+    placed.parent = parent;
+    placed.dirty = false;
+    placed.moved = false;
+    s->objects.elements[s->objects.length++] = placed;
+    s->object_bounds.length++;
+    scene_place_object(s, index);
+    return index;
+}
+
+int scene_add_object(scene* s, object placed) {
+    return scene_add_child(s, -1, placed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Change the transform of an object, relative to its parent
+///////////////////////////////////////////////////////////////////////////////
+void scene_set_transform(scene* s, int index, float scale, vec3d rotation, vec3d position) {
+    object* o = &s->objects.elements[index];
+    o->scale = scale;
+    o->rotation = rotation;
+    o->position = position;
+    o->dirty = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Advance the rotation of the spinning objects, rebuild the world matrix and
+// bounds of every object that moved itself or with an ancestor, and bring
+// the BVH up to date
+///////////////////////////////////////////////////////////////////////////////
+void scene_update(scene* s, float delta_time) {
+    int_array_clear(&s->moved_objects);
+    bool listed = int_array_reserve(&s->moved_objects, s->objects.length);
+    for (int i = 0; i < s->objects.length; i++) {
+        object* o = &s->objects.elements[i];
+        if (o->spin.x != 0 || o->spin.y != 0 || o->spin.z != 0) {
+            o->rotation.x += o->spin.x * delta_time;
+            o->rotation.y += o->spin.y * delta_time;
+            o->rotation.z += o->spin.z * delta_time;
+            o->dirty = true;
+        }
+
+        // Parents come first, so theirs is already this frame's flag
+        o->moved = o->dirty || (o->parent >= 0 && s->objects.elements[o->parent].moved);
+        o->dirty = false;
+        if (o->moved) {
+            scene_place_object(s, i);
+            if (listed)
+                s->moved_objects.elements[s->moved_objects.length++] = i;
+        }
+    }
+    if (s->moved_objects.length > 0 || !listed || s->tree.num_items != s->objects.length) {
+        bvh_update(&s->tree, s->object_bounds.elements, s->objects.length,
+                   listed ? s->moved_objects.elements : NULL, s->moved_objects.length);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Objects whose bounds touch the frustum; visible needs room for all objects
+///////////////////////////////////////////////////////////////////////////////
+int scene_cull(const scene* s, const frustum* f, int* visible) {
+    return bvh_cull(&s->tree, s->object_bounds.elements, f, visible);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Object whose bounds a ray hits first, or -1
+///////////////////////////////////////////////////////////////////////////////
+int scene_pick(const scene* s, vec3d origin, vec3d direction, float* distance) {
+    return bvh_pick(&s->tree, s->object_bounds.elements, origin, direction, distance);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pick the coarsest LOD level of a model whose error stays under
+// LOD_MAX_PIXEL_ERROR pixels, given the depth of the nearest point of the
+// object and the projection scale in pixels per unit at depth 1
+///////////////////////////////////////////////////////////////////////////////
+int model_select_lod(const model* m, float scale, float depth, float pixel_scale) {
+    float pixels_per_unit = pixel_scale * scale / depth;
+    int selected = 0;
+    for (int i = 1; i < m->num_lods; i++) {
+        if (m->lods[i].error * pixels_per_unit <= LOD_MAX_PIXEL_ERROR)
+            selected = i;
+    }
+    return selected;
+}
+
+void scene_free(scene* s) {
+    for (int i = 0; i < s->models.length; i++) {
+        for (int l = 0; l < s->models.elements[i].num_lods; l++)
+            free_mesh_lod(&s->models.elements[i].lods[l]);
+        unmap_file(&s->models.elements[i].mapping);
+    }
+    model_array_free(&s->models);
+    object_array_free(&s->objects);
+    aabb_array_free(&s->object_bounds);
+    int_array_free(&s->moved_objects);
+    bvh_free(&s->tree);
+    scene_init(s);
+}
+
+#endif
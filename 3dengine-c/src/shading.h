@@ -0,0 +1,410 @@
+#ifndef SHADING_H
+#define SHADING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "vector.h"
+#include "lighting.h"
+#include "gbuffer.h"
+#include "blend.h"
+#include "color_ramp.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Lighting of the filled triangles
+// Flat shading lights a whole face once, from its face normal. Gouraud
+// shading lights the three corners from their vertex normals and
+// interpolates the diffuse light across the face. Per-pixel shading
+// interpolates the normals instead, and lights every pixel with Lambert
+// diffuse plus a Blinn highlight from the lights listed in its light tile.
+// Deferred shading interpolates the normals the same way but only stores
+// them in the G-buffer with the color, leaving the lighting to a pass over
+// the whole screen once every triangle is drawn (see deferred.h).
+// Transparent triangles are blended over the color buffer instead of
+// replacing it: flat colors premultiplied once per triangle, smooth shaded
+// ones as straight colors.
+//
+// Pixels come from the depth buffer one run at a time: the part of a span
+// inside one tile (at most 8 pixels), with a mask of the ones that passed the
+// depth test. Colors are lit in 8.8 fixed point with each 8-bit channel
+// widened to a 16-bit lane, so one SSE2 register holds two pixels and a run
+// of four pixels is lit with two multiplies. Gamma-correct colors are lit
+// through the tables of color_ramp.h instead, one pixel at a time.
+///////////////////////////////////////////////////////////////////////////////
+#define SHADING_RUN_MAX 8
+
+typedef enum {
+    SHADING_FLAT,
+    SHADING_GOURAUD,
+    SHADING_PHONG,
+    SHADING_DEFERRED
+} shading_mode;
+
+// The run shading has an SSE2 version picked at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHADING_SIMD_X86 1
+#include <emmintrin.h>
+#define SHADING_TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// A value interpolated linearly over the screen: origin + d_dx * x + d_dy * y
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    float d_dx;
+    float d_dy;
+    float origin;
+} shading_plane;
+
+///////////////////////////////////////////////////////////////////////////////
+// Shading of the triangle being drawn: the caller fills in the mode, the
+// base color, the lights and (for smooth shading) the view-space positions
+// and normals of the vertices in the order of the triangle corners;
+// triangle_shading_begin sets up the rest
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    shading_mode mode;
+    uint32_t color;
+    const lighting* lights;
+    vec3d positions[3];
+    vec3d normals[3];
+    float specular; // strength of the highlights
+
+    // Deferred: where the pixels are stored, and their material
+    gbuffer* target;
+    uint8_t material;
+
+    // Blend over the color buffer by the alpha of the color
+    bool blend;
+    uint32_t premultiplied; // flat color with its alpha applied
+
+    // Gouraud: light intensity; per-pixel and deferred: the normal over the
+    // view depth
+    shading_plane planes[3];
+    bool simd;
+} triangle_shading;
+
+///////////////////////////////////////////////////////////////////////////////
+// Scale the red, green and blue channels of a color by a light factor,
+// clamped to [0, 1] so no channel can spill into its neighbour; the factor
+// picks one of the shade ramps of light_tables
+///////////////////////////////////////////////////////////////////////////////
+uint32_t apply_light(uint32_t color, float percentage_factor) {
+    if (!(percentage_factor > 0))
+        percentage_factor = 0;
+    if (percentage_factor > 1)
+        percentage_factor = 1;
+    return ramp_color(&light_tables, color, (uint32_t)(percentage_factor * 256));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Diffuse light reaching a surface point drawn at a screen position
+///////////////////////////////////////////////////////////////////////////////
+float light_diffuse(const lighting* lights, int x, int y, vec3d position, vec3d normal) {
+    int count;
+    const uint32_t* list = lighting_tile_lights(lights, x, y, &count);
+    float diffuse, specular;
+    light_surface(lights, list, count, position, normal, &diffuse, &specular);
+    return diffuse;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Plane through three screen points carrying a value each, or flat at the
+// first value when the triangle has no area
+///////////////////////////////////////////////////////////////////////////////
+shading_plane shading_plane_through(int x0, int y0, float a0, int x1, int y1, float a1, int x2, int y2, float a2) {
+    shading_plane plane = { 0, 0, a0 };
+    float area = (float)(x1 - x0) * (y2 - y0) - (float)(x2 - x0) * (y1 - y0);
+    if (area != 0) {
+        float inverse_area = 1 / area;
+        plane.d_dx = ((a1 - a0) * (y2 - y0) - (a2 - a0) * (y1 - y0)) * inverse_area;
+        plane.d_dy = ((a2 - a0) * (x1 - x0) - (a1 - a0) * (x2 - x0)) * inverse_area;
+        plane.origin = a0 - plane.d_dx * x0 - plane.d_dy * y0;
+    }
+    return plane;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Set up the interpolation of a triangle that passed the depth test, from
+// the screen position and view depth of its corners
+// Per-pixel normals are interpolated divided by the view depth, which makes
+// the interpolation perspective correct once they are normalized.
+///////////////////////////////////////////////////////////////////////////////
+void triangle_shading_begin(triangle_shading* shading, int x0, int y0, float w0, int x1, int y1, float w1, int x2, int y2, float w2) {
+#ifdef SHADING_SIMD_X86
+    shading->simd = __builtin_cpu_supports("sse2");
+#else
+    shading->simd = false;
+#endif
+    const vec3d* n = shading->normals;
+    const vec3d* p = shading->positions;
+    if (shading->blend)
+        shading->premultiplied = premultiply_color(shading->color);
+    if (shading->mode == SHADING_GOURAUD) {
+        shading->planes[0] = shading_plane_through(
+            x0, y0, light_diffuse(shading->lights, x0, y0, p[0], n[0]),
+            x1, y1, light_diffuse(shading->lights, x1, y1, p[1], n[1]),
+            x2, y2, light_diffuse(shading->lights, x2, y2, p[2], n[2]));
+    } else if (shading->mode == SHADING_PHONG || shading->mode == SHADING_DEFERRED) {
+        float z0 = 1 / w0, z1 = 1 / w1, z2 = 1 / w2;
+        shading->planes[0] = shading_plane_through(x0, y0, n[0].x * z0, x1, y1, n[1].x * z1, x2, y2, n[2].x * z2);
+        shading->planes[1] = shading_plane_through(x0, y0, n[0].y * z0, x1, y1, n[1].y * z1, x2, y2, n[2].y * z2);
+        shading->planes[2] = shading_plane_through(x0, y0, n[0].z * z0, x1, y1, n[1].z * z1, x2, y2, n[2].z * z2);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Light a color: every channel times diffuse / 256, plus specular, saturated
+///////////////////////////////////////////////////////////////////////////////
+uint32_t shade_color(uint32_t color, uint32_t diffuse, uint32_t specular) {
+    uint32_t result = color & 0xFF000000;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t channel = ((((color >> shift) & 0xFF) * diffuse) >> 8) + specular;
+        result |= (channel > 0xFF ? 0xFF : channel) << shift;
+    }
+    return result;
+}
+
+// The same in linear light when the tables are gamma correct
+uint32_t light_color(uint32_t color, uint32_t diffuse, uint32_t specular) {
+    if (light_tables.gamma)
+        return ramp_color_specular(&light_tables, color, diffuse, specular);
+    return shade_color(color, diffuse, specular);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Light the pixels of a run whose bit is set in `passed` (bit 0 is pixel x)
+// into shaded[0 .. count - 1], depth holding their 1/w
+// Per-pixel shading finds the view-space position of every pixel from its
+// depth, and evaluates the lights of the tile the run lies in.
+///////////////////////////////////////////////////////////////////////////////
+void shade_run_scalar(const triangle_shading* shading, int y, int x, int count, uint32_t passed, const float* depth, uint32_t* shaded) {
+    const shading_plane* planes = shading->planes;
+    if (shading->mode == SHADING_GOURAUD) {
+        float row = planes[0].origin + planes[0].d_dy * y;
+        for (int i = 0; i < count; i++) {
+            float diffuse = row + planes[0].d_dx * (float)(x + i);
+            diffuse = diffuse > 0 ? (diffuse < 1 ? diffuse : 1) : 0;
+            shaded[i] = light_color(shading->color, (uint32_t)(diffuse * 256), 0);
+        }
+        return;
+    }
+
+    const lighting* lights = shading->lights;
+    int num_lights;
+    const uint32_t* list = lighting_tile_lights(lights, x, y, &num_lights);
+    float view_y = ((float)y - lights->height * 0.5f) * lights->pixel_to_view_y;
+    float row_x = planes[0].origin + planes[0].d_dy * y;
+    float row_y = planes[1].origin + planes[1].d_dy * y;
+    float row_z = planes[2].origin + planes[2].d_dy * y;
+    for (int i = 0; i < count; i++) {
+        if (!(passed & (1u << i)))
+            continue;
+        float p = (float)(x + i);
+        float w = 1 / depth[i];
+        vec3d position = {
+            .x = ((p - lights->width * 0.5f) * lights->pixel_to_view_x) * w,
+            .y = view_y * w,
+            .z = w
+        };
+        vec3d normal = {
+            .x = row_x + planes[0].d_dx * p,
+            .y = row_y + planes[1].d_dx * p,
+            .z = row_z + planes[2].d_dx * p
+        };
+        float length = normal.x * normal.x + normal.y * normal.y + normal.z * normal.z;
+        float inverse_length = 1 / sqrtf(length > 1e-20f ? length : 1e-20f);
+        normal.x *= inverse_length;
+        normal.y *= inverse_length;
+        normal.z *= inverse_length;
+
+        float diffuse, specular;
+        light_surface(lights, list, num_lights, position, normal, &diffuse, &specular);
+        specular *= shading->specular;
+        diffuse = diffuse > 0 ? (diffuse < 1 ? diffuse : 1) : 0;
+        specular = specular > 0 ? (specular < 1 ? specular : 1) : 0;
+        shaded[i] = light_color(shading->color, (uint32_t)(diffuse * 256), (uint32_t)(specular * 255));
+    }
+}
+
+#ifdef SHADING_SIMD_X86
+// Lights four pixels given their diffuse (0-256) and specular (0-255) terms
+// as 32-bit lanes: the terms are narrowed to 16 bits and spread over the
+// four channel lanes of their pixel, then applied two pixels per register.
+// Gamma-correct colors are looked up one pixel at a time.
+SHADING_TARGET_SSE2 __m128i shade_colors_sse2(__m128i color, __m128i diffuse, __m128i specular) {
+    if (light_tables.gamma) {
+        uint32_t colors[4], diffuses[4], speculars[4];
+        _mm_storeu_si128((__m128i*) colors, color);
+        _mm_storeu_si128((__m128i*) diffuses, diffuse);
+        _mm_storeu_si128((__m128i*) speculars, specular);
+        for (int i = 0; i < 4; i++)
+            colors[i] = ramp_color_specular(&light_tables, colors[i], diffuses[i], speculars[i]);
+        return _mm_loadu_si128((const __m128i*) colors);
+    }
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i diffuse16 = _mm_packs_epi32(diffuse, diffuse);
+    diffuse16 = _mm_unpacklo_epi16(diffuse16, diffuse16);
+    __m128i specular16 = _mm_packs_epi32(specular, specular);
+    specular16 = _mm_unpacklo_epi16(specular16, specular16);
+
+    __m128i low = _mm_unpacklo_epi8(color, zero);
+    __m128i high = _mm_unpackhi_epi8(color, zero);
+    low = _mm_srli_epi16(_mm_mullo_epi16(low, _mm_unpacklo_epi32(diffuse16, diffuse16)), 8);
+    high = _mm_srli_epi16(_mm_mullo_epi16(high, _mm_unpackhi_epi32(diffuse16, diffuse16)), 8);
+    low = _mm_add_epi16(low, _mm_unpacklo_epi32(specular16, specular16));
+    high = _mm_add_epi16(high, _mm_unpackhi_epi32(specular16, specular16));
+    __m128i lit = _mm_packus_epi16(low, high);
+
+    // The alpha channel keeps its value
+    __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    return _mm_or_si128(_mm_andnot_si128(alpha, lit), _mm_and_si128(alpha, color));
+}
+
+// Same steps as shade_run_scalar, four pixels at a time; groups of four
+// where no pixel passed are skipped
+SHADING_TARGET_SSE2 void shade_run_sse2(const triangle_shading* shading, int y, int x, int count, uint32_t passed, const float* depth, uint32_t* shaded) {
+    const shading_plane* planes = shading->planes;
+    __m128i color = _mm_set1_epi32((int)shading->color);
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1);
+    __m128 xs = _mm_add_ps(_mm_set1_ps((float)x), _mm_set_ps(3, 2, 1, 0));
+
+    if (shading->mode == SHADING_GOURAUD) {
+        __m128 row = _mm_set1_ps(planes[0].origin + planes[0].d_dy * y);
+        __m128 d_dx = _mm_set1_ps(planes[0].d_dx);
+        for (int i = 0; i < count; i += 4) {
+            __m128 diffuse = _mm_add_ps(row, _mm_mul_ps(d_dx, xs));
+            diffuse = _mm_max_ps(_mm_min_ps(diffuse, one), zero);
+            __m128i diffuse_fixed = _mm_cvttps_epi32(_mm_mul_ps(diffuse, _mm_set1_ps(256)));
+            _mm_storeu_si128((__m128i*) &shaded[i], shade_colors_sse2(color, diffuse_fixed, _mm_setzero_si128()));
+            xs = _mm_add_ps(xs, _mm_set1_ps(4));
+        }
+        return;
+    }
+
+    const lighting* lights = shading->lights;
+    int num_lights;
+    const uint32_t* list = lighting_tile_lights(lights, x, y, &num_lights);
+    __m128 view_y = _mm_set1_ps(((float)y - lights->height * 0.5f) * lights->pixel_to_view_y);
+    __m128 half_width = _mm_set1_ps(lights->width * 0.5f);
+    __m128 pixel_to_view_x = _mm_set1_ps(lights->pixel_to_view_x);
+    __m128 row_x = _mm_set1_ps(planes[0].origin + planes[0].d_dy * y);
+    __m128 row_y = _mm_set1_ps(planes[1].origin + planes[1].d_dy * y);
+    __m128 row_z = _mm_set1_ps(planes[2].origin + planes[2].d_dy * y);
+
+    // The run may end past the last group of four, and the row with it
+    float run_depth[SHADING_RUN_MAX];
+    for (int i = 0; i < SHADING_RUN_MAX; i++)
+        run_depth[i] = i < count ? depth[i] : 1;
+
+    for (int i = 0; i < count; i += 4, xs = _mm_add_ps(xs, _mm_set1_ps(4))) {
+        if (!((passed >> i) & 0xF))
+            continue;
+        __m128 w = _mm_div_ps(one, _mm_loadu_ps(&run_depth[i]));
+        __m128 px = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(xs, half_width), pixel_to_view_x), w);
+        __m128 py = _mm_mul_ps(view_y, w);
+
+        __m128 nx = _mm_add_ps(row_x, _mm_mul_ps(_mm_set1_ps(planes[0].d_dx), xs));
+        __m128 ny = _mm_add_ps(row_y, _mm_mul_ps(_mm_set1_ps(planes[1].d_dx), xs));
+        __m128 nz = _mm_add_ps(row_z, _mm_mul_ps(_mm_set1_ps(planes[2].d_dx), xs));
+        __m128 length = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+        __m128 inverse_length = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(length, _mm_set1_ps(1e-20f))));
+        nx = _mm_mul_ps(nx, inverse_length);
+        ny = _mm_mul_ps(ny, inverse_length);
+        nz = _mm_mul_ps(nz, inverse_length);
+
+        __m128 diffuse, specular;
+        light_surface_sse2(lights, list, num_lights, px, py, w, nx, ny, nz, &diffuse, &specular);
+        specular = _mm_mul_ps(specular, _mm_set1_ps(shading->specular));
+        diffuse = _mm_max_ps(_mm_min_ps(diffuse, one), zero);
+        specular = _mm_max_ps(_mm_min_ps(specular, one), zero);
+        __m128i diffuse_fixed = _mm_cvttps_epi32(_mm_mul_ps(diffuse, _mm_set1_ps(256)));
+        __m128i specular_fixed = _mm_cvttps_epi32(_mm_mul_ps(specular, _mm_set1_ps(255)));
+        _mm_storeu_si128((__m128i*) &shaded[i], shade_colors_sse2(color, diffuse_fixed, specular_fixed));
+    }
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Store the pixels of a run whose bit is set in `passed` in the G-buffer
+// instead of lighting them; packing only keeps the direction of the
+// normal, so the normal over the view depth is stored as it is
+///////////////////////////////////////////////////////////////////////////////
+void shade_run_deferred(const triangle_shading* shading, int y, int x, int count, uint32_t passed) {
+    gbuffer* g = shading->target;
+    const shading_plane* planes = shading->planes;
+    float row_x = planes[0].origin + planes[0].d_dy * y;
+    float row_y = planes[1].origin + planes[1].d_dy * y;
+    float row_z = planes[2].origin + planes[2].d_dy * y;
+    int index = y * g->width + x;
+    for (int i = 0; i < count; i++) {
+        if (!(passed & (1u << i)))
+            continue;
+        float p = (float)(x + i);
+        vec3d normal = {
+            .x = row_x + planes[0].d_dx * p,
+            .y = row_y + planes[1].d_dx * p,
+            .z = row_z + planes[2].d_dx * p
+        };
+        g->albedo[index + i] = shading->color;
+        g->normals[index + i] = gbuffer_pack_normal(normal);
+        g->materials[index + i] = shading->material;
+    }
+}
+
+void shade_run(const triangle_shading* shading, int y, int x, int count, uint32_t passed, const float* depth, uint32_t* colors) {
+    if (shading->mode == SHADING_DEFERRED) {
+        shade_run_deferred(shading, y, x, count, passed);
+        return;
+    }
+    if (shading->mode == SHADING_FLAT) {
+        for (int i = 0; i < count; i++) {
+            if (passed & (1u << i))
+                colors[i] = shading->color;
+        }
+        return;
+    }
+
+    // Whole groups of four are lit into a scratch run, then copied through the mask
+    uint32_t shaded[SHADING_RUN_MAX];
+#ifdef SHADING_SIMD_X86
+    if (shading->simd)
+        shade_run_sse2(shading, y, x, count, passed, depth, shaded);
+    else
+#endif
+        shade_run_scalar(shading, y, x, count, passed, depth, shaded);
+    for (int i = 0; i < count; i++) {
+        if (passed & (1u << i))
+            colors[i] = shaded[i];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Shade the pixels of a run like shade_run, but blend them over colors; the
+// pixels that did not pass get a source with no alpha, which blends to
+// nothing, so whole runs go through the blend kernels
+///////////////////////////////////////////////////////////////////////////////
+void shade_run_blended(const triangle_shading* shading, int y, int x, int count, uint32_t passed, const float* depth, uint32_t* colors) {
+    uint32_t source[SHADING_RUN_MAX];
+    if (shading->mode == SHADING_FLAT) {
+        for (int i = 0; i < count; i++)
+            source[i] = passed & (1u << i) ? shading->premultiplied : 0;
+        blend_run(colors, source, count, true);
+        return;
+    }
+
+    uint32_t shaded[SHADING_RUN_MAX];
+#ifdef SHADING_SIMD_X86
+    if (shading->simd)
+        shade_run_sse2(shading, y, x, count, passed, depth, shaded);
+    else
+#endif
+        shade_run_scalar(shading, y, x, count, passed, depth, shaded);
+    for (int i = 0; i < count; i++)
+        source[i] = passed & (1u << i) ? shaded[i] : 0;
+    blend_run(colors, source, count, false);
+}
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+#include <stdbool.h>
+#include <math.h>
+#include "vector.h"
+#include "matrix.h"
+#include "depth_buffer.h"
+#include "lighting.h"
+#include "triangle.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Shadow maps
+// A directional or spot light that casts shadows gets a square depth buffer
+// seen from the light. Every frame the scene is drawn into it with the
+// depth-only rasterizer, and the shading looks the lit points up in it
+// through the light_shadow of the light.
+// A spot light is seen through a perspective projection covering its outer
+// cone, and a directional light through an orthographic one around the
+// whole scene. Only the faces turned away from the light are drawn, so the
+// surfaces facing it are compared with the back of their own object and do
+// not shadow themselves.
+///////////////////////////////////////////////////////////////////////////////
+#define SHADOW_MAP_SIZE 1024
+#define SHADOW_MAX_MAPS 4
+#define SHADOW_ZNEAR 0.1f
+
+typedef struct {
+    depth_buffer depth;
+    int light; // index of the light in its lighting
+    float pixel_scale; // texels per unit at depth 1, for picking LOD levels
+} shadow_map;
+
+bool shadow_map_init(shadow_map* map, int light, int size) {
+    map->light = light;
+    map->pixel_scale = 1;
+    return depth_buffer_init(&map->depth, size, size);
+}
+
+void shadow_map_free(shadow_map* map) {
+    depth_buffer_free(&map->depth);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Axes of a view looking along forward, turned like the camera when forward
+// is +z: right is +x and up is +y
+///////////////////////////////////////////////////////////////////////////////
+void shadow_view_axes(vec3d forward, vec3d* right, vec3d* up) {
+    vec3d world_up = { .x = 0, .y = 1, .z = 0 };
+    if (fabsf(forward.y) > 0.99f) {
+        world_up.x = 1;
+        world_up.y = 0;
+    }
+    right->x = world_up.y * forward.z - world_up.z * forward.y;
+    right->y = world_up.z * forward.x - world_up.x * forward.z;
+    right->z = world_up.x * forward.y - world_up.y * forward.x;
+    right->w = 0;
+    vector_normalize(right);
+    up->x = forward.y * right->z - forward.z * right->y;
+    up->y = forward.z * right->x - forward.x * right->z;
+    up->z = forward.x * right->y - forward.y * right->x;
+    up->w = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Point the shadow of a light at the map, seeing the scene in the sphere
+// (center, radius), and clear the map for this frame's casters
+// The spot light matrix gives texel * w in x and y and w in the last column.
+// The directional one keeps the scene between depths 0.25 and 0.75, its
+// farthest point at the back.
+///////////////////////////////////////////////////////////////////////////////
+void shadow_map_begin(shadow_map* map, light* source, vec3d center, float radius, bool pcf) {
+    int size = map->depth.width;
+    float half_size = size / 2.0f;
+    vec3d forward = source->direction;
+    if (source->type == LIGHT_DIRECTIONAL) {
+        forward.x = -forward.x;
+        forward.y = -forward.y;
+        forward.z = -forward.z;
+    }
+    vec3d right, up;
+    shadow_view_axes(forward, &right, &up);
+    float axes[3][3] = {
+        { right.x, right.y, right.z },
+        { up.x, up.y, up.z },
+        { forward.x, forward.y, forward.z }
+    };
+
+    mat4x4 m = { 0 };
+    if (source->type == LIGHT_SPOT) {
+        float sin_outer = sqrtf(fmaxf(1 - source->spot_cos_outer * source->spot_cos_outer, 1e-6f));
+        float scale = source->spot_cos_outer / sin_outer * half_size;
+        map->pixel_scale = scale;
+        vec3d p = source->position;
+        for (int row = 0; row < 3; row++) {
+            m.m[row][0] = axes[0][row] * scale + axes[2][row] * half_size;
+            m.m[row][1] = axes[1][row] * scale + axes[2][row] * half_size;
+            m.m[row][2] = axes[2][row];
+            m.m[row][3] = axes[2][row];
+        }
+        float to_x = -vector_dot(p, right), to_y = -vector_dot(p, up), to_z = -vector_dot(p, forward);
+        m.m[3][0] = to_x * scale + to_z * half_size;
+        m.m[3][1] = to_y * scale + to_z * half_size;
+        m.m[3][2] = to_z;
+        m.m[3][3] = to_z;
+    } else {
+        float scale = radius > 0 ? half_size / radius : 1;
+        float depth_scale = radius > 0 ? 0.25f / radius : 0;
+        map->pixel_scale = scale;
+        for (int row = 0; row < 3; row++) {
+            m.m[row][0] = axes[0][row] * scale;
+            m.m[row][1] = axes[1][row] * scale;
+            m.m[row][2] = -axes[2][row] * depth_scale;
+        }
+        m.m[3][0] = -vector_dot(center, right) * scale + half_size;
+        m.m[3][1] = -vector_dot(center, up) * scale + half_size;
+        m.m[3][2] = vector_dot(center, forward) * depth_scale + 0.5f;
+        m.m[3][3] = 1;
+    }
+
+    depth_buffer_clear(&map->depth);
+    light_shadow shadow = {
+        .depth = map->depth.pixels,
+        .size = size,
+        .matrix = m,
+        .perspective = source->type == LIGHT_SPOT,
+        .pcf = pcf
+    };
+    source->shadow = shadow;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Texel position of a point on the map, with the w the rasterizer expects in
+// .w; a w at or below 0 means the point cannot be drawn
+///////////////////////////////////////////////////////////////////////////////
+vec3d shadow_map_project(const light_shadow* shadow, const mat4x4* m, vec3d point) {
+    vec3d projected = {
+        .x = point.x * m->m[0][0] + point.y * m->m[1][0] + point.z * m->m[2][0] + m->m[3][0],
+        .y = point.x * m->m[0][1] + point.y * m->m[1][1] + point.z * m->m[2][1] + m->m[3][1],
+        .z = point.x * m->m[0][2] + point.y * m->m[1][2] + point.z * m->m[2][2] + m->m[3][2],
+        .w = point.x * m->m[0][3] + point.y * m->m[1][3] + point.z * m->m[2][3] + m->m[3][3]
+    };
+    if (shadow->perspective) {
+        if (projected.w < SHADOW_ZNEAR) {
+            projected.w = 0;
+            return projected;
+        }
+        projected.x /= projected.w;
+        projected.y /= projected.w;
+    } else {
+        projected.w = projected.z > 0 ? 1 / projected.z : 0;
+    }
+    return projected;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a face seen from the light into the map if it faces away from it;
+// the texel positions keep the winding of the screen, where the faces
+// towards the viewer have a negative area
+///////////////////////////////////////////////////////////////////////////////
+void shadow_map_draw_face(shadow_map* map, vec3d a, vec3d b, vec3d c) {
+    if (a.w <= 0 || b.w <= 0 || c.w <= 0)
+        return;
+    float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+    if (!(area > 0))
+        return;
+    draw_depth_triangle(&map->depth, a.x, a.y, a.w, b.x, b.y, b.w, c.x, c.y, c.w);
+}
+
+#endif
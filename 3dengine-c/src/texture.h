@@ -18,7 +18,6 @@ typedef struct {
 // Declare global variables for texture information
 ///////////////////////////////////////////////////////////////////////////////
 uint32_t* mesh_texture = NULL;
-upng_t* png_texture = NULL;
 
 int texture_width = 64;
 int texture_height = 64;
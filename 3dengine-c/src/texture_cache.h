@@ -0,0 +1,215 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file_map.h"
+
+#if defined(FILE_MAP_ENABLED)
+#define TEXTURE_CACHE_ENABLED 1
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Baked texture cache
+// Decoded textures are written to disk together with their mip chain, keyed
+// by a hash of the source PNG bytes. A warm start maps the cache file and
+// samples straight from it without inflating or unfiltering anything.
+//
+// File layout (every level starts on a 64-byte boundary):
+//   texture_cache_header | pad | level 0 pixels | pad | level 1 pixels | ...
+///////////////////////////////////////////////////////////////////////////////
+#define TEXTURE_CACHE_DIR "./cache"
+#define TEXTURE_CACHE_MAGIC 0x43584554 // "TEXC"
+#define TEXTURE_CACHE_VERSION 1
+#define TEXTURE_CACHE_ALIGNMENT 64
+#define TEXTURE_CACHE_MAX_LEVELS 16
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset;
+} texture_cache_level;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint32_t pixel_format;
+    uint32_t num_levels;
+    texture_cache_level levels[TEXTURE_CACHE_MAX_LEVELS];
+} texture_cache_header;
+
+///////////////////////////////////////////////////////////////////////////////
+// 64-bit FNV-1a hash of the source file contents
+///////////////////////////////////////////////////////////////////////////////
+uint64_t texture_cache_hash(const unsigned char* bytes, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void texture_cache_path(char* path, size_t length, uint64_t source_hash) {
+    snprintf(path, length, "%s/%016llx.tex", TEXTURE_CACHE_DIR, (unsigned long long)source_hash);
+}
+
+size_t texture_cache_align(size_t offset) {
+    return (offset + TEXTURE_CACHE_ALIGNMENT - 1) & ~(size_t)(TEXTURE_CACHE_ALIGNMENT - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Map the cache entry of a source file and check that it is complete
+///////////////////////////////////////////////////////////////////////////////
+bool texture_cache_load(uint64_t source_hash, uint64_t source_size, uint32_t pixel_format, mapped_file* file) {
+    char path[256];
+    texture_cache_path(path, sizeof(path), source_hash);
+    if (!map_file(path, file))
+        return false;
+
+    const texture_cache_header* header = (const texture_cache_header*) file->data;
+    bool valid = file->size >= sizeof(texture_cache_header) &&
+        header->magic == TEXTURE_CACHE_MAGIC &&
+        header->version == TEXTURE_CACHE_VERSION &&
+        header->source_hash == source_hash &&
+        header->source_size == source_size &&
+        header->pixel_format == pixel_format &&
+        header->num_levels >= 1 &&
+        header->num_levels <= TEXTURE_CACHE_MAX_LEVELS;
+
+    for (uint32_t i = 0; valid && i < header->num_levels; i++) {
+        const texture_cache_level* level = &header->levels[i];
+        uint64_t level_size = (uint64_t)level->width * level->height * sizeof(uint32_t);
+        valid = level->offset % TEXTURE_CACHE_ALIGNMENT == 0 && level->offset + level_size <= file->size;
+    }
+
+    if (!valid)
+        unmap_file(file);
+    return valid;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Box filter a 32-bit texture down to half its size, channel by channel
+///////////////////////////////////////////////////////////////////////////////
+void texture_cache_downsample(const uint8_t* src, int width, int height, uint8_t* dst, int dst_width, int dst_height) {
+    for (int y = 0; y < dst_height; y++) {
+        int y0 = y * 2;
+        int y1 = (y0 + 1 < height) ? y0 + 1 : y0;
+        for (int x = 0; x < dst_width; x++) {
+            int x0 = x * 2;
+            int x1 = (x0 + 1 < width) ? x0 + 1 : x0;
+            for (int c = 0; c < 4; c++) {
+                int sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c] +
+                          src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+                dst[(y * dst_width + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Write a decoded texture and its mip chain to the cache
+// The file is written under a temporary name and renamed into place, so a
+// concurrent or interrupted writer never leaves a half-written entry behind.
+///////////////////////////////////////////////////////////////////////////////
+bool texture_cache_store(uint64_t source_hash, uint64_t source_size, uint32_t pixel_format,
+                         const uint32_t* pixels, int width, int height) {
+#if defined(TEXTURE_CACHE_ENABLED)
+    texture_cache_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TEXTURE_CACHE_MAGIC;
+    header.version = TEXTURE_CACHE_VERSION;
+    header.source_hash = source_hash;
+    header.source_size = source_size;
+    header.pixel_format = pixel_format;
+
+    // Lay out the whole mip chain, down to 1x1
+    size_t offset = texture_cache_align(sizeof(texture_cache_header));
+    size_t scratch_size = 0;
+    int w = width, h = height;
+    while (header.num_levels < TEXTURE_CACHE_MAX_LEVELS) {
+        texture_cache_level* level = &header.levels[header.num_levels++];
+        level->width = w;
+        level->height = h;
+        level->offset = offset;
+        offset = texture_cache_align(offset + (size_t)w * h * sizeof(uint32_t));
+        if (header.num_levels > 1)
+            scratch_size += (size_t)w * h * sizeof(uint32_t);
+        if (w == 1 && h == 1)
+            break;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+
+    uint8_t* scratch = (uint8_t*) malloc(scratch_size > 0 ? scratch_size : 1);
+    if (!scratch)
+        return false;
+
+    mkdir(TEXTURE_CACHE_DIR, 0755);
+
+    char path[256];
+    char temp_path[300];
+    texture_cache_path(path, sizeof(path), source_hash);
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+
+    // mkstemp picks a name no other writer has, in this process or another
+    int fd = mkstemp(temp_path);
+    FILE* file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!file) {
+        if (fd >= 0) {
+            close(fd);
+            remove(temp_path);
+        }
+        free(scratch);
+        return false;
+    }
+    fchmod(fd, 0644);
+
+    static const uint8_t padding[TEXTURE_CACHE_ALIGNMENT] = { 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    size_t written = sizeof(header);
+
+    const uint8_t* level_pixels = (const uint8_t*) pixels;
+    uint8_t* next_pixels = scratch;
+    for (uint32_t i = 0; ok && i < header.num_levels; i++) {
+        const texture_cache_level* level = &header.levels[i];
+        size_t level_size = (size_t)level->width * level->height * sizeof(uint32_t);
+
+        ok = fwrite(padding, 1, level->offset - written, file) == level->offset - written &&
+             fwrite(level_pixels, 1, level_size, file) == level_size;
+        written = level->offset + level_size;
+
+        if (i + 1 < header.num_levels) {
+            const texture_cache_level* next = &header.levels[i + 1];
+            texture_cache_downsample(level_pixels, level->width, level->height, next_pixels, next->width, next->height);
+            level_pixels = next_pixels;
+            next_pixels += (size_t)next->width * next->height * sizeof(uint32_t);
+        }
+    }
+
+    ok = (fclose(file) == 0) && ok;
+    free(scratch);
+
+    if (!ok || rename(temp_path, path) != 0) {
+        remove(temp_path);
+        return false;
+    }
+    return true;
+#else
+    (void)source_hash;
+    (void)source_size;
+    (void)pixel_format;
+    (void)pixels;
+    (void)width;
+    (void)height;
+    return false;
+#endif
+}
+
+#endif
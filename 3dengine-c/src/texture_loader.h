@@ -0,0 +1,258 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "upng.h"
+#include "texture_cache.h"
+#include "texture_data.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Asynchronous texture loading
+// PNG files are decoded by a small pool of worker threads. Each request gets
+// a handle right away that hands out a placeholder texture until the decoded
+// pixels are ready, so startup does not wait on the decoder. Decoded images
+// go to the baked texture cache, so later runs skip decoding altogether.
+///////////////////////////////////////////////////////////////////////////////
+#define MAX_TEXTURE_LOADER_THREADS 8
+
+typedef enum {
+    TEXTURE_LOADING = 0,
+    TEXTURE_READY = 1,
+    TEXTURE_FAILED = 2
+} texture_state;
+
+typedef struct texture_handle {
+    const char* filename;
+    const uint32_t* placeholder;
+    int placeholder_width;
+    int placeholder_height;
+    const uint32_t* pixels;
+    int width;
+    int height;
+    upng_t* png;
+    mapped_file cache;
+    float load_ms; // how long the load took, once it is done
+    bool cache_hit; // whether it came from the texture cache
+    SDL_atomic_t state;
+    struct texture_handle* next;
+} texture_handle;
+
+typedef struct {
+    SDL_Thread* threads[MAX_TEXTURE_LOADER_THREADS];
+    int num_threads;
+    SDL_mutex* lock;
+    SDL_cond* wake;
+    texture_handle* queue_head;
+    texture_handle* queue_tail;
+    bool quit;
+} texture_loader;
+
+texture_loader loader;
+
+///////////////////////////////////////////////////////////////////////////////
+// Fill in the pixels of a handle, from the texture cache when the source file
+// has been seen before, or by decoding the PNG and baking it otherwise
+///////////////////////////////////////////////////////////////////////////////
+bool texture_load_pixels(texture_handle* handle, bool* cache_hit) {
+    mapped_file source = { NULL, 0 };
+    uint64_t source_hash = 0;
+    *cache_hit = false;
+
+    if (map_file(handle->filename, &source)) {
+        source_hash = texture_cache_hash((const unsigned char*) source.data, source.size);
+        if (texture_cache_load(source_hash, source.size, UPNG_OUTPUT_RGBA32, &handle->cache)) {
+            const texture_cache_header* header = (const texture_cache_header*) handle->cache.data;
+            handle->pixels = (const uint32_t*) ((const uint8_t*) handle->cache.data + header->levels[0].offset);
+            handle->width = header->levels[0].width;
+            handle->height = header->levels[0].height;
+            unmap_file(&source);
+            *cache_hit = true;
+            return true;
+        }
+    }
+
+    // Decode straight into the byte order of the SDL_PIXELFORMAT_RGBA32 color buffer,
+    // so any PNG color format ends up usable by the texture sampler
+    upng_t* png = source.data != NULL ?
+        upng_new_from_bytes((const unsigned char*) source.data, source.size) :
+        upng_new_from_file(handle->filename);
+    bool ok = png != NULL &&
+        upng_set_output(png, UPNG_OUTPUT_RGBA32, false) == UPNG_EOK &&
+        upng_decode(png) == UPNG_EOK;
+
+    if (!ok) {
+        if (png != NULL)
+            upng_free(png);
+        unmap_file(&source);
+        return false;
+    }
+
+    handle->png = png;
+    handle->pixels = (const uint32_t*) upng_get_buffer(png);
+    handle->width = upng_get_width(png);
+    handle->height = upng_get_height(png);
+
+    if (source.data != NULL) {
+        if (!texture_cache_store(source_hash, source.size, UPNG_OUTPUT_RGBA32, handle->pixels, handle->width, handle->height))
+            fprintf(stderr, "Error writing %s to the texture cache.\n", handle->filename);
+        unmap_file(&source);
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Worker thread: pop a pending handle, load it, and publish the result
+///////////////////////////////////////////////////////////////////////////////
+int texture_loader_worker(void* data) {
+    (void)data;
+    while (true) {
+        SDL_LockMutex(loader.lock);
+        while (!loader.quit && loader.queue_head == NULL)
+            SDL_CondWait(loader.wake, loader.lock);
+        if (loader.quit) {
+            SDL_UnlockMutex(loader.lock);
+            return 0;
+        }
+        texture_handle* handle = loader.queue_head;
+        loader.queue_head = handle->next;
+        if (loader.queue_head == NULL)
+            loader.queue_tail = NULL;
+        SDL_UnlockMutex(loader.lock);
+
+        // Time cold (decode) and warm (cache) loads for whoever wants to report them
+        Uint64 start = SDL_GetPerformanceCounter();
+        bool ok = texture_load_pixels(handle, &handle->cache_hit);
+        handle->load_ms = (float)((SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+        if (!ok)
+            fprintf(stderr, "Error loading texture %s.\n", handle->filename);
+
+        SDL_AtomicSet(&handle->state, ok ? TEXTURE_READY : TEXTURE_FAILED);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start the decode threads, leaving one core free for the main loop
+///////////////////////////////////////////////////////////////////////////////
+void texture_loader_init(void) {
+    loader.lock = SDL_CreateMutex();
+    loader.wake = SDL_CreateCond();
+    loader.queue_head = NULL;
+    loader.queue_tail = NULL;
+    loader.quit = false;
+
+    int num_threads = SDL_GetCPUCount() - 1;
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > MAX_TEXTURE_LOADER_THREADS) num_threads = MAX_TEXTURE_LOADER_THREADS;
+
+    loader.num_threads = 0;
+    for (int i = 0; i < num_threads; i++) {
+        SDL_Thread* thread = SDL_CreateThread(texture_loader_worker, "texture_loader", NULL);
+        if (!thread) {
+            fprintf(stderr, "Error creating texture loader thread.\n");
+            break;
+        }
+        loader.threads[loader.num_threads++] = thread;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Queue a PNG for decoding; the placeholder is used until it is ready
+///////////////////////////////////////////////////////////////////////////////
+texture_handle* texture_load_async(const char* filename, const uint32_t* placeholder, int width, int height) {
+    texture_handle* handle = (texture_handle*) malloc(sizeof(texture_handle));
+    if (!handle) {
+        fprintf(stderr, "Error trying to allocate memory for texture handle.\n");
+        return NULL;
+    }
+    handle->filename = filename;
+    handle->placeholder = placeholder;
+    handle->placeholder_width = width;
+    handle->placeholder_height = height;
+    handle->pixels = NULL;
+    handle->width = 0;
+    handle->height = 0;
+    handle->png = NULL;
+    handle->cache.data = NULL;
+    handle->cache.size = 0;
+    handle->next = NULL;
+    SDL_AtomicSet(&handle->state, TEXTURE_LOADING);
+
+    SDL_LockMutex(loader.lock);
+    if (loader.queue_tail)
+        loader.queue_tail->next = handle;
+    else
+        loader.queue_head = handle;
+    loader.queue_tail = handle;
+    SDL_CondSignal(loader.wake);
+    SDL_UnlockMutex(loader.lock);
+
+    return handle;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Query the current pixels and size of a texture (decoded or placeholder)
+// A NULL handle, from a request that could not be allocated, gets the
+// built-in red brick.
+///////////////////////////////////////////////////////////////////////////////
+#define TEXTURE_FALLBACK_SIZE 64
+
+bool texture_is_ready(texture_handle* handle) {
+    return handle != NULL && SDL_AtomicGet(&handle->state) == TEXTURE_READY;
+}
+
+uint32_t* texture_get_pixels(texture_handle* handle) {
+    if (handle == NULL)
+        return (uint32_t*) REDBRICK_TEXTURE;
+    if (texture_is_ready(handle))
+        return (uint32_t*) handle->pixels;
+    return (uint32_t*) handle->placeholder;
+}
+
+int texture_get_width(texture_handle* handle) {
+    if (handle == NULL)
+        return TEXTURE_FALLBACK_SIZE;
+    if (texture_is_ready(handle))
+        return handle->width;
+    return handle->placeholder_width;
+}
+
+int texture_get_height(texture_handle* handle) {
+    if (handle == NULL)
+        return TEXTURE_FALLBACK_SIZE;
+    if (texture_is_ready(handle))
+        return handle->height;
+    return handle->placeholder_height;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stop the workers; requests still in the queue are never decoded
+///////////////////////////////////////////////////////////////////////////////
+void texture_loader_shutdown(void) {
+    SDL_LockMutex(loader.lock);
+    loader.quit = true;
+    SDL_CondBroadcast(loader.wake);
+    SDL_UnlockMutex(loader.lock);
+
+    for (int i = 0; i < loader.num_threads; i++)
+        SDL_WaitThread(loader.threads[i], NULL);
+    loader.num_threads = 0;
+
+    SDL_DestroyCond(loader.wake);
+    SDL_DestroyMutex(loader.lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Release a handle; only valid once the loader has been shut down
+///////////////////////////////////////////////////////////////////////////////
+void texture_free(texture_handle* handle) {
+    if (handle == NULL)
+        return;
+    if (handle->png != NULL)
+        upng_free(handle->png);
+    unmap_file(&handle->cache);
+    free(handle);
+}
+
+#endif
@@ -3,17 +3,7 @@
 
 #include "graphics.h"
 #include "texture.h"
-
-///////////////////////////////////////////////////////////////////////////////
-// Type definition for Triangles
-///////////////////////////////////////////////////////////////////////////////
-typedef struct {
-    int a;
-    int b;
-    int c;
-    uint32_t color;
-    int face_index;
-} triangle;
+#include "depth_buffer.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 // Function to swap the value of two integer variables
@@ -41,10 +31,23 @@ float area_triangle(vec3d p1, vec3d p2, vec3d p3) {
     return cross_magnitude / 2;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Fill one span into the color buffer, blended over it for transparent
+// triangles, or only into the depth buffer when there is no shading
+///////////////////////////////////////////////////////////////////////////////
+void fill_span(depth_buffer* buffer, const depth_triangle* depth, int y, int x_start, int x_end, const triangle_shading* shading) {
+    if (!shading)
+        depth_triangle_span_depth(buffer, depth, y, x_start, x_end);
+    else if (shading->blend)
+        depth_triangle_span_blend(buffer, depth, y, x_start, x_end, color_buffer, shading);
+    else
+        depth_triangle_span(buffer, depth, y, x_start, x_end, color_buffer, shading);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Draw a filled a triangle with a flat bottom
 ///////////////////////////////////////////////////////////////////////////////
-void fill_flat_bottom_triangle(float x0, float y0, float x1, float y1, float x2, float y2, uint32_t color) {
+void fill_flat_bottom_triangle(depth_buffer* buffer, const depth_triangle* depth, float x0, float y0, float x1, float y1, float x2, float y2, const triangle_shading* shading) {
     float inv_slope_left = (x1 - x0) / (y1 - y0);
     float inv_slope_right = (x2 - x0) / (y2 - y0);
 
@@ -52,13 +55,7 @@ void fill_flat_bottom_triangle(float x0, float y0, float x1, float y1, float x2,
     float x_end = x0;
 
     for (int y = y0; y <= y1; y++) {
-        if (x_start <= x_end) {
-            for (int x = (int)x_start; x <= (int)x_end; x++)
-                draw_pixel(x, y, color);
-        } else {
-            for (int x = (int)x_end; x <= (int)x_start; x++)
-                draw_pixel(x, y, color);
-        }
+        fill_span(buffer, depth, y, (int)x_start, (int)x_end, shading);
         x_start += inv_slope_left;
         x_end += inv_slope_right;
     }
@@ -67,7 +64,7 @@ void fill_flat_bottom_triangle(float x0, float y0, float x1, float y1, float x2,
 ///////////////////////////////////////////////////////////////////////////////
 // Draw a filled a triangle with a flat top
 ///////////////////////////////////////////////////////////////////////////////
-void fill_flat_top_triangle(float x0, float y0, float x1, float y1, float x2, float y2, uint32_t color) {
+void fill_flat_top_triangle(depth_buffer* buffer, const depth_triangle* depth, float x0, float y0, float x1, float y1, float x2, float y2, const triangle_shading* shading) {
     float inv_slope_left = (x2 - x0) / (y2 - y0);
     float inv_slope_right = (x2 - x1) / (y2 - y1);
 
@@ -75,21 +72,72 @@ void fill_flat_top_triangle(float x0, float y0, float x1, float y1, float x2, fl
     float x_end = x1;
 
     for (int y = y0; y < y2; y++) {
-        if (x_start <= x_end) {
-            for (int x = (int)x_start; x <= (int)x_end; x++)
-                draw_pixel(x, y, color);
-        } else {
-            for (int x = (int)x_end; x <= (int)x_start; x++)
-                draw_pixel(x, y, color);
-        }
+        fill_span(buffer, depth, y, (int)x_start, (int)x_end, shading);
         x_start += inv_slope_left;
         x_end += inv_slope_right;
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// First pixel whose center lies at or right of where the edge from (x0, y0)
+// down to (x1, y1) crosses the center line of row y, worked out in integers
+// so that a crossing exactly on a pixel center always rounds the same way
+///////////////////////////////////////////////////////////////////////////////
+int edge_first_pixel(int x0, int y0, int x1, int y1, int y) {
+    int64_t dy = y1 - y0;
+    int64_t numerator = (int64_t)(x1 - x0) * (2 * (y - y0) + 1) - dy;
+    int64_t denominator = 2 * dy;
+    int64_t steps = numerator >= 0 ? (numerator + denominator - 1) / denominator : -((-numerator) / denominator);
+    return x0 + (int)steps;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fill a triangle with the top-left rule: a pixel is drawn when its center
+// is inside the triangle, or on its top or left edge. The rows and the
+// spans are half open, so a pixel on an edge shared by two triangles
+// belongs to exactly one of them. Blending needs this, as a pixel drawn
+// twice would be blended twice. Centers sit half a pixel off the integer
+// vertices, so no row center ever lies on a horizontal edge.
+///////////////////////////////////////////////////////////////////////////////
+void rasterize_triangle_top_left(depth_buffer* buffer, const depth_triangle* depth, int x0, int y0, int x1, int y1, int x2, int y2, const triangle_shading* shading) {
+    if (y0 > y1) {
+        swapi(&y0, &y1);
+        swapi(&x0, &x1);
+    }
+    if (y1 > y2) {
+        swapi(&y1, &y2);
+        swapi(&x1, &x2);
+    }
+    if (y0 > y1) {
+        swapi(&y0, &y1);
+        swapi(&x0, &x1);
+    }
+
+    // The middle vertex lies left of the long edge when this is positive
+    int64_t cross = (int64_t)(x2 - x0) * (y1 - y0) - (int64_t)(x1 - x0) * (y2 - y0);
+    if (cross == 0)
+        return;
+
+    int y_from = y0 > depth->y_min ? y0 : depth->y_min;
+    int y_to = y2 - 1 < depth->y_max ? y2 - 1 : depth->y_max;
+    for (int y = y_from; y <= y_to; y++) {
+        int long_edge = edge_first_pixel(x0, y0, x2, y2, y);
+        int short_edge = y < y1 ? edge_first_pixel(x0, y0, x1, y1, y) : edge_first_pixel(x1, y1, x2, y2, y);
+        int x_start = cross > 0 ? short_edge : long_edge;
+        int x_end = (cross > 0 ? long_edge : short_edge) - 1;
+        if (x_start <= x_end)
+            fill_span(buffer, depth, y, x_start, x_end, shading);
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Draw a filled triangle with the flat-top/flat-bottom method
 // We split the original triangle in two, half flat-bottom and half flat-top
+// The depth buffer rejects hidden triangles and tiles before any span is
+// walked, w being the view depth of each vertex, and the shading is only set
+// up for the triangles that survive. Without shading, rasterize_triangle
+// only writes depth. Blended triangles are filled with the top-left rule
+// instead.
 ///////////////////////////////////////////////////////////////////////////////
 //
 //        v0
@@ -107,7 +155,12 @@ void fill_flat_top_triangle(float x0, float y0, float x1, float y1, float x2, fl
 //                    v2
 //
 ///////////////////////////////////////////////////////////////////////////////
-void draw_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color) {
+void rasterize_triangle(depth_buffer* buffer, const depth_triangle* depth, int x0, int y0, int x1, int y1, int x2, int y2, const triangle_shading* shading) {
+    if (shading && shading->blend) {
+        rasterize_triangle_top_left(buffer, depth, x0, y0, x1, y1, x2, y2, shading);
+        return;
+    }
+
     // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
     if (y0 > y1) {
         swapi(&y0, &y1);
@@ -123,19 +176,40 @@ void draw_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32
     }
 
     if (y1 == y2) {
-        fill_flat_bottom_triangle(x0, y0, x1, y1, x2, y2, color);
+        fill_flat_bottom_triangle(buffer, depth, x0, y0, x1, y1, x2, y2, shading);
     } else if (y0 == y1) {
-        fill_flat_top_triangle(x0, y0, x1, y1, x2, y2, color);
+        fill_flat_top_triangle(buffer, depth, x0, y0, x1, y1, x2, y2, shading);
     } else {
         // Create a new vertex (x3,y3) using triangle similarity
         float x3 = (int)(x0 + ((float)(y1 - y0) / (float)(y2 - y0)) * (x2 - x0));
         float y3 = y1;
 
-        fill_flat_bottom_triangle(x0, y0, x1, y1, x3, y3, color);
-        fill_flat_top_triangle(x1, y1, x3, y3, x2, y2, color);
+        fill_flat_bottom_triangle(buffer, depth, x0, y0, x1, y1, x3, y3, shading);
+        fill_flat_top_triangle(buffer, depth, x1, y1, x3, y3, x2, y2, shading);
     }
 }
 
+void draw_filled_triangle(int x0, int y0, float w0, int x1, int y1, float w1, int x2, int y2, float w2, triangle_shading* shading) {
+    depth_triangle depth;
+    if (!depth_triangle_begin(&z_buffer, &depth, x0, y0, w0, x1, y1, w1, x2, y2, w2))
+        return;
+    triangle_shading_begin(shading, x0, y0, w0, x1, y1, w1, x2, y2, w2);
+    rasterize_triangle(&z_buffer, &depth, x0, y0, x1, y1, x2, y2, shading);
+    depth_triangle_end(&z_buffer, &depth);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a triangle into a depth buffer only, e.g. a shadow map: the same
+// setup and walk as draw_filled_triangle, with no color or texture work
+///////////////////////////////////////////////////////////////////////////////
+void draw_depth_triangle(depth_buffer* buffer, int x0, int y0, float w0, int x1, int y1, float w1, int x2, int y2, float w2) {
+    depth_triangle depth;
+    if (!depth_triangle_begin(buffer, &depth, x0, y0, w0, x1, y1, w1, x2, y2, w2))
+        return;
+    rasterize_triangle(buffer, &depth, x0, y0, x1, y1, x2, y2, NULL);
+    depth_triangle_end(buffer, &depth);
+}
+
 
 vec2d get_texel_coords(
     vec3d point_a, vec3d point_b, vec3d point_c, vec3d point_p,
@@ -195,6 +269,10 @@ void draw_textured_triangle(
     int x2, int y2, float z2, float w2, float u2, float v2,
     uint32_t* texture
 ) {
+    depth_triangle depth;
+    if (!depth_triangle_begin(&z_buffer, &depth, x0, y0, w0, x1, y1, w1, x2, y2, w2))
+        return;
+
     // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
     if (y1 < y0) {
         swapi(&y0, &y1);
@@ -250,6 +328,9 @@ void draw_textured_triangle(
             }
 
             for (int x = ax; x < bx; x++) {
+                if (!depth_triangle_pixel(&z_buffer, &depth, x, y))
+                    continue;
+
                 vec3d point_p = { .x = x, .y = y };
                 vec2d tex_coords = get_texel_coords(point_a, point_b, point_c, point_p, u0, v0, u1, v1, u2, v2);
 
@@ -278,6 +359,9 @@ void draw_textured_triangle(
             }
 
             for (int x = ax; x < bx; x++) {
+                if (!depth_triangle_pixel(&z_buffer, &depth, x, y))
+                    continue;
+
                 vec3d point_p = { .x = x, .y = y };
                 vec2d tex_coords = get_texel_coords(point_a, point_b, point_c, point_p, u0, v0, u1, v1, u2, v2);
 
@@ -286,6 +370,7 @@ void draw_textured_triangle(
             }
         }
     }
+    depth_triangle_end(&z_buffer, &depth);
 }
 
 #endif
@@ -24,13 +24,34 @@ freely, subject to the following restrictions:
 		distribution.
 */
 
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 
+/* on POSIX systems files are mapped read-only instead of being copied to the heap */
+#if defined(__unix__) || defined(__APPLE__)
+#define UPNG_USE_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "upng.h"
 
+/* SSE2/SSSE3 unfilter kernels are compiled per-function with target attributes
+ * and picked at runtime, so the rest of the file needs no special flags */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UPNG_SIMD_X86 1
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
 #define MAKE_BYTE(b) ((b) & 0xFF)
 #define MAKE_DWORD(a,b,c,d) ((MAKE_BYTE(a) << 24) | (MAKE_BYTE(b) << 16) | (MAKE_BYTE(c) << 8) | MAKE_BYTE(d))
 #define MAKE_DWORD_PTR(p) MAKE_DWORD((p)[0], (p)[1], (p)[2], (p)[3])
@@ -76,10 +97,16 @@ typedef enum upng_color {
 	UPNG_RGBA		= 6
 } upng_color;
 
+typedef enum upng_owner {
+	UPNG_BORROWED	= 0, /* caller keeps ownership of the bytes */
+	UPNG_HEAP		= 1, /* malloc'd copy, released with free() */
+	UPNG_MAPPED		= 2  /* read-only file mapping, released with munmap() */
+} upng_owner;
+
 typedef struct upng_source {
 	const unsigned char*	buffer;
 	unsigned long			size;
-	char					owning;
+	upng_owner				owning;
 } upng_source;
 
 struct upng_t {
@@ -96,6 +123,9 @@ struct upng_t {
 	upng_error		error;
 	unsigned		error_line;
 
+	upng_output		output;
+	int				premultiplied;
+
 	upng_state		state;
 	upng_source		source;
 };
@@ -537,7 +567,7 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 			start = (*pos);
 			backward = start - distance;
 
-			if ((*pos) + length >= outsize) {
+			if ((*pos) + length > outsize) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
@@ -582,7 +612,7 @@ static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long
 		return;
 	}
 
-	if ((*pos) + len >= outsize) {
+	if ((*pos) + len > outsize) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
@@ -688,6 +718,156 @@ static int paeth_predictor(int a, int b, int c)
 		return c;
 }
 
+#if defined(UPNG_SIMD_X86)
+
+#define UPNG_TARGET_SSE2 __attribute__((target("sse2")))
+#define UPNG_TARGET_SSSE3 __attribute__((target("ssse3")))
+
+static inline UPNG_TARGET_SSE2 __m128i load_pixel4(const unsigned char *p)
+{
+	int v;
+	memcpy(&v, p, 4);
+	return _mm_cvtsi32_si128(v);
+}
+
+static inline UPNG_TARGET_SSE2 void store_pixel4(unsigned char *p, __m128i v)
+{
+	int x = _mm_cvtsi128_si32(v);
+	memcpy(p, &x, 4);
+}
+
+/*Up filter, 32 bytes per step; works for any bytewidth since it never looks left*/
+static UPNG_TARGET_SSE2 void unfilter_up_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unsigned long i = 0;
+	for (; i + 32 <= length; i += 32) {
+		__m128i x0 = _mm_loadu_si128((const __m128i*)(scanline + i));
+		__m128i x1 = _mm_loadu_si128((const __m128i*)(scanline + i + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(precon + i));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(precon + i + 16));
+		_mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x0, b0));
+		_mm_storeu_si128((__m128i*)(recon + i + 16), _mm_add_epi8(x1, b1));
+	}
+	for (; i + 16 <= length; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(precon + i));
+		_mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x, b));
+	}
+	for (; i < length; i++)
+		recon[i] = scanline[i] + precon[i];
+}
+
+/*Sub filter for 4 bytes per pixel: the whole pixel is added to its left neighbour in one step*/
+static UPNG_TARGET_SSE2 void unfilter_sub4_sse2(unsigned char *recon, const unsigned char *scanline, unsigned long length)
+{
+	__m128i a = _mm_setzero_si128();
+	unsigned long i;
+	for (i = 0; i < length; i += 4) {
+		a = _mm_add_epi8(load_pixel4(scanline + i), a);
+		store_pixel4(recon + i, a);
+	}
+}
+
+/*Average filter for 4 bytes per pixel; _mm_avg_epu8 rounds up, so the carry bit is subtracted back out*/
+static UPNG_TARGET_SSE2 void unfilter_avg4_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	const __m128i one = _mm_set1_epi8(1);
+	__m128i a = _mm_setzero_si128();
+	unsigned long i;
+	for (i = 0; i < length; i += 4) {
+		__m128i b = load_pixel4(precon + i);
+		__m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+		a = _mm_add_epi8(load_pixel4(scanline + i), avg);
+		store_pixel4(recon + i, a);
+	}
+}
+
+/*
+   Paeth filter for 4 bytes per pixel, evaluated on 16-bit lanes without branches.
+   with p = a + b - c the three distances reduce to pa = |b - c|, pb = |a - c| and pc = |pa' + pb'|
+   (using the signed values), and the predictor is the first of a, b, c whose distance equals the minimum.
+   the two variants only differ in how the absolute value is computed.
+ */
+#define UNFILTER_PAETH4(name, target, abs16) \
+static target void name(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length) \
+{ \
+	const __m128i zero = _mm_setzero_si128(); \
+	__m128i a = zero, c = zero; \
+	unsigned long i; \
+	for (i = 0; i < length; i += 4) { \
+		__m128i b = _mm_unpacklo_epi8(load_pixel4(precon + i), zero); \
+		__m128i pa = _mm_sub_epi16(b, c); \
+		__m128i pb = _mm_sub_epi16(a, c); \
+		__m128i pc = _mm_add_epi16(pa, pb); \
+		__m128i smallest, pick_a, pick_b, pred, x; \
+		pa = abs16(pa); \
+		pb = abs16(pb); \
+		pc = abs16(pc); \
+		smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb)); \
+		pick_a = _mm_cmpeq_epi16(smallest, pa); \
+		pick_b = _mm_andnot_si128(pick_a, _mm_cmpeq_epi16(smallest, pb)); \
+		pred = _mm_or_si128(_mm_and_si128(pick_a, a), _mm_and_si128(pick_b, b)); \
+		pred = _mm_or_si128(pred, _mm_andnot_si128(_mm_or_si128(pick_a, pick_b), c)); \
+		x = _mm_add_epi8(load_pixel4(scanline + i), _mm_packus_epi16(pred, pred)); \
+		store_pixel4(recon + i, x); \
+		a = _mm_unpacklo_epi8(x, zero); \
+		c = b; \
+	} \
+}
+
+static inline UPNG_TARGET_SSE2 __m128i abs16_sse2(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+UNFILTER_PAETH4(unfilter_paeth4_sse2, UPNG_TARGET_SSE2, abs16_sse2)
+UNFILTER_PAETH4(unfilter_paeth4_ssse3, UPNG_TARGET_SSSE3, _mm_abs_epi16)
+
+/*
+   try to unfilter a scanline with the vectorized kernels. returns 0 when there is no kernel
+   for this filter type / bytewidth / cpu combination and the scalar code has to do it.
+ */
+static int unfilter_scanline_simd(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+{
+	if (!__builtin_cpu_supports("sse2")) {
+		return 0;
+	}
+
+	switch (filterType) {
+	case 0:
+		if (recon != scanline)
+			memmove(recon, scanline, length);
+		return 1;
+	case 1:
+		if (bytewidth != 4)
+			return 0;
+		unfilter_sub4_sse2(recon, scanline, length);
+		return 1;
+	case 2:
+		if (precon == NULL)
+			return 0;
+		unfilter_up_sse2(recon, scanline, precon, length);
+		return 1;
+	case 3:
+		if (bytewidth != 4 || precon == NULL)
+			return 0;
+		unfilter_avg4_sse2(recon, scanline, precon, length);
+		return 1;
+	case 4:
+		if (bytewidth != 4 || precon == NULL)
+			return 0;
+		if (__builtin_cpu_supports("ssse3"))
+			unfilter_paeth4_ssse3(recon, scanline, precon, length);
+		else
+			unfilter_paeth4_sse2(recon, scanline, precon, length);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+#endif /*defined(UPNG_SIMD_X86)*/
+
 static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
 {
 	/*
@@ -699,6 +879,13 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	 */
 
 	unsigned long i;
+
+#if defined(UPNG_SIMD_X86)
+	if (unfilter_scanline_simd(recon, scanline, precon, bytewidth, filterType, length)) {
+		return;
+	}
+#endif
+
 	switch (filterType) {
 	case 0:
 		for (i = 0; i < length; i++)
@@ -807,6 +994,197 @@ static void remove_padding_bits(unsigned char *out, const unsigned char *in, uns
 	}
 }
 
+/*
+   Conversion of unfiltered scanlines to 32-bit output pixels.
+   for every output byte position (R, G, B, A) we know which byte of a source pixel feeds it,
+   16-bit samples use their most significant (first) byte, and a missing alpha becomes 255.
+ */
+#define UPNG_NO_ALPHA -1
+
+static void output_channel_offsets(const upng_t* upng, int offsets[4])
+{
+	int bpc = upng->color_depth == 16 ? 2 : 1;
+	switch (upng->color_type) {
+	case UPNG_LUM:
+		offsets[0] = offsets[1] = offsets[2] = 0;
+		offsets[3] = UPNG_NO_ALPHA;
+		break;
+	case UPNG_LUMA:
+		offsets[0] = offsets[1] = offsets[2] = 0;
+		offsets[3] = bpc;
+		break;
+	case UPNG_RGB:
+		offsets[0] = 0;
+		offsets[1] = bpc;
+		offsets[2] = 2 * bpc;
+		offsets[3] = UPNG_NO_ALPHA;
+		break;
+	default:
+		offsets[0] = 0;
+		offsets[1] = bpc;
+		offsets[2] = 2 * bpc;
+		offsets[3] = 3 * bpc;
+		break;
+	}
+}
+
+/*exact c * a / 255 with rounding, the same formula is used by the SIMD path*/
+static unsigned char premultiply(unsigned c, unsigned a)
+{
+	unsigned t = c * a + 128;
+	return (unsigned char)((t + (t >> 8)) >> 8);
+}
+
+static void store_output_pixel(const upng_t* upng, unsigned char *out, unsigned r, unsigned g, unsigned b, unsigned a)
+{
+	if (upng->premultiplied) {
+		r = premultiply(r, a);
+		g = premultiply(g, a);
+		b = premultiply(b, a);
+	}
+
+	if (upng->output == UPNG_OUTPUT_ARGB8888) {
+		unsigned int word = (a << 24) | (r << 16) | (g << 8) | b;
+		memcpy(out, &word, 4);
+	} else {
+		out[0] = (unsigned char)r;
+		out[1] = (unsigned char)g;
+		out[2] = (unsigned char)b;
+		out[3] = (unsigned char)a;
+	}
+}
+
+/*convert pixels [first, w) of one scanline; handles every bit depth, including the packed 1/2/4 bit ones*/
+static void convert_scanline_scalar(const upng_t* upng, unsigned char *out, const unsigned char *in, unsigned first, unsigned w)
+{
+	unsigned depth = upng->color_depth;
+	unsigned components = upng_get_components(upng);
+	unsigned x;
+
+	if (depth >= 8) {
+		unsigned long stride = components * (depth / 8);
+		int offsets[4];
+		output_channel_offsets(upng, offsets);
+		for (x = first; x < w; x++) {
+			const unsigned char *pixel = in + x * stride;
+			unsigned a = offsets[3] == UPNG_NO_ALPHA ? 255 : pixel[offsets[3]];
+			store_output_pixel(upng, out + x * 4, pixel[offsets[0]], pixel[offsets[1]], pixel[offsets[2]], a);
+		}
+	} else {
+		/* packed samples, most significant bits first; scale them up to the full 0..255 range */
+		unsigned max = (1u << depth) - 1;
+		for (x = first; x < w; x++) {
+			unsigned long bit = (unsigned long)x * components * depth;
+			unsigned l = (in[bit >> 3] >> (8 - depth - (bit & 7))) & max;
+			unsigned a = 255;
+			l = l * 255 / max;
+			if (components == 2) {
+				bit += depth;
+				a = ((in[bit >> 3] >> (8 - depth - (bit & 7))) & max) * 255 / max;
+			}
+			store_output_pixel(upng, out + x * 4, l, l, l, a);
+		}
+	}
+}
+
+#if defined(UPNG_SIMD_X86)
+/*
+   SSSE3 conversion: one pshufb moves the samples of up to 4 source pixels into place,
+   alpha is forced to 255 for formats without one, and premultiplication runs on 16-bit lanes.
+   returns the number of pixels converted, the caller finishes the rest with the scalar code.
+ */
+static UPNG_TARGET_SSSE3 unsigned convert_scanline_ssse3(const upng_t* upng, unsigned char *out, const unsigned char *in, unsigned w)
+{
+	unsigned long stride = upng_get_components(upng) * (upng->color_depth / 8);
+	unsigned per_step = stride <= 4 ? 4 : 2;
+	unsigned long rowbytes = stride * w;
+	static const int rgba_order[4] = { 0, 1, 2, 3 };
+	static const int bgra_order[4] = { 2, 1, 0, 3 };	/* 0xAARRGGBB on a little-endian cpu */
+	const int *order = upng->output == UPNG_OUTPUT_ARGB8888 ? bgra_order : rgba_order;
+	unsigned char shuffle_bytes[16], alpha_bytes[16], alpha_fill_bytes[16];
+	__m128i shuffle, alpha_broadcast, alpha_fill;
+	int offsets[4];
+	unsigned x, p, c;
+
+	output_channel_offsets(upng, offsets);
+	for (p = 0; p < 4; p++) {
+		for (c = 0; c < 4; c++) {
+			int channel = order[c];
+			unsigned char *dst = &shuffle_bytes[p * 4 + c];
+			if (p >= per_step || offsets[channel] == UPNG_NO_ALPHA)
+				*dst = 0x80;
+			else
+				*dst = (unsigned char)(p * stride + offsets[channel]);
+			alpha_fill_bytes[p * 4 + c] = (channel == 3 && offsets[3] == UPNG_NO_ALPHA) ? 0xFF : 0;
+			/* the alpha lane gets multiplied by 255, which leaves it unchanged */
+			alpha_bytes[p * 4 + c] = channel == 3 ? 0x80 : (unsigned char)(p * 4 + 3);
+		}
+	}
+	shuffle = _mm_loadu_si128((const __m128i*)shuffle_bytes);
+	alpha_fill = _mm_loadu_si128((const __m128i*)alpha_fill_bytes);
+	alpha_broadcast = _mm_loadu_si128((const __m128i*)alpha_bytes);
+
+	for (x = 0; x + per_step <= w && x * stride + 16 <= rowbytes; x += per_step) {
+		__m128i px = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + x * stride)), shuffle);
+		px = _mm_or_si128(px, alpha_fill);
+
+		if (upng->premultiplied) {
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i bias = _mm_set1_epi16(128);
+			__m128i alpha = _mm_or_si128(_mm_shuffle_epi8(px, alpha_broadcast), _mm_cmpeq_epi8(alpha_broadcast, _mm_set1_epi8((char)0x80)));
+			__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(px, zero), _mm_unpacklo_epi8(alpha, zero)), bias);
+			__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(px, zero), _mm_unpackhi_epi8(alpha, zero)), bias);
+			lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+			px = _mm_packus_epi16(lo, hi);
+		}
+
+		if (per_step == 4)
+			_mm_storeu_si128((__m128i*)(out + x * 4), px);
+		else
+			_mm_storel_epi64((__m128i*)(out + x * 4), px);
+	}
+	return x;
+}
+#endif
+
+static void convert_scanline(const upng_t* upng, unsigned char *out, const unsigned char *in, unsigned w)
+{
+	unsigned first = 0;
+#if defined(UPNG_SIMD_X86)
+	if (upng->color_depth >= 8 && __builtin_cpu_supports("ssse3")) {
+		first = convert_scanline_ssse3(upng, out, in, w);
+	}
+#endif
+	convert_scanline_scalar(upng, out, in, first, w);
+}
+
+/*
+   unfilter each scanline in place and convert it to the output format right away, while it is still in cache.
+   in keeps the unfiltered rows so the next scanline can use them as its predecessor.
+ */
+static void unfilter_convert(upng_t* upng, unsigned char *out, unsigned char *in, unsigned w, unsigned h, unsigned bpp)
+{
+	unsigned y;
+	unsigned char *prevline = 0;
+
+	unsigned long bytewidth = (bpp + 7) / 8;
+	unsigned long linebytes = (w * bpp + 7) / 8;
+
+	for (y = 0; y < h; y++) {
+		unsigned char *line = &in[(1 + linebytes) * y + 1];
+		unsigned char filterType = line[-1];
+
+		unfilter_scanline(upng, line, line, prevline, bytewidth, filterType, linebytes);
+		if (upng->error != UPNG_EOK) {
+			return;
+		}
+
+		convert_scanline(upng, &out[(unsigned long)w * 4 * y], line, w);
+		prevline = line;
+	}
+}
+
 /*out must be buffer big enough to contain full image, and in must contain the full decompressed data from the IDAT chunks*/
 static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned char *in, const upng_t* info_png)
 {
@@ -819,6 +1197,11 @@ static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned ch
 		return;
 	}
 
+	if (upng->output != UPNG_OUTPUT_NATIVE) {
+		unfilter_convert(upng, out, in, w, h, bpp);
+		return;
+	}
+
 	if (bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8) {
 		unfilter(upng, in, in, w, h, bpp);
 		if (upng->error != UPNG_EOK) {
@@ -842,6 +1225,8 @@ static upng_format determine_format(upng_t* upng) {
 			return UPNG_LUMINANCE4;
 		case 8:
 			return UPNG_LUMINANCE8;
+		case 16:
+			return UPNG_LUMINANCE16;
 		default:
 			return UPNG_BADFORMAT;
 		}
@@ -864,6 +1249,8 @@ static upng_format determine_format(upng_t* upng) {
 			return UPNG_LUMINANCE_ALPHA4;
 		case 8:
 			return UPNG_LUMINANCE_ALPHA8;
+		case 16:
+			return UPNG_LUMINANCE_ALPHA16;
 		default:
 			return UPNG_BADFORMAT;
 		}
@@ -883,13 +1270,18 @@ static upng_format determine_format(upng_t* upng) {
 
 static void upng_free_source(upng_t* upng)
 {
-	if (upng->source.owning != 0) {
+	if (upng->source.owning == UPNG_HEAP) {
 		free((void*)upng->source.buffer);
 	}
+#if defined(UPNG_USE_MMAP)
+	else if (upng->source.owning == UPNG_MAPPED) {
+		munmap((void*)upng->source.buffer, upng->source.size);
+	}
+#endif
 
 	upng->source.buffer = NULL;
 	upng->source.size = 0;
-	upng->source.owning = 0;
+	upng->source.owning = UPNG_BORROWED;
 }
 
 /*read the information from the header and store it in the upng_Info. return value is error*/
@@ -1066,7 +1458,7 @@ upng_error upng_decode(upng_t* upng)
 	}
 
 	/* allocate space to store inflated (but still filtered) data */
-	inflated_size = ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) + upng->height;
+	inflated_size = upng->height * ((upng->width * upng_get_bpp(upng) + 7) / 8) + upng->height;
 	inflated = (unsigned char*)malloc(inflated_size);
 	if (inflated == NULL) {
 		free(compressed);
@@ -1086,7 +1478,10 @@ upng_error upng_decode(upng_t* upng)
 	free(compressed);
 
 	/* allocate final image buffer */
-	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
+	if (upng->output != UPNG_OUTPUT_NATIVE)
+		upng->size = upng->height * upng->width * 4;
+	else
+		upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
 	upng->buffer = (unsigned char*)malloc(upng->size);
 	if (upng->buffer == NULL) {
 		free(inflated);
@@ -1131,6 +1526,9 @@ static upng_t* upng_new(void)
 	upng->color_depth = 8;
 	upng->format = UPNG_RGBA8;
 
+	upng->output = UPNG_OUTPUT_NATIVE;
+	upng->premultiplied = 0;
+
 	upng->state = UPNG_NEW;
 
 	upng->error = UPNG_EOK;
@@ -1138,7 +1536,7 @@ static upng_t* upng_new(void)
 
 	upng->source.buffer = NULL;
 	upng->source.size = 0;
-	upng->source.owning = 0;
+	upng->source.owning = UPNG_BORROWED;
 
 	return upng;
 }
@@ -1152,11 +1550,42 @@ upng_t* upng_new_from_bytes(const unsigned char* buffer, unsigned long size)
 
 	upng->source.buffer = buffer;
 	upng->source.size = size;
-	upng->source.owning = 0;
+	upng->source.owning = UPNG_BORROWED;
 
 	return upng;
 }
 
+#if defined(UPNG_USE_MMAP)
+/*map the whole file read-only; returns 0 when mapping is not possible and the file should be read instead*/
+static int upng_map_file(upng_t* upng, const char *filename)
+{
+	struct stat st;
+	void *mapping;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		close(fd);
+		return 0;
+	}
+
+	mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);	/* the mapping keeps its own reference to the file */
+	if (mapping == MAP_FAILED) {
+		return 0;
+	}
+
+	upng->source.buffer = (const unsigned char*)mapping;
+	upng->source.size = (unsigned long)st.st_size;
+	upng->source.owning = UPNG_MAPPED;
+	return 1;
+}
+#endif
+
 upng_t* upng_new_from_file(const char *filename)
 {
 	upng_t* upng;
@@ -1169,6 +1598,13 @@ upng_t* upng_new_from_file(const char *filename)
 		return NULL;
 	}
 
+#if defined(UPNG_USE_MMAP)
+	/* reference the page cache directly instead of holding a heap copy of the file */
+	if (upng_map_file(upng, filename)) {
+		return upng;
+	}
+#endif
+
 	file = fopen(filename, "rb");
 	if (file == NULL) {
 		SET_ERROR(upng, UPNG_ENOTFOUND);
@@ -1193,7 +1629,7 @@ upng_t* upng_new_from_file(const char *filename)
 	/* set the read buffer as our source buffer, with owning flag set */
 	upng->source.buffer = buffer;
 	upng->source.size = size;
-	upng->source.owning = 1;
+	upng->source.owning = UPNG_HEAP;
 
 	return upng;
 }
@@ -1212,6 +1648,23 @@ void upng_free(upng_t* upng)
 	free(upng);
 }
 
+/*choose the pixel layout upng_decode writes; must be called before decoding*/
+upng_error upng_set_output(upng_t* upng, upng_output output, int premultiplied)
+{
+	if (upng->state == UPNG_DECODED || output < UPNG_OUTPUT_NATIVE || output > UPNG_OUTPUT_ARGB8888) {
+		return UPNG_EPARAM;
+	}
+
+	/* premultiplying only makes sense once the pixels have a known 8-bit layout */
+	if (output == UPNG_OUTPUT_NATIVE && premultiplied) {
+		return UPNG_EPARAM;
+	}
+
+	upng->output = output;
+	upng->premultiplied = premultiplied != 0;
+	return UPNG_EOK;
+}
+
 upng_error upng_get_error(const upng_t* upng)
 {
 	return upng->error;
@@ -52,15 +52,27 @@ typedef enum upng_format {
 	UPNG_LUMINANCE_ALPHA1,
 	UPNG_LUMINANCE_ALPHA2,
 	UPNG_LUMINANCE_ALPHA4,
-	UPNG_LUMINANCE_ALPHA8
+	UPNG_LUMINANCE_ALPHA8,
+	UPNG_LUMINANCE16,
+	UPNG_LUMINANCE_ALPHA16
 } upng_format;
 
+/* pixel layout of the decoded buffer; anything but NATIVE expands every
+ * supported PNG format to 4 bytes per pixel while scanlines are unfiltered */
+typedef enum upng_output {
+	UPNG_OUTPUT_NATIVE,		/* same layout as the PNG data (default) */
+	UPNG_OUTPUT_RGBA32,		/* bytes R, G, B, A in memory */
+	UPNG_OUTPUT_ARGB8888	/* native-endian 32-bit words 0xAARRGGBB */
+} upng_output;
+
 typedef struct upng_t upng_t;
 
 upng_t*		upng_new_from_bytes	(const unsigned char* buffer, unsigned long size);
 upng_t*		upng_new_from_file	(const char* path);
 void		upng_free			(upng_t* upng);
 
+upng_error	upng_set_output		(upng_t* upng, upng_output output, int premultiplied);
+
 upng_error	upng_header			(upng_t* upng);
 upng_error	upng_decode			(upng_t* upng);
 
@@ -0,0 +1,226 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "vector.h"
+#include "matrix.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Quantized vertex storage
+// Positions are kept as 16-bit fractions of the bounding box of the mesh and
+// unit normals as two 8-bit octahedral coordinates, so a whole vertex takes
+// 8 bytes against 16 for a vec3d position and 16 more for a vec3d normal.
+// UVs are kept as 16-bit fractions of the range they cover.
+//
+// A quantized value decodes to offset + q * scale. For positions, that
+// decoding is folded into the world matrix (see quantized_position_matrix),
+// so transforming the raw integers costs no more than transforming floats.
+///////////////////////////////////////////////////////////////////////////////
+#define QUANTIZED_MAX 65535.0f
+#define OCTAHEDRAL_MAX 255.0f
+
+typedef struct {
+    uint16_t position[3];
+    uint8_t normal[2];
+} quantized_vertex;
+
+typedef struct {
+    float offset[3];
+    float scale[3];
+} quantization;
+
+// The transform has an SSE2 version picked at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VERTEX_FORMAT_SIMD_X86 1
+#include <emmintrin.h>
+#define VERTEX_FORMAT_TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Quantization spreading the 16-bit range over [min, max] on each component
+///////////////////////////////////////////////////////////////////////////////
+quantization quantization_from_range(const float* min, const float* max, int components) {
+    quantization q = { { 0, 0, 0 }, { 0, 0, 0 } };
+    for (int i = 0; i < components; i++) {
+        q.offset[i] = min[i];
+        q.scale[i] = max[i] > min[i] ? (max[i] - min[i]) / QUANTIZED_MAX : 0;
+    }
+    return q;
+}
+
+uint16_t quantize_component(float value, const quantization* q, int component) {
+    if (q->scale[component] == 0)
+        return 0;
+    float units = (value - q->offset[component]) / q->scale[component] + 0.5f;
+    if (units <= 0)
+        return 0;
+    if (units >= QUANTIZED_MAX)
+        return (uint16_t)QUANTIZED_MAX;
+    return (uint16_t)units;
+}
+
+float dequantize_component(uint16_t value, const quantization* q, int component) {
+    return q->offset[component] + value * q->scale[component];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Octahedral normals: the unit sphere is projected onto the octahedron
+// |x| + |y| + |z| = 1, whose lower half is folded over the upper one, and
+// the resulting square is stored at 8 bits per axis
+///////////////////////////////////////////////////////////////////////////////
+float octahedral_sign(float value) {
+    return value >= 0 ? 1.0f : -1.0f;
+}
+
+void octahedral_encode(vec3d normal, uint8_t encoded[2]) {
+    float length = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+    if (length == 0) {
+        encoded[0] = encoded[1] = 128;
+        return;
+    }
+    float u = normal.x / length;
+    float v = normal.y / length;
+    if (normal.z < 0) {
+        float folded_u = (1 - fabsf(v)) * octahedral_sign(u);
+        v = (1 - fabsf(u)) * octahedral_sign(v);
+        u = folded_u;
+    }
+    encoded[0] = (uint8_t)((u * 0.5f + 0.5f) * OCTAHEDRAL_MAX + 0.5f);
+    encoded[1] = (uint8_t)((v * 0.5f + 0.5f) * OCTAHEDRAL_MAX + 0.5f);
+}
+
+// The point on the octahedron, before normalizing
+vec3d octahedral_unfold(const uint8_t encoded[2]) {
+    float u = encoded[0] / OCTAHEDRAL_MAX * 2 - 1;
+    float v = encoded[1] / OCTAHEDRAL_MAX * 2 - 1;
+    vec3d normal = { .x = u, .y = v, .z = 1 - fabsf(u) - fabsf(v), .w = 0 };
+    if (normal.z < 0) {
+        normal.x = (1 - fabsf(v)) * octahedral_sign(u);
+        normal.y = (1 - fabsf(u)) * octahedral_sign(v);
+    }
+    return normal;
+}
+
+vec3d octahedral_decode(const uint8_t encoded[2]) {
+    vec3d normal = octahedral_unfold(encoded);
+    vector_normalize(&normal);
+    return normal;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// World matrix that takes quantized positions (as floats) straight to world
+// space: every row of the model axes is scaled by the quantization step, and
+// the offset is moved into the translation
+///////////////////////////////////////////////////////////////////////////////
+mat4x4 quantized_position_matrix(const quantization* q, const mat4x4* world) {
+    mat4x4 result = *world;
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 3; row++) {
+            result.m[row][column] = q->scale[row] * world->m[row][column];
+            result.m[3][column] += q->offset[row] * world->m[row][column];
+        }
+    }
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Transform the listed quantized vertices with a matrix from
+// quantized_position_matrix, writing each one to out[index]
+// When normals_out is given, the normals are decoded in the same pass,
+// turned by normal_m (the world matrix: only its rotation and uniform scale
+// are used) and normalized into normals_out[index]. Normalizing after the
+// turn rather than before gives the same direction and divides the scale out.
+///////////////////////////////////////////////////////////////////////////////
+void transform_quantized_vertices_scalar(const quantized_vertex* vertices, const uint32_t* indices, int count, const mat4x4* m, vec3d* out, const mat4x4* normal_m, vec3d* normals_out) {
+    for (int k = 0; k < count; k++) {
+        const quantized_vertex* vertex = &vertices[indices[k]];
+        vec3d position = {
+            .x = vertex->position[0], .y = vertex->position[1], .z = vertex->position[2], .w = 1
+        };
+        out[indices[k]] = transform_point_mat4x4(position, m);
+        if (normals_out) {
+            vec3d normal = transform_direction_mat4x4(octahedral_unfold(vertex->normal), normal_m);
+            vector_normalize(&normal);
+            normals_out[indices[k]] = normal;
+        }
+    }
+}
+
+#ifdef VERTEX_FORMAT_SIMD_X86
+// Widens the three 16-bit components of a vertex at once and sums the
+// matrix rows in the same order as transform_point_mat4x4, so both versions
+// give the same result. The two normal bytes come in the same 8-byte load;
+// they are unfolded with masks instead of branches, with the same float
+// operations as octahedral_unfold.
+VERTEX_FORMAT_TARGET_SSE2 void transform_quantized_vertices_sse2(const quantized_vertex* vertices, const uint32_t* indices, int count, const mat4x4* m, vec3d* out, const mat4x4* normal_m, vec3d* normals_out) {
+    __m128 row0 = _mm_loadu_ps(m->m[0]);
+    __m128 row1 = _mm_loadu_ps(m->m[1]);
+    __m128 row2 = _mm_loadu_ps(m->m[2]);
+    __m128 row3 = _mm_loadu_ps(m->m[3]);
+    __m128i zero = _mm_setzero_si128();
+    __m128 normal_row0 = _mm_setzero_ps();
+    __m128 normal_row1 = _mm_setzero_ps();
+    __m128 normal_row2 = _mm_setzero_ps();
+    if (normals_out) {
+        normal_row0 = _mm_loadu_ps(normal_m->m[0]);
+        normal_row1 = _mm_loadu_ps(normal_m->m[1]);
+        normal_row2 = _mm_loadu_ps(normal_m->m[2]);
+    }
+    __m128 sign_bit = _mm_set1_ps(-0.0f);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 two = _mm_set1_ps(2.0f);
+    __m128 octahedral_max = _mm_set1_ps(OCTAHEDRAL_MAX);
+    for (int k = 0; k < count; k++) {
+        uint32_t index = indices[k];
+        __m128i packed = _mm_loadl_epi64((const __m128i*) &vertices[index]);
+        __m128 q = _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, zero));
+        __m128 x = _mm_shuffle_ps(q, q, _MM_SHUFFLE(0, 0, 0, 0));
+        __m128 y = _mm_shuffle_ps(q, q, _MM_SHUFFLE(1, 1, 1, 1));
+        __m128 z = _mm_shuffle_ps(q, q, _MM_SHUFFLE(2, 2, 2, 2));
+        __m128 p = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, row0), _mm_mul_ps(y, row1)), _mm_mul_ps(z, row2)), row3);
+        _mm_storeu_ps(&out[index].x, p);
+        out[index].w = 1;
+
+        if (normals_out) {
+            // Bytes 6 and 7 of the vertex, as (u, v, u, v)
+            __m128i bytes = _mm_unpackhi_epi16(_mm_unpacklo_epi8(packed, zero), zero);
+            __m128 encoded = _mm_cvtepi32_ps(bytes);
+            encoded = _mm_shuffle_ps(encoded, encoded, _MM_SHUFFLE(3, 2, 3, 2));
+            __m128 uv = _mm_sub_ps(_mm_mul_ps(_mm_div_ps(encoded, octahedral_max), two), one);
+            __m128 absolute = _mm_andnot_ps(sign_bit, uv);
+            // (1 - |u|, 1 - |v|, ...) and z = 1 - |u| - |v| in every lane
+            __m128 rest = _mm_sub_ps(one, absolute);
+            __m128 nz = _mm_sub_ps(rest, _mm_shuffle_ps(absolute, absolute, _MM_SHUFFLE(1, 1, 1, 1)));
+            nz = _mm_shuffle_ps(nz, nz, _MM_SHUFFLE(0, 0, 0, 0));
+            // The folded (x, y) is ((1 - |v|) * sign(u), (1 - |u|) * sign(v))
+            __m128 negative = _mm_and_ps(_mm_cmplt_ps(uv, _mm_setzero_ps()), sign_bit);
+            __m128 folded = _mm_xor_ps(_mm_shuffle_ps(rest, rest, _MM_SHUFFLE(0, 1, 0, 1)), negative);
+            __m128 fold = _mm_cmplt_ps(nz, _mm_setzero_ps());
+            __m128 nxy = _mm_or_ps(_mm_and_ps(fold, folded), _mm_andnot_ps(fold, uv));
+            __m128 nx = _mm_shuffle_ps(nxy, nxy, _MM_SHUFFLE(0, 0, 0, 0));
+            __m128 ny = _mm_shuffle_ps(nxy, nxy, _MM_SHUFFLE(1, 1, 1, 1));
+            __m128 n = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, normal_row0), _mm_mul_ps(ny, normal_row1)), _mm_mul_ps(nz, normal_row2));
+            __m128 squares = _mm_mul_ps(n, n);
+            __m128 length = _mm_add_ss(_mm_add_ss(squares, _mm_shuffle_ps(squares, squares, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(squares, squares));
+            length = _mm_sqrt_ss(length);
+            n = _mm_div_ps(n, _mm_shuffle_ps(length, length, _MM_SHUFFLE(0, 0, 0, 0)));
+            _mm_storeu_ps(&normals_out[index].x, n);
+            normals_out[index].w = 0;
+        }
+    }
+}
+#endif
+
+void transform_quantized_vertices(const quantized_vertex* vertices, const uint32_t* indices, int count, const mat4x4* m, vec3d* out, const mat4x4* normal_m, vec3d* normals_out) {
+#ifdef VERTEX_FORMAT_SIMD_X86
+    if (__builtin_cpu_supports("sse2")) {
+        transform_quantized_vertices_sse2(vertices, indices, count, m, out, normal_m, normals_out);
+        return;
+    }
+#endif
+    transform_quantized_vertices_scalar(vertices, indices, count, m, out, normal_m, normals_out);
+}
+
+#endif
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "arraylist.h"
+#include "array.h"
+#include "vector.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Microbenchmark of the typed arrays against the old pointer arraylist
+// Each case fills, walks and empties a list the way the engine used to (a
+// list of pointers into separately allocated elements) and the way it does
+// now (elements stored inline), and prints the time both took.
+//
+// Usage: array_benchmark [element count]
+///////////////////////////////////////////////////////////////////////////////
+#define BENCHMARK_DEFAULT_COUNT 1000000
+#define BENCHMARK_REMOVE_COUNT 20000
+
+ARRAY_DEFINE(vec3d_array, vec3d)
+
+vec3d benchmark_element(int i) {
+    vec3d v = { .x = (float)i, .y = (float)(i % 7), .z = (float)(i % 13), .w = 1 };
+    return v;
+}
+
+double seconds_since(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void print_result(const char* name, double old_time, double new_time, double checksum) {
+    printf("%-34s arraylist %8.2f ms   array %8.2f ms   %6.1fx   (%g)\n",
+        name, old_time * 1000, new_time * 1000, new_time > 0 ? old_time / new_time : 0, checksum);
+}
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : BENCHMARK_DEFAULT_COUNT;
+    if (count <= 0) {
+        fprintf(stderr, "Usage: %s [element count]\n", argv[0]);
+        return 1;
+    }
+
+    // Elements the old list points to, and the source of the bulk copies
+    vec3d* storage = (vec3d*) malloc(sizeof(vec3d) * count);
+    vec3d* source = (vec3d*) malloc(sizeof(vec3d) * count);
+    if (!storage || !source) {
+        fprintf(stderr, "Error trying to allocate memory for the benchmark.\n");
+        return 1;
+    }
+    for (int i = 0; i < count; i++)
+        source[i] = benchmark_element(i);
+
+    // Add one element at a time, as the loaders do
+    arraylist list;
+    vec3d_array array;
+    clock_t start = clock();
+    arraylist_init(&list);
+    for (int i = 0; i < count; i++) {
+        storage[i] = benchmark_element(i);
+        arraylist_add(&list, &storage[i]);
+    }
+    double old_time = seconds_since(start);
+    start = clock();
+    vec3d_array_init(&array);
+    for (int i = 0; i < count; i++)
+        vec3d_array_push(&array, benchmark_element(i));
+    double new_time = seconds_since(start);
+    print_result("push one at a time", old_time, new_time, array.length);
+
+    // Walk every element
+    double old_sum = 0, new_sum = 0;
+    start = clock();
+    for (int i = 0; i < arraylist_length(&list); i++)
+        old_sum += ((vec3d*) arraylist_get(&list, i))->y;
+    old_time = seconds_since(start);
+    start = clock();
+    for (int i = 0; i < array.length; i++)
+        new_sum += array.elements[i].y;
+    new_time = seconds_since(start);
+    print_result("iterate", old_time, new_time, new_sum - old_sum);
+    arraylist_free(&list);
+    vec3d_array_free(&array);
+
+    // Copy a whole block in, e.g. the vertices of a mesh
+    start = clock();
+    vec3d* block = (vec3d*) malloc(sizeof(vec3d) * count);
+    if (!block) {
+        fprintf(stderr, "Error trying to allocate memory for the benchmark.\n");
+        return 1;
+    }
+    memcpy(block, source, sizeof(vec3d) * count);
+    arraylist_init(&list);
+    arraylist_resize(&list, count);
+    for (int i = 0; i < count; i++)
+        arraylist_add(&list, &block[i]);
+    old_time = seconds_since(start);
+    start = clock();
+    vec3d_array_init(&array);
+    vec3d_array_reserve(&array, count);
+    vec3d_array_append(&array, source, count);
+    new_time = seconds_since(start);
+    print_result("reserve and bulk append", old_time, new_time, array.length);
+    arraylist_free(&list);
+    free(block);
+    vec3d_array_free(&array);
+
+    // Remove elements at pseudo-random positions until the list is empty
+    int removals = count < BENCHMARK_REMOVE_COUNT ? count : BENCHMARK_REMOVE_COUNT;
+    uint32_t seed = 12345;
+    arraylist_init(&list);
+    for (int i = 0; i < removals; i++)
+        arraylist_add(&list, &storage[i]);
+    start = clock();
+    while (list.length > 0) {
+        seed = seed * 1664525u + 1013904223u;
+        arraylist_remove(&list, (int)(seed >> 8) % list.length);
+    }
+    old_time = seconds_since(start);
+    seed = 12345;
+    vec3d_array_init(&array);
+    vec3d_array_append(&array, source, removals);
+    start = clock();
+    while (array.length > 0) {
+        seed = seed * 1664525u + 1013904223u;
+        vec3d_array_swap_remove(&array, (int)(seed >> 8) % array.length);
+    }
+    new_time = seconds_since(start);
+    print_result("remove all at random positions", old_time, new_time, removals);
+    arraylist_free(&list);
+    vec3d_array_free(&array);
+
+    free(storage);
+    free(source);
+    return 0;
+}
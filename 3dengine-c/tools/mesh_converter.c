@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "vector.h"
+#include "mesh.h"
+#include "obj_loader.h"
+#include "mesh_data.h"
+#include "mesh_file.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Offline converter from OBJ files (or the built-in cube) to baked .mesh files
+// Meshes are reordered for vertex locality, split into meshlets and
+// simplified into their LOD chain before they are written, so the engine
+// does none of that work when it loads them.
+//
+// Usage: mesh_converter <input.obj | --cube> <output.mesh>
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <input.obj | --cube> <output.mesh>\n", argv[0]);
+        return 1;
+    }
+
+    mesh source;
+    bool loaded = strcmp(argv[1], "--cube") == 0 ?
+        load_cube_mesh(&source) :
+        load_obj_mesh(argv[1], &source);
+    if (!loaded) {
+        fprintf(stderr, "Error loading %s.\n", argv[1]);
+        return 1;
+    }
+
+    mesh_lod lods[MESH_MAX_LODS];
+    int num_lods = load_mesh_lod_chain(&source, lods, false);
+    mesh_free(&source);
+
+    bool ok = mesh_file_write(argv[2], lods, num_lods);
+    if (ok) {
+        printf("Wrote %s:\n", argv[2]);
+        for (int i = 0; i < num_lods; i++)
+            printf("LOD %d: %d vertices, %d faces, %d meshlets, error %.4f\n", i, lods[i].num_vertices, lods[i].num_faces, lods[i].num_meshlets, lods[i].error);
+    }
+    for (int i = 0; i < num_lods; i++)
+        free_mesh_lod(&lods[i]);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include "triangle.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Microbenchmark of the triangle rasterizers
+// The same set of random triangles is drawn into a cleared depth buffer by
+// the textured path, the flat filled path and the depth-only path shadow
+// maps use, and the time each took per triangle is printed. All three
+// reject the same hidden triangles and tiles, so the difference is the
+// color and texture work the depth-only path skips.
+//
+// Usage: raster_benchmark [triangle count] [rounds]
+///////////////////////////////////////////////////////////////////////////////
+#define BENCHMARK_DEFAULT_TRIANGLES 20000
+#define BENCHMARK_DEFAULT_ROUNDS 20
+#define BENCHMARK_MAX_SIZE 60 // pixels across a triangle
+
+typedef struct {
+    int x[3], y[3];
+    float w[3];
+    float u[3], v[3];
+} benchmark_triangle;
+
+enum {
+    BENCHMARK_TEXTURED,
+    BENCHMARK_FILLED,
+    BENCHMARK_DEPTH,
+    BENCHMARK_PATHS
+};
+
+float benchmark_random(void) {
+    return rand() / (float)RAND_MAX;
+}
+
+double seconds_since(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void draw_benchmark_triangle(const benchmark_triangle* t, int path) {
+    if (path == BENCHMARK_TEXTURED) {
+        draw_textured_triangle(
+            t->x[0], t->y[0], t->w[0], t->w[0], t->u[0], t->v[0],
+            t->x[1], t->y[1], t->w[1], t->w[1], t->u[1], t->v[1],
+            t->x[2], t->y[2], t->w[2], t->w[2], t->u[2], t->v[2],
+            mesh_texture
+        );
+    } else if (path == BENCHMARK_FILLED) {
+        triangle_shading shading = { .mode = SHADING_FLAT, .color = 0xFF8080FF };
+        draw_filled_triangle(
+            t->x[0], t->y[0], t->w[0],
+            t->x[1], t->y[1], t->w[1],
+            t->x[2], t->y[2], t->w[2],
+            &shading
+        );
+    } else {
+        draw_depth_triangle(&z_buffer,
+            t->x[0], t->y[0], t->w[0],
+            t->x[1], t->y[1], t->w[1],
+            t->x[2], t->y[2], t->w[2]
+        );
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : BENCHMARK_DEFAULT_TRIANGLES;
+    int rounds = argc > 2 ? atoi(argv[2]) : BENCHMARK_DEFAULT_ROUNDS;
+    if (count <= 0 || rounds <= 0) {
+        fprintf(stderr, "Usage: %s [triangle count] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    color_buffer = (uint32_t*) malloc(sizeof(uint32_t) * window_width * window_height);
+    mesh_texture = (uint32_t*) malloc(sizeof(uint32_t) * texture_width * texture_height);
+    benchmark_triangle* triangles = (benchmark_triangle*) malloc(sizeof(benchmark_triangle) * count);
+    if (!color_buffer || !mesh_texture || !triangles || !depth_buffer_init(&z_buffer, window_width, window_height)) {
+        fprintf(stderr, "Error trying to allocate memory for the benchmark.\n");
+        return 1;
+    }
+    for (int i = 0; i < texture_width * texture_height; i++)
+        mesh_texture[i] = (i * 2654435761u) | 0xFF000000;
+
+    // Triangles scattered over the screen at random depths, with UVs kept
+    // inside the texture
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        benchmark_triangle* t = &triangles[i];
+        float center_x = benchmark_random() * window_width;
+        float center_y = benchmark_random() * window_height;
+        float depth = 2 + benchmark_random() * 48;
+        for (int k = 0; k < 3; k++) {
+            t->x[k] = (int)(center_x + (benchmark_random() - 0.5f) * BENCHMARK_MAX_SIZE);
+            t->y[k] = (int)(center_y + (benchmark_random() - 0.5f) * BENCHMARK_MAX_SIZE);
+            t->w[k] = depth + benchmark_random();
+            t->u[k] = 0.05f + 0.9f * benchmark_random();
+            t->v[k] = 0.05f + 0.9f * benchmark_random();
+        }
+    }
+
+    const char* names[BENCHMARK_PATHS] = { "textured", "filled (flat)", "depth only" };
+    double seconds[BENCHMARK_PATHS];
+    for (int path = 0; path < BENCHMARK_PATHS; path++) {
+        clock_t start = clock();
+        for (int r = 0; r < rounds; r++) {
+            depth_buffer_clear(&z_buffer);
+            for (int i = 0; i < count; i++)
+                draw_benchmark_triangle(&triangles[i], path);
+        }
+        seconds[path] = seconds_since(start);
+    }
+
+    double checksum = 0;
+    for (int i = 0; i < (int)(window_width * window_height); i++)
+        checksum += z_buffer.pixels[i];
+
+    int drawn = count * rounds;
+    for (int path = 0; path < BENCHMARK_PATHS; path++) {
+        printf("%-16s %8.1f ns per triangle   %5.1fx faster than textured\n",
+            names[path], seconds[path] * 1e9 / drawn,
+            seconds[path] > 0 ? seconds[BENCHMARK_TEXTURED] / seconds[path] : 0);
+    }
+    printf("(%g)\n", checksum);
+
+    depth_buffer_free(&z_buffer);
+    free(triangles);
+    free(mesh_texture);
+    free(color_buffer);
+    return 0;
+}